@@ -0,0 +1,210 @@
+/**
+Shared by the host benchmarks: timing, and the SCuM images they run on.
+
+Built-in images, 64KiB each, from a fixed seed:
+- "code":   Cortex-M0 code all the way, Thumb instructions, BL pairs,
+            literal pools of peripheral and SRAM addresses, some strings
+- "padded": 16KiB of the same, then zeros, as an SRAM dump of a small
+            program
+Image files given on the command line are used as well.
+*/
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//=========================== defines =========================================
+
+#define BENCH_IMAGE_SIZE            (64*1024) // SCuM's SRAM, SCUM_IMAGE_SIZE
+#define BENCH_IMAGES_MAX            8
+#define BENCH_MIN_TIME              0.3       // seconds per measurement
+
+//=========================== typedef =========================================
+
+typedef struct {
+    const char*    name;
+    uint8_t*       buf;
+    uint32_t       len;
+} bench_image_t;
+
+typedef void (*bench_fn_t)(void* ctx);
+
+//=========================== variables =======================================
+
+static uint32_t bench_seed = 0x5c0de;
+
+//=========================== helpers =========================================
+
+static double bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+// seconds per call of fn, over at least BENCH_MIN_TIME
+static double bench_time(bench_fn_t fn, void* ctx) {
+    double   start;
+    double   elapsed;
+    uint32_t n;
+    uint32_t i;
+
+    fn(ctx);
+    n = 1;
+    while (1) {
+        start   = bench_now();
+        for (i=0;i<n;i++) {
+            fn(ctx);
+        }
+        elapsed = bench_now()-start;
+        if (elapsed>=BENCH_MIN_TIME) {
+            return elapsed/n;
+        }
+        n      *= 2;
+    }
+}
+
+// xorshift32
+static uint32_t bench_rand(void) {
+    bench_seed ^= bench_seed<<13;
+    bench_seed ^= bench_seed>>17;
+    bench_seed ^= bench_seed<<5;
+    return bench_seed;
+}
+
+static void bench_put16(uint8_t* buf, uint32_t* i, uint32_t len, uint16_t v) {
+    if (*i+2<=len) {
+        buf[(*i)++] = v & 0xff;
+        buf[(*i)++] = v >> 8;
+    }
+}
+
+static void bench_put32(uint8_t* buf, uint32_t* i, uint32_t len, uint32_t v) {
+    bench_put16(buf, i, len, v & 0xffff);
+    bench_put16(buf, i, len, v >> 16);
+}
+
+// code as a compiler lays it out: functions, each followed by its literals
+static void bench_image_code(uint8_t* buf, uint32_t len) {
+    static const char* strings[] = {
+        "SCuM ready\r\n", "rx pkt len=%d crc=%d\r\n", "calibration done, IF=%d\r\n",
+        "radio timeout\r\n", "%08x %08x %08x %08x\r\n",
+    };
+    uint16_t vocab[64];
+    uint32_t i;
+    uint32_t k;
+    uint32_t end;
+    uint32_t num;
+    uint32_t lit;
+
+    // the instructions a program uses most, picked with a skew
+    for (k=0;k<64;k++) {
+        vocab[k] = bench_rand() & 0xffff;
+    }
+    vocab[0] = 0x4770;      // bx lr
+    vocab[1] = 0x2000;      // movs r0, #0
+    vocab[2] = 0x6800;      // ldr r0, [r0]
+    vocab[3] = 0x6008;      // str r0, [r1]
+    vocab[4] = 0x4a00;      // ldr r2, [pc, #0]
+    vocab[5] = 0xd100;      // bne
+    vocab[6] = 0x1c40;      // adds r0, r0, #1
+    vocab[7] = 0x4288;      // cmp r0, r1
+
+    i = 0;
+    while (i<len*9/10) {
+        // prologue, body, epilogue
+        bench_put16(buf, &i, len, 0xb500 | (bench_rand() & 0xff));
+        end = i+16+bench_rand()%240;
+        while (i<end) {
+            k = bench_rand();
+            if ((k & 0xff)<16) {
+                // bl, to somewhere in the image
+                num = (bench_rand()%len)/2;
+                bench_put16(buf, &i, len, 0xf000 | ((num>>11) & 0x7ff));
+                bench_put16(buf, &i, len, 0xf800 | (num & 0x7ff));
+            } else {
+                bench_put16(buf, &i, len, vocab[((k>>8)%64)*((k>>16)%64)/64]);
+            }
+        }
+        bench_put16(buf, &i, len, 0xbd00 | (bench_rand() & 0xff));
+        // literal pool, aligned
+        if (i & 2) {
+            bench_put16(buf, &i, len, 0x46c0); // nop
+        }
+        num = 1+bench_rand()%4;
+        for (k=0;k<num;k++) {
+            lit = bench_rand();
+            switch (lit%4) {
+                case 0:  lit = 0x40000000+(lit>>16)%0x40*4;  break; // SCuM's analog config
+                case 1:  lit = 0xe000e100+(lit>>16)%0x10*4;  break; // NVIC
+                case 2:  lit = 0x20000000+(lit>>16)%0x4000;  break; // data RAM
+                default: lit = (lit>>16)%len | 1;            break; // function pointer
+            }
+            bench_put32(buf, &i, len, lit);
+        }
+    }
+    // read-only data
+    k = 0;
+    while (i<len) {
+        num = strlen(strings[k%5])+1;
+        if (i+num>len) {
+            num = len-i;
+        }
+        memcpy(&buf[i], strings[k%5], num);
+        i  += num;
+        k++;
+    }
+}
+
+static void bench_image_padded(uint8_t* buf, uint32_t len, uint32_t code_len) {
+    bench_image_code(buf, code_len);
+    memset(&buf[code_len], 0, len-code_len);
+}
+
+static uint32_t bench_image_file(const char* path, uint8_t* buf, uint32_t size) {
+    FILE*  f;
+    size_t len;
+
+    f = fopen(path, "rb");
+    if (f==NULL) {
+        perror(path);
+        exit(1);
+    }
+    len = fread(buf, 1, size, f);
+    fclose(f);
+    return (uint32_t)len;
+}
+
+// the built-in images, then the files on the command line
+static uint32_t bench_images(int argc, char** argv, bench_image_t* images) {
+    uint32_t num;
+    int      i;
+
+    num = 0;
+    images[num].name = "code";
+    images[num].buf  = malloc(BENCH_IMAGE_SIZE);
+    images[num].len  = BENCH_IMAGE_SIZE;
+    bench_image_code(images[num].buf, images[num].len);
+    num++;
+    images[num].name = "padded";
+    images[num].buf  = malloc(BENCH_IMAGE_SIZE);
+    images[num].len  = BENCH_IMAGE_SIZE;
+    bench_image_padded(images[num].buf, images[num].len, 16*1024);
+    num++;
+    for (i=1;i<argc && num<BENCH_IMAGES_MAX;i++) {
+        images[num].name = argv[i];
+        images[num].buf  = malloc(BENCH_IMAGE_SIZE);
+        images[num].len  = bench_image_file(argv[i], images[num].buf, BENCH_IMAGE_SIZE);
+        if (images[num].len) {
+            num++;
+        }
+    }
+    return num;
+}
+
+#endif
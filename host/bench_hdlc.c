@@ -0,0 +1,344 @@
+/**
+Host link framing: the firmware's HDLC decoder next to COBS and SLIP.
+
+Each image is cut in LOAD_CHUNK frames as tools/scum_programmer.py sends
+them ([0x03][seq][offset u32][up to 256 bytes]), each with the CRC-16 FCS,
+and framed three ways:
+- HDLC, hdlc_encode() and hdlc_rx() of hdlc.c: once as proto.c runs it,
+  the payload routed straight into the image, once into a frame buffer
+  and copied from there, as the other two
+- SLIP (RFC 1055), 0xc0 ends a frame, 0xdb escapes
+- COBS, 0x00 ends a frame, each run of non-zero bytes preceded by its
+  length
+The decoders take the bytes one at a time and update the FCS as they go,
+as the firmware has to, the stream arriving in USB packets and UARTE
+chunks of any size. For each, the bytes on the wire and the decoding
+speed; the decoded image is compared with the original.
+
+Usage: bench_hdlc [image.bin ...]
+*/
+
+#include <stddef.h>
+#include "bench.h"
+#include "crc.h"
+#include "hdlc.h"
+
+//=========================== defines =========================================
+
+#define CHUNK_MAX                   256
+#define HDR_LEN                     6
+#define FRAME_MAX                   (HDR_LEN+CHUNK_MAX+2)
+#define WIRE_MAX                    (BENCH_IMAGE_SIZE/CHUNK_MAX*(2+2*FRAME_MAX))
+
+#define SLIP_END                    0xc0
+#define SLIP_ESC                    0xdb
+#define SLIP_ESC_END                0xdc
+#define SLIP_ESC_ESC                0xdd
+
+//=========================== typedef =========================================
+
+typedef uint32_t (*encode_t)(uint8_t* out, const uint8_t* frame, uint32_t len);
+typedef void     (*decode_t)(void);
+
+typedef struct {
+    const char*    name;
+    encode_t       encode;          // NULL: hdlc_encode()
+    decode_t       decode;
+} framing_t;
+
+typedef struct {
+    const uint8_t* wire;
+    uint32_t       wire_len;
+    uint8_t*       image;           // decoded
+    uint32_t       image_len;
+    uint32_t       num_frames;      // decoded with a good FCS
+    uint8_t        frame[FRAME_MAX];
+    hdlc_rx_t      hdlc;
+} bench_vars_t;
+
+//=========================== variables =======================================
+
+bench_vars_t bench_vars;
+
+//=========================== prototypes ======================================
+
+uint32_t _slip_encode(uint8_t* out, const uint8_t* frame, uint32_t len);
+uint32_t _cobs_encode(uint8_t* out, const uint8_t* frame, uint32_t len);
+void     _hdlc_routed_decode(void);
+void     _hdlc_copied_decode(void);
+void     _slip_decode(void);
+void     _cobs_decode(void);
+uint8_t* _route(const uint8_t* hdr, uint16_t* size);
+void     _deliver(const uint8_t* frame, uint32_t len);
+void     _bench_decode(void* ctx);
+
+static const framing_t framings[] = {
+    {"HDLC, routed",  NULL,         _hdlc_routed_decode},
+    {"HDLC, copied",  NULL,         _hdlc_copied_decode},
+    {"SLIP",          _slip_encode, _slip_decode},
+    {"COBS",          _cobs_encode, _cobs_decode},
+};
+
+//=========================== main ============================================
+
+int main(int argc, char** argv) {
+    bench_image_t images[BENCH_IMAGES_MAX];
+    uint32_t      num_images;
+    uint8_t*      wire;
+    uint8_t       frame[FRAME_MAX];
+    uint32_t      wire_len;
+    uint32_t      offset;
+    uint32_t      len;
+    uint32_t      payload;
+    uint16_t      fcs;
+    double        seconds;
+    uint32_t      i;
+    uint32_t      f;
+
+    crc_init();
+    num_images       = bench_images(argc, argv, images);
+    wire             = malloc(WIRE_MAX);
+    bench_vars.image = malloc(BENCH_IMAGE_SIZE);
+
+    for (i=0;i<num_images;i++) {
+        printf("%s, %u bytes\n", images[i].name, images[i].len);
+        printf("  %-14s %10s %9s %9s %8s\n", "", "wire", "overhead", "MB/s", "ns/byte");
+        payload = images[i].len+images[i].len/CHUNK_MAX*HDR_LEN;
+        for (f=0;f<sizeof(framings)/sizeof(framings[0]);f++) {
+
+            // the load, framed
+            wire_len = 0;
+            for (offset=0;offset<images[i].len;offset+=CHUNK_MAX) {
+                len      = images[i].len-offset;
+                len      = (len>CHUNK_MAX) ? CHUNK_MAX : len;
+                frame[0] = 0x03;
+                frame[1] = (offset/CHUNK_MAX) & 0xff;
+                frame[2] = offset & 0xff;
+                frame[3] = (offset>>8) & 0xff;
+                frame[4] = (offset>>16) & 0xff;
+                frame[5] = (offset>>24) & 0xff;
+                if (framings[f].encode==NULL) {
+                    wire_len += hdlc_encode(&wire[wire_len], frame, HDR_LEN, &images[i].buf[offset], len);
+                    continue;
+                }
+                memcpy(&frame[HDR_LEN], &images[i].buf[offset], len);
+                fcs                  = crc16(frame, HDR_LEN+len);
+                frame[HDR_LEN+len]   = fcs & 0xff;
+                frame[HDR_LEN+len+1] = fcs >> 8;
+                wire_len += framings[f].encode(&wire[wire_len], frame, HDR_LEN+len+2);
+            }
+
+            // decoded, and checked
+            bench_vars.wire      = wire;
+            bench_vars.wire_len  = wire_len;
+            bench_vars.image_len = images[i].len;
+            memset(bench_vars.image, 0, BENCH_IMAGE_SIZE);
+            seconds = bench_time(_bench_decode, (void*)framings[f].decode);
+            if (bench_vars.num_frames!=(images[i].len+CHUNK_MAX-1)/CHUNK_MAX ||
+                memcmp(bench_vars.image, images[i].buf, images[i].len)!=0) {
+                printf("%s: %s decodes wrong\n", images[i].name, framings[f].name);
+                return 1;
+            }
+            printf("  %-14s %10u %8.2f%% %9.1f %8.2f\n", framings[f].name, wire_len,
+                   100.0*(wire_len-payload)/payload, wire_len/seconds/1e6, seconds*1e9/wire_len);
+        }
+    }
+    return 0;
+}
+
+void _bench_decode(void* ctx) {
+    bench_vars.num_frames = 0;
+    ((decode_t)ctx)();
+}
+
+//=========================== encoders ========================================
+
+uint32_t _slip_encode(uint8_t* out, const uint8_t* frame, uint32_t len) {
+    uint32_t n;
+    uint32_t i;
+
+    n        = 0;
+    out[n++] = SLIP_END;
+    for (i=0;i<len;i++) {
+        if (frame[i]==SLIP_END) {
+            out[n++] = SLIP_ESC;
+            out[n++] = SLIP_ESC_END;
+        } else if (frame[i]==SLIP_ESC) {
+            out[n++] = SLIP_ESC;
+            out[n++] = SLIP_ESC_ESC;
+        } else {
+            out[n++] = frame[i];
+        }
+    }
+    out[n++] = SLIP_END;
+    return n;
+}
+
+uint32_t _cobs_encode(uint8_t* out, const uint8_t* frame, uint32_t len) {
+    uint32_t n;
+    uint32_t code_at;
+    uint8_t  code;
+    uint32_t i;
+
+    code_at = 0;
+    n       = 1;
+    code    = 1;
+    for (i=0;i<len;i++) {
+        if (frame[i]==0) {
+            out[code_at] = code;
+            code_at      = n++;
+            code         = 1;
+            continue;
+        }
+        out[n++] = frame[i];
+        if (++code==0xff) {
+            out[code_at] = code;
+            code_at      = n++;
+            code         = 1;
+        }
+    }
+    out[code_at] = code;
+    out[n++]     = 0x00;
+    return n;
+}
+
+//=========================== decoders ========================================
+
+uint8_t* _route(const uint8_t* hdr, uint16_t* size) {
+    uint32_t offset;
+
+    // as _proto_route(): LOAD_CHUNK payloads go straight to the image
+    offset = hdr[2] | (hdr[3]<<8) | (hdr[4]<<16) | ((uint32_t)hdr[5]<<24);
+    if (hdr[0]!=0x03 || offset>=bench_vars.image_len) {
+        return NULL;
+    }
+    *size  = CHUNK_MAX;
+    return &bench_vars.image[offset];
+}
+
+void _deliver(const uint8_t* frame, uint32_t len) {
+    uint32_t offset;
+
+    // a frame decoded whole, FCS stripped
+    offset = frame[2] | (frame[3]<<8) | (frame[4]<<16) | ((uint32_t)frame[5]<<24);
+    if (len<HDR_LEN || offset+len-HDR_LEN>bench_vars.image_len) {
+        return;
+    }
+    memcpy(&bench_vars.image[offset], &frame[HDR_LEN], len-HDR_LEN);
+    bench_vars.num_frames++;
+}
+
+void _hdlc_routed_decode(void) {
+    const uint8_t* buf;
+    uint32_t       len;
+    uint32_t       used;
+
+    hdlc_rx_init(&bench_vars.hdlc, bench_vars.frame, FRAME_MAX, _route, HDR_LEN);
+    buf = bench_vars.wire;
+    len = bench_vars.wire_len;
+    while (len) {
+        if (hdlc_rx(&bench_vars.hdlc, buf, len, &used)==HDLC_RX_FRAME &&
+            bench_vars.hdlc.frame_dst) {
+            bench_vars.num_frames++;
+        }
+        buf += used;
+        len -= used;
+    }
+}
+
+void _hdlc_copied_decode(void) {
+    const uint8_t* buf;
+    uint32_t       len;
+    uint32_t       used;
+
+    hdlc_rx_init(&bench_vars.hdlc, bench_vars.frame, FRAME_MAX, NULL, 0);
+    buf = bench_vars.wire;
+    len = bench_vars.wire_len;
+    while (len) {
+        if (hdlc_rx(&bench_vars.hdlc, buf, len, &used)==HDLC_RX_FRAME) {
+            _deliver(bench_vars.frame, bench_vars.hdlc.frame_len);
+        }
+        buf += used;
+        len -= used;
+    }
+}
+
+void _slip_decode(void) {
+    uint32_t len;
+    uint16_t fcs;
+    uint8_t  escape;
+    uint8_t  b;
+    uint32_t i;
+
+    len    = 0;
+    fcs    = CRC16_INIT;
+    escape = 0;
+    for (i=0;i<bench_vars.wire_len;i++) {
+        b = bench_vars.wire[i];
+        if (b==SLIP_END) {
+            if (len>=2 && fcs==CRC16_GOOD && escape==0) {
+                _deliver(bench_vars.frame, len-2);
+            }
+            len    = 0;
+            fcs    = CRC16_INIT;
+            escape = 0;
+            continue;
+        }
+        if (b==SLIP_ESC) {
+            escape = 1;
+            continue;
+        }
+        if (escape) {
+            b      = (b==SLIP_ESC_END) ? SLIP_END : SLIP_ESC;
+            escape = 0;
+        }
+        fcs = CRC16_UPDATE_BYTE(fcs, b);
+        if (len<FRAME_MAX) {
+            bench_vars.frame[len++] = b;
+        }
+    }
+}
+
+void _cobs_decode(void) {
+    uint32_t len;
+    uint16_t fcs;
+    uint8_t  code;
+    uint8_t  left;
+    uint8_t  b;
+    uint32_t i;
+
+    len  = 0;
+    fcs  = CRC16_INIT;
+    code = 0;
+    left = 0;
+    for (i=0;i<bench_vars.wire_len;i++) {
+        b = bench_vars.wire[i];
+        if (b==0x00) {
+            if (len>=2 && fcs==CRC16_GOOD && left==0) {
+                _deliver(bench_vars.frame, len-2);
+            }
+            len  = 0;
+            fcs  = CRC16_INIT;
+            code = 0;
+            left = 0;
+            continue;
+        }
+        if (left==0) {
+            // a new run, the one before ended on a zero unless it was full
+            if (code!=0 && code!=0xff) {
+                fcs = CRC16_UPDATE_BYTE(fcs, 0x00);
+                if (len<FRAME_MAX) {
+                    bench_vars.frame[len++] = 0x00;
+                }
+            }
+            code = b;
+            left = b-1;
+            continue;
+        }
+        fcs = CRC16_UPDATE_BYTE(fcs, b);
+        if (len<FRAME_MAX) {
+            bench_vars.frame[len++] = b;
+        }
+        left--;
+    }
+}
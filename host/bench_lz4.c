@@ -0,0 +1,243 @@
+/**
+LOAD_CHUNK_LZ4: what the firmware's LZ4 decoder costs, on SCuM images.
+
+Each image is packed into frames as tools/scum_programmer.py does it:
+from each chunk on, the longest run of 16, 8, 4, 2 or 1 chunks whose LZ4
+block fits in one chunk's payload goes out as one LOAD_CHUNK_LZ4, else
+the chunk goes out plain. The compressor below is the tool's, greedy,
+in C. Then every block is decoded with lz4_decode() of lz4.c into the
+staging image, as proto.c does, next to copying the same image in plain
+chunks; the decoded image is compared with the original.
+
+Usage: bench_lz4 [image.bin ...]
+*/
+
+#include "bench.h"
+#include "lz4.h"
+
+//=========================== defines =========================================
+
+#define CHUNK_MAX                   256
+#define RUN_MAX                     16   // chunks per LOAD_CHUNK_LZ4, PROTO_LZ4_OUT_MAX
+#define NUM_FRAMES_MAX              (BENCH_IMAGE_SIZE/CHUNK_MAX)
+#define HASH_BITS                   12
+
+//=========================== typedef =========================================
+
+typedef struct {
+    uint32_t       offset;          // in the image
+    uint32_t       out_len;         // image bytes it carries
+    uint32_t       block_len;       // 0: plain chunk
+    uint8_t        block[CHUNK_MAX];
+} frame_t;
+
+typedef struct {
+    const uint8_t* image;
+    uint32_t       image_len;
+    uint8_t*       staged;
+    frame_t*       frames;
+    uint32_t       num_frames;
+} bench_vars_t;
+
+//=========================== variables =======================================
+
+bench_vars_t bench_vars;
+
+//=========================== prototypes ======================================
+
+uint32_t _compress(const uint8_t* src, uint32_t len, uint8_t* out, uint32_t out_size);
+uint32_t _compress_sequence(uint8_t* out, uint32_t n, uint32_t out_size,
+                       const uint8_t* literals, uint32_t num_literals, uint32_t offset, uint32_t match);
+uint32_t _compress_length(uint8_t* out, uint32_t n, uint32_t len);
+void     _bench_lz4(void* ctx);
+void     _bench_plain(void* ctx);
+
+//=========================== main ============================================
+
+int main(int argc, char** argv) {
+    bench_image_t images[BENCH_IMAGES_MAX];
+    uint32_t      num_images;
+    uint32_t      num_chunks;
+    uint32_t      num_lz4;
+    uint32_t      wire;
+    uint32_t      len;
+    uint32_t      n;
+    frame_t*      frame;
+    double        lz4_seconds;
+    double        plain_seconds;
+    uint32_t      i;
+    uint32_t      c;
+
+    num_images        = bench_images(argc, argv, images);
+    bench_vars.frames = malloc(NUM_FRAMES_MAX*sizeof(frame_t));
+    bench_vars.staged = malloc(BENCH_IMAGE_SIZE);
+
+    printf("%-10s %7s %7s %7s %7s %8s %9s %9s %8s\n",
+           "", "bytes", "chunks", "frames", "lz4", "wire", "lz4 MB/s", "copy MB/s", "ns/byte");
+    for (i=0;i<num_images;i++) {
+
+        // packed as the tool does
+        num_chunks            = (images[i].len+CHUNK_MAX-1)/CHUNK_MAX;
+        bench_vars.image      = images[i].buf;
+        bench_vars.image_len  = images[i].len;
+        bench_vars.num_frames = 0;
+        num_lz4               = 0;
+        wire                  = 0;
+        c                     = 0;
+        while (c<num_chunks) {
+            frame             = &bench_vars.frames[bench_vars.num_frames++];
+            frame->offset     = c*CHUNK_MAX;
+            frame->block_len  = 0;
+            len               = 0;
+            for (n=RUN_MAX;n>0;n/=2) {
+                if (c+n>num_chunks) {
+                    continue;
+                }
+                len = (c+n==num_chunks) ? images[i].len-c*CHUNK_MAX : n*CHUNK_MAX;
+                frame->block_len = _compress(&images[i].buf[c*CHUNK_MAX], len, frame->block, CHUNK_MAX);
+                if (frame->block_len && (n>1 || frame->block_len<len)) {
+                    break;
+                }
+                frame->block_len = 0;
+            }
+            if (frame->block_len) {
+                frame->out_len = len;
+                wire          += frame->block_len;
+                num_lz4++;
+                c             += n;
+            } else {
+                frame->out_len = (c+1==num_chunks) ? images[i].len-c*CHUNK_MAX : CHUNK_MAX;
+                wire          += frame->out_len;
+                c++;
+            }
+        }
+
+        // decoded, and checked
+        memset(bench_vars.staged, 0, BENCH_IMAGE_SIZE);
+        lz4_seconds   = bench_time(_bench_lz4, NULL);
+        if (memcmp(bench_vars.staged, images[i].buf, images[i].len)!=0) {
+            printf("%s: decodes wrong\n", images[i].name);
+            return 1;
+        }
+        plain_seconds = bench_time(_bench_plain, NULL);
+
+        printf("%-10s %7u %7u %7u %7u %8u %9.1f %9.1f %8.2f\n", images[i].name, images[i].len,
+               num_chunks, bench_vars.num_frames, num_lz4, wire,
+               images[i].len/lz4_seconds/1e6, images[i].len/plain_seconds/1e6,
+               lz4_seconds*1e9/images[i].len);
+    }
+    return 0;
+}
+
+void _bench_lz4(void* ctx) {
+    frame_t* frame;
+    uint32_t f;
+
+    (void)ctx;
+    for (f=0;f<bench_vars.num_frames;f++) {
+        frame = &bench_vars.frames[f];
+        if (frame->block_len==0) {
+            memcpy(&bench_vars.staged[frame->offset], &bench_vars.image[frame->offset], frame->out_len);
+        } else if (lz4_decode(frame->block, frame->block_len, &bench_vars.staged[frame->offset], frame->out_len)!=(int32_t)frame->out_len) {
+            memset(&bench_vars.staged[frame->offset], 0, frame->out_len);
+        }
+    }
+}
+
+void _bench_plain(void* ctx) {
+    uint32_t offset;
+    uint32_t len;
+
+    // the same image in plain LOAD_CHUNKs
+    (void)ctx;
+    for (offset=0;offset<bench_vars.image_len;offset+=CHUNK_MAX) {
+        len = bench_vars.image_len-offset;
+        len = (len>CHUNK_MAX) ? CHUNK_MAX : len;
+        memcpy(&bench_vars.staged[offset], &bench_vars.image[offset], len);
+    }
+}
+
+//=========================== compressor ======================================
+
+// returns the size of the block, 0 if it doesn't fit in out_size; the last
+// 5 bytes are literals, and no match starts in the last 12, as the format
+// requires
+uint32_t _compress(const uint8_t* src, uint32_t len, uint8_t* out, uint32_t out_size) {
+    int32_t  table[1<<HASH_BITS];
+    uint32_t anchor;
+    uint32_t key;
+    uint32_t h;
+    int32_t  candidate;
+    uint32_t match;
+    uint32_t n;
+    uint32_t i;
+
+    memset(table, 0xff, sizeof(table));
+    n      = 0;
+    anchor = 0;
+    i      = 0;
+    while (len>12 && i<len-12) {
+        memcpy(&key, &src[i], 4);
+        h          = (key*2654435761u)>>(32-HASH_BITS);
+        candidate  = table[h];
+        table[h]   = (int32_t)i;
+        if (candidate<0 || memcmp(&src[candidate], &src[i], 4)!=0) {
+            i++;
+            continue;
+        }
+        match = 4;
+        while (match<len-5-i && src[candidate+match]==src[i+match]) {
+            match++;
+        }
+        n = _compress_sequence(out, n, out_size, &src[anchor], i-anchor, i-candidate, match);
+        if (n==0) {
+            return 0;
+        }
+        i     += match;
+        anchor = i;
+    }
+    return _compress_sequence(out, n, out_size, &src[anchor], len-anchor, 0, 0);
+}
+
+// offset 0: the last sequence, literals only
+uint32_t _compress_sequence(uint8_t* out, uint32_t n, uint32_t out_size,
+                       const uint8_t* literals, uint32_t num_literals, uint32_t offset, uint32_t match) {
+    uint32_t token;
+    uint32_t size;
+
+    size  = 1+num_literals;
+    size += (num_literals>=15) ? (num_literals-15)/255+1 : 0;
+    size += (offset) ? 2 : 0;
+    size += (offset && match-4>=15) ? (match-4-15)/255+1 : 0;
+    if (n+size>out_size) {
+        return 0;
+    }
+    token = ((num_literals<15) ? num_literals : 15)<<4;
+    if (offset) {
+        token |= (match-4<15) ? match-4 : 15;
+    }
+    out[n++] = token;
+    if (num_literals>=15) {
+        n = _compress_length(out, n, num_literals);
+    }
+    memcpy(&out[n], literals, num_literals);
+    n += num_literals;
+    if (offset) {
+        out[n++] = offset & 0xff;
+        out[n++] = offset >> 8;
+        if (match-4>=15) {
+            n = _compress_length(out, n, match-4);
+        }
+    }
+    return n;
+}
+
+uint32_t _compress_length(uint8_t* out, uint32_t n, uint32_t len) {
+    len -= 15;
+    while (len>=255) {
+        out[n++] = 255;
+        len     -= 255;
+    }
+    out[n++] = len;
+    return n;
+}
@@ -0,0 +1,491 @@
+/**
+The programmer's protocol side, on a host: a protocol-only harness.
+
+crc.c, hdlc.c, lz4.c, proto.c, prof.c and store.c are the firmware's own,
+built against stub/nrf52840.h; scum-programmer.c and the drivers are not
+built, this file stands in for them:
+- the main loop: events_post() sets a bit, the loop handles the lowest
+  pending one first, as scum-programmer.c does, and sleeps in poll() when
+  there is none; EVT_LED_ADVANCE comes every 125ms
+- the host link: stdin/stdout carry the HDLC stream of the J-Link VCOM
+  (PROTO_LINK_UART), the CDC-ACM one goes to stdout too
+- the flash: the store's pages are mapped at their nRF52840 addresses,
+  STORE_DIR_ALT_ADDR up to 1MiB, erased by the stub's NVMC as the store
+  commands it; given a file name, the flash is read from it at start and
+  written back at exit
+- time: timestamp_get() is the host's clock, the loop is not cycle-timed
+- SCuM: the 3WB clocks whatever is available into a model of SCuM's SRAM,
+  the read-back verify compares that SRAM with the image, the UART bridge
+  echoes what it is sent
+
+Linux only, mapping at a fixed low address is not possible on macOS.
+*/
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "scum-programmer.h"
+#include "proto.h"
+#include "crc.h"
+#include "usb.h"
+#include "host_uart.h"
+#include "threewb.h"
+#include "calib.h"
+#include "store.h"
+#include "scum_uart.h"
+#include "ringbuf.h"
+#include "prof.h"
+#include "trace.h"
+
+//=========================== defines =========================================
+
+#define SIM_FLASH_ADDR              STORE_DIR_ALT_ADDR
+#define SIM_FLASH_SIZE              (0x00100000-STORE_DIR_ALT_ADDR)
+#define SIM_TICK_MS                 125
+#define SIM_RX_BUF_SIZE             4096
+#define SIM_TX_FREE                 1024  // as HOST_UART_TX_BUF_SIZE, stdout never fills
+#define SIM_ECHO_BUF_SIZE           1024  // power of two
+
+//=========================== variables =======================================
+
+typedef void (*sim_handler_t)(void);
+
+typedef struct {
+    uint32_t       events;          // pending-work bitmap, one bit per EVT_*
+    uint32_t       ts_tick;         // timestamp_get() of the last EVT_LED_ADVANCE
+    uint8_t        rx_buf[SIM_RX_BUF_SIZE];
+    uint32_t       rx_len;
+    uint8_t        eof;
+    const char*    flash_file;
+} sim_vars_t;
+
+typedef struct {
+    // 3WB, SCuM's end of it
+    uint8_t        mode;
+    uint32_t       bit_period;
+    const uint8_t* buf;
+    uint32_t       len;
+    uint32_t       avail;
+    uint32_t       idx;             // bytes clocked in
+    uint8_t        busy;
+    uint8_t        stalled;
+    uint8_t        result;
+    uint32_t       ts_stall;
+    uint8_t        sram[SCUM_IMAGE_SIZE];
+    // read-back verify
+    uint8_t        verify_result;
+    uint32_t       verify_mismatch;
+    // UART bridge, echoed
+    uint8_t        bridge;
+    ringbuf_t      echo;
+    uint8_t        echo_buf[SIM_ECHO_BUF_SIZE];
+} sim_scum_t;
+
+sim_vars_t     sim_vars;
+sim_scum_t     sim_scum;
+
+// as in scum-programmer.c
+const uint8_t  APP_VERSION[]  = {0x00,0x01};
+app_dbg_t      app_dbg;
+app_bench_t    app_bench;
+uint8_t        scum_image[SCUM_IMAGE_SIZE];
+uint32_t       scum_image_len;
+uint32_t       scum_image_crc;
+
+//=========================== prototypes ======================================
+
+void _sim_flash_init(void);
+void _sim_flash_save(void);
+void _sim_poll(void);
+void _sim_3wb_clock(void);
+void _sim_host_uart_rx(void);
+void _sim_tick(void);
+void _sim_3wb_done(void);
+void _sim_store_done(void);
+void _sim_scum_verify_done(void);
+void _sim_scum_uart_rx(void);
+void _sim_write(const uint8_t* buf, uint32_t len);
+
+const sim_handler_t sim_handlers[EVT_MAX] = {
+    _sim_tick,                      // EVT_LED_ADVANCE
+    NULL,                           // EVT_USB_CDC_RX
+    NULL,                           // EVT_USB_VENDOR_RX
+    _sim_host_uart_rx,              // EVT_HOST_UART_RX
+    _sim_3wb_done,                  // EVT_3WB_DONE
+    store_step,                     // EVT_STORE_STEP
+    _sim_store_done,                // EVT_STORE_DONE
+    NULL,                           // EVT_BUTTON
+    NULL,                           // EVT_SCUM_UART
+    _sim_scum_verify_done,          // EVT_SCUM_VERIFY_DONE
+    _sim_scum_uart_rx,              // EVT_SCUM_UART_RX
+};
+
+//=========================== main ============================================
+
+int main(int argc, char** argv) {
+    uint8_t evt;
+
+    sim_vars.flash_file                = (argc>1) ? argv[1] : NULL;
+    sim_regs_init();
+    _sim_flash_init();
+
+    sim_scum.bit_period                = THREEWB_BIT_PERIOD_DEFAULT;
+    ringbuf_init(&sim_scum.echo, sim_scum.echo_buf, SIM_ECHO_BUF_SIZE);
+    crc_init();
+    prof_init();
+    store_init();
+    proto_init();
+    sim_vars.ts_tick                   = timestamp_get();
+
+    // until the host closes the link
+    while (sim_vars.eof==0 || sim_vars.events) {
+        _sim_3wb_clock();
+        if (sim_vars.events==0) {
+            _sim_poll();
+            continue;
+        }
+        evt                            = __builtin_ctz(sim_vars.events);
+        sim_vars.events               &= ~(0x00000001 << evt);
+        if (sim_handlers[evt]) {
+            sim_dwt.CYCCNT             = timestamp_get()*4;
+            sim_handlers[evt]();
+        }
+    }
+
+    _sim_flash_save();
+    return 0;
+}
+
+//=========================== main loop =======================================
+
+void events_post(uint8_t evt) {
+    sim_vars.events                   |= (0x00000001 << evt);
+}
+
+uint32_t timestamp_get(void) {
+    struct timespec ts;
+
+    // 16MHz, as TIMER2
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec*16000000+(uint64_t)ts.tv_nsec*16/1000);
+}
+
+uint8_t scum_image_in_use(void) {
+    return threewb_is_busy() || store_is_busy() || proto_is_loading();
+}
+
+void _sim_poll(void) {
+    struct pollfd fd;
+    uint32_t      elapsed;
+    int           timeout;
+    ssize_t       num;
+
+    // the tick, or the host, whichever comes first
+    elapsed = (timestamp_get()-sim_vars.ts_tick)/16000;
+    timeout = (elapsed>=SIM_TICK_MS) ? 0 : (int)(SIM_TICK_MS-elapsed);
+    if (sim_vars.eof==0) {
+        fd.fd      = STDIN_FILENO;
+        fd.events  = POLLIN;
+        if (poll(&fd, 1, timeout)>0) {
+            num = read(STDIN_FILENO, sim_vars.rx_buf, sizeof(sim_vars.rx_buf));
+            if (num<=0) {
+                sim_vars.eof           = 1;
+                return;
+            }
+            sim_vars.rx_len            = (uint32_t)num;
+            events_post(EVT_HOST_UART_RX);
+            return;
+        }
+    }
+    if ((timestamp_get()-sim_vars.ts_tick)/16000>=SIM_TICK_MS) {
+        sim_vars.ts_tick               = timestamp_get();
+        events_post(EVT_LED_ADVANCE);
+    }
+}
+
+void _sim_host_uart_rx(void) {
+    proto_rx(PROTO_LINK_UART, sim_vars.rx_buf, sim_vars.rx_len);
+    sim_vars.rx_len                    = 0;
+}
+
+void _sim_tick(void) {
+    threewb_tick();
+}
+
+void _sim_3wb_done(void) {
+    proto_3wb_done();
+}
+
+void _sim_store_done(void) {
+    proto_store_done();
+}
+
+void _sim_scum_verify_done(void) {
+    proto_scum_verify_done();
+}
+
+void _sim_scum_uart_rx(void) {
+    uint8_t* buf;
+    uint32_t len;
+    uint32_t num;
+
+    while ((buf = scum_uart_rx_peek(&len)) && len) {
+        num = proto_bridge_rx(buf, len);
+        if (num==0) {
+            proto_bridge_wait(EVT_SCUM_UART_RX);
+            return;
+        }
+        scum_uart_rx_release(num);
+    }
+}
+
+//=========================== flash ===========================================
+
+void _sim_flash_init(void) {
+    FILE* f;
+
+    if (mmap((void*)(uintptr_t)SIM_FLASH_ADDR, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)==MAP_FAILED) {
+        perror("sim: mapping the flash");
+        exit(1);
+    }
+    memset((void*)(uintptr_t)SIM_FLASH_ADDR, 0xff, SIM_FLASH_SIZE);
+    if (sim_vars.flash_file==NULL || (f = fopen(sim_vars.flash_file, "rb"))==NULL) {
+        return;
+    }
+    if (fread((void*)(uintptr_t)SIM_FLASH_ADDR, 1, SIM_FLASH_SIZE, f)!=SIM_FLASH_SIZE) {
+        memset((void*)(uintptr_t)SIM_FLASH_ADDR, 0xff, SIM_FLASH_SIZE);
+    }
+    fclose(f);
+}
+
+void _sim_flash_save(void) {
+    FILE* f;
+
+    if (sim_vars.flash_file==NULL || (f = fopen(sim_vars.flash_file, "wb"))==NULL) {
+        return;
+    }
+    fwrite((const void*)(uintptr_t)SIM_FLASH_ADDR, 1, SIM_FLASH_SIZE, f);
+    fclose(f);
+}
+
+//=========================== host link =======================================
+
+void _sim_write(const uint8_t* buf, uint32_t len) {
+    ssize_t num;
+
+    while (len) {
+        num = write(STDOUT_FILENO, buf, len);
+        if (num<=0) {
+            exit(0);
+        }
+        buf += num;
+        len -= (uint32_t)num;
+    }
+}
+
+uint32_t usb_cdc_tx(const uint8_t* buf, uint32_t len) {
+    _sim_write(buf, len);
+    return len;
+}
+
+uint32_t usb_cdc_tx_free(void) {
+    return SIM_TX_FREE;
+}
+
+void usb_cdc_tx_wait(uint8_t evt) {
+    events_post(evt);
+}
+
+uint8_t usb_vendor_is_busy(void) {
+    return 0;
+}
+
+uint32_t host_uart_tx(const uint8_t* buf, uint32_t len) {
+    _sim_write(buf, len);
+    return len;
+}
+
+uint32_t host_uart_tx_free(void) {
+    return SIM_TX_FREE;
+}
+
+void host_uart_tx_wait(uint8_t evt) {
+    events_post(evt);
+}
+
+//=========================== 3WB =============================================
+
+uint8_t threewb_set_mode(uint8_t mode) {
+    if (sim_scum.busy) {
+        return RC_BUSY;
+    }
+    if (mode!=THREEWB_MODE_PWM && mode!=THREEWB_MODE_SPIM) {
+        return RC_INVALID;
+    }
+    sim_scum.mode                      = mode;
+    return RC_OK;
+}
+
+uint8_t threewb_set_bit_period(uint32_t ns) {
+    if (sim_scum.busy) {
+        return RC_BUSY;
+    }
+    if ((sim_scum.mode==THREEWB_MODE_PWM  && (ns<THREEWB_PWM_PERIOD_MIN  || ns>THREEWB_PWM_PERIOD_MAX)) ||
+        (sim_scum.mode==THREEWB_MODE_SPIM && (ns<THREEWB_SPIM_PERIOD_MIN || ns>THREEWB_SPIM_PERIOD_MAX))) {
+        return RC_INVALID;
+    }
+    sim_scum.bit_period                = ns;
+    return RC_OK;
+}
+
+uint8_t threewb_load(const uint8_t* buf, uint32_t len) {
+    return threewb_load_stream(buf, len, len);
+}
+
+uint8_t threewb_load_stream(const uint8_t* buf, uint32_t len, uint32_t avail) {
+    if (sim_scum.busy) {
+        return RC_BUSY;
+    }
+    if (len==0 || avail>len) {
+        return RC_INVALID;
+    }
+    // SCuM is reset, its SRAM keeps what it had
+    sim_scum.buf                       = buf;
+    sim_scum.len                       = len;
+    sim_scum.avail                     = avail;
+    sim_scum.idx                       = 0;
+    sim_scum.stalled                   = 0;
+    sim_scum.busy                      = 1;
+    sim_scum.result                    = RC_OK;
+    app_dbg.num_3wb_loads++;
+    return RC_OK;
+}
+
+void threewb_feed(uint32_t avail) {
+    if (sim_scum.busy==0 || avail<=sim_scum.avail) {
+        return;
+    }
+    sim_scum.avail                     = avail;
+    sim_scum.stalled                   = 0;
+}
+
+uint8_t threewb_abort(void) {
+    if (sim_scum.busy==0 || sim_scum.stalled==0) {
+        return RC_INVALID;
+    }
+    sim_scum.busy                      = 0;
+    sim_scum.result                    = RC_INVALID;
+    app_dbg.num_3wb_aborts++;
+    return RC_OK;
+}
+
+void threewb_tick(void) {
+    if (sim_scum.busy && sim_scum.stalled &&
+        timestamp_get()-sim_scum.ts_stall>=THREEWB_STALL_TIMEOUT &&
+        threewb_abort()==RC_OK) {
+        events_post(EVT_3WB_DONE);
+    }
+}
+
+uint8_t threewb_is_busy(void) {
+    return sim_scum.busy;
+}
+
+uint8_t threewb_result(void) {
+    return sim_scum.result;
+}
+
+void _sim_3wb_clock(void) {
+
+    if (sim_scum.busy==0) {
+        return;
+    }
+
+    // the bus is fast next to the host link, it keeps up with the image
+    memcpy(&sim_scum.sram[sim_scum.idx], &sim_scum.buf[sim_scum.idx], sim_scum.avail-sim_scum.idx);
+    sim_scum.idx                       = sim_scum.avail;
+    if (sim_scum.idx==sim_scum.len) {
+        sim_scum.busy                  = 0;
+        events_post(EVT_3WB_DONE);
+    } else if (sim_scum.stalled==0) {
+        sim_scum.stalled               = 1;
+        sim_scum.ts_stall              = timestamp_get();
+        app_dbg.num_3wb_stalls++;
+    }
+}
+
+//=========================== SCuM UART =======================================
+
+uint8_t scum_uart_verify(const uint8_t* image, uint32_t len) {
+    uint32_t i;
+
+    // SCuM's answer, straight away
+    sim_scum.verify_result             = SCUM_VERIFY_MATCH;
+    sim_scum.verify_mismatch           = 0;
+    for (i=0;i<len;i++) {
+        if (sim_scum.sram[i]!=image[i]) {
+            sim_scum.verify_result     = SCUM_VERIFY_MISMATCH;
+            sim_scum.verify_mismatch   = i;
+            break;
+        }
+    }
+    events_post(EVT_SCUM_VERIFY_DONE);
+    return RC_OK;
+}
+
+uint8_t scum_uart_verify_result(uint32_t* mismatch) {
+    *mismatch = sim_scum.verify_mismatch;
+    return sim_scum.verify_result;
+}
+
+uint8_t scum_uart_bridge_start(uint32_t baudrate) {
+    (void)baudrate;
+    sim_scum.bridge                    = 1;
+    return RC_OK;
+}
+
+void scum_uart_bridge_stop(void) {
+    sim_scum.bridge                    = 0;
+}
+
+uint8_t scum_uart_bridge_is_on(void) {
+    return sim_scum.bridge;
+}
+
+uint8_t* scum_uart_rx_peek(uint32_t* len) {
+    return ringbuf_peek(&sim_scum.echo, len);
+}
+
+void scum_uart_rx_release(uint32_t len) {
+    ringbuf_release(&sim_scum.echo, len);
+}
+
+uint32_t scum_uart_tx(const uint8_t* buf, uint32_t len) {
+    uint32_t num;
+
+    // SCuM echoes what it receives
+    num = ringbuf_write(&sim_scum.echo, buf, len);
+    if (num) {
+        events_post(EVT_SCUM_UART_RX);
+    }
+    return num;
+}
+
+//=========================== others ==========================================
+
+uint8_t calib_start(uint16_t num_periods, uint16_t period_ticks) {
+    (void)num_periods;
+    (void)period_ticks;
+    return RC_OK;
+}
+
+void trace(uint8_t id, uint8_t arg8, uint16_t arg16) {
+    (void)id;
+    (void)arg8;
+    (void)arg16;
+}
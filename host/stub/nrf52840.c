@@ -0,0 +1,732 @@
+/**
+Register blocks of stub/nrf52840.h, at the nRF52840's addresses, and the
+models of the peripherals behind them.
+
+sim_reg() is what every NRF_xxx expands to: before handing out the block,
+it completes what the registers written since the last access started, as
+the peripheral would have by then, and moves time on by SIM_ACCESS_PS. A
+write is therefore seen at the next access to any register, the READY poll
+that follows an NVMC command included, which is where the firmware waits
+for it.
+
+Time is in ps. Each peripheral knows when its next edge or event is due,
+sim_run() takes them in order; an event goes through PPI to its tasks at
+the same instant, every channel on it firing as it was enabled when the
+event came, and raises the peripheral's IRQ if INTEN has it. Pins are
+resolved after each step, PWM0 or SPIM3 where connected, P0's OUT
+otherwise, and each change goes to the pin hook.
+
+Linux only, mapping at a fixed low address is not possible on macOS.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "nrf52840.h"
+
+//=========================== defines =========================================
+
+#define SIM_APB_SIZE                0x00030000
+#define SIM_AHB_SIZE                0x00001000
+
+#define SIM_FLASH_PAGE_SIZE         4096
+#define SIM_FLASH_NUM_PAGES         256  // 1MiB
+#define SIM_ERASE_PAGE_MS           85   // tERASEPAGE, max
+
+#define SIM_ANOMALY_198             0x40000E00UL // SPIM3 priority on RAM blocks
+#define SIM_PSEL_DISCONNECTED       0x80000000
+#define SIM_NUM_PWM_CH              4
+#define SIM_NUM_PPI_CH              20
+#define SIM_NUM_PPI_CHG             6
+
+_Static_assert(offsetof(NRF_PWM_Type, PSEL)         == 0x560, "PWM layout");
+_Static_assert(offsetof(NRF_SPIM_Type, ORC)         == 0x5c0, "SPIM layout");
+_Static_assert(offsetof(NRF_TIMER_Type, CC)         == 0x540, "TIMER layout");
+_Static_assert(offsetof(NRF_PPI_Type, FORK)         == 0x910, "PPI layout");
+_Static_assert(offsetof(NRF_GPIO_Type, PIN_CNF)     == 0x700, "GPIO layout");
+_Static_assert(offsetof(NRF_NVMC_Type, ERASEPAGEPARTIALCFG) == 0x51c, "NVMC layout");
+
+//=========================== variables =======================================
+
+typedef struct {
+    uint8_t        running;
+    uint8_t        seq;             // playing
+    uint32_t       step;            // period within it
+    uint32_t       loops;           // seq 1 played, since SEQSTART
+    uint8_t        stopping;        // STOP, at the end of the period
+    uint64_t       period_end;
+    uint64_t       edge[SIM_NUM_PWM_CH]; // the compare edge of this period, SIM_NEVER if none
+    uint8_t        edge_level[SIM_NUM_PWM_CH];
+    uint8_t        out[SIM_NUM_PWM_CH];
+} sim_pwm_t;
+
+typedef struct {
+    uint8_t        active;
+    uint32_t       bit;             // of the transaction, MSB of byte 0 first
+    uint32_t       num_bits;
+    uint8_t        byte;
+    uint64_t       t0;              // first bit
+    uint64_t       period;          // of a bit
+    uint64_t       next;            // next edge
+    uint8_t        phase;           // 0: DATA set, 1: CLK rises, 2: CLK falls
+    uint8_t        sck;
+    uint8_t        mosi;
+    uint32_t       unprotected;     // transactions started without the anomaly 198 workaround
+} sim_spim_t;
+
+typedef struct {
+    uint8_t        running;
+    uint32_t       count;
+} sim_timer_t;
+
+typedef struct {
+    uint64_t       now;
+    uint32_t       erase_ms[SIM_FLASH_NUM_PAGES]; // partial erases so far, per page
+    uint32_t       pins;            // resolved levels
+    sim_pin_hook_t pin_hook;
+    uint8_t        irq_enabled[SIM_NUM_IRQS];
+    uint8_t        irq_pending[SIM_NUM_IRQS];
+    uint8_t        irq_active[SIM_NUM_IRQS];
+    uint64_t       irq_since[SIM_NUM_IRQS];
+    sim_pwm_t      pwm;
+    sim_spim_t     spim;
+    sim_timer_t    timer;
+} sim_regs_vars_t;
+
+sim_regs_vars_t sim_regs_vars;
+
+DWT_Type        sim_dwt;
+CoreDebug_Type  sim_core_debug;
+
+#define NVMC      ((NRF_NVMC_Type*)(uintptr_t)NRF_NVMC_BASE)
+#define P0        ((NRF_GPIO_Type*)(uintptr_t)NRF_P0_BASE)
+#define PWM0      ((NRF_PWM_Type*)(uintptr_t)NRF_PWM0_BASE)
+#define SPIM3     ((NRF_SPIM_Type*)(uintptr_t)NRF_SPIM3_BASE)
+#define TIMER3    ((NRF_TIMER_Type*)(uintptr_t)NRF_TIMER3_BASE)
+#define PPI       ((NRF_PPI_Type*)(uintptr_t)NRF_PPI_BASE)
+
+//=========================== prototypes ======================================
+
+void     _sim_writes(void);
+void     _sim_inten(volatile uint32_t* inten);
+void     _sim_event(volatile uint32_t* event);
+void     _sim_task(uint32_t addr);
+void     _sim_step(void);
+void     _sim_pins(void);
+void     _sim_irqs(void);
+void     _sim_irq_line(IRQn_Type irq, uintptr_t base);
+void     _sim_nvmc_sync(void);
+void     _sim_pwm_tasks(void);
+void     _sim_pwm_period(void);
+void     _sim_pwm_edges(void);
+uint64_t _sim_pwm_next(void);
+void     _sim_spim_tasks(void);
+void     _sim_spim_edge(void);
+void     _sim_timer_tasks(void);
+void     _sim_ppi_tasks(void);
+
+//=========================== public ==========================================
+
+void sim_regs_init(void) {
+    uint8_t ch;
+
+    if (mmap((void*)(uintptr_t)NRF_POWER_BASE, SIM_APB_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)==MAP_FAILED ||
+        mmap((void*)(uintptr_t)NRF_P0_BASE, SIM_AHB_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)==MAP_FAILED) {
+        perror("sim: mapping the peripherals");
+        exit(1);
+    }
+    memset(&sim_regs_vars, 0, sizeof(sim_regs_vars));
+
+    // reset values
+    NVMC->READY                        = 1;
+    NVMC->READYNEXT                    = 1;
+    NVMC->ERASEPAGEPARTIALCFG          = 10;
+    for (ch=0;ch<SIM_NUM_PWM_CH;ch++) {
+        PWM0->PSEL.OUT[ch]             = 0xffffffff;
+        sim_regs_vars.pwm.edge[ch]     = SIM_NEVER;
+    }
+    PWM0->LOOP                         = 0;
+    PWM0->COUNTERTOP                   = 0x3ff;
+    SPIM3->PSEL.SCK                    = 0xffffffff;
+    SPIM3->PSEL.MOSI                   = 0xffffffff;
+    SPIM3->PSEL.MISO                   = 0xffffffff;
+    SPIM3->PSEL.CSN                    = 0xffffffff;
+    SPIM3->FREQUENCY                   = 0x04000000;
+}
+
+void* sim_reg(uintptr_t base) {
+    sim_regs_sync();
+    return (void*)base;
+}
+
+void sim_regs_sync(void) {
+    _sim_writes();
+    sim_run(sim_regs_vars.now+SIM_ACCESS_PS);
+}
+
+uint64_t sim_time(void) {
+    return sim_regs_vars.now;
+}
+
+uint64_t sim_next_event(void) {
+    uint64_t next;
+
+    // the firmware's last writes apply first
+    _sim_writes();
+    next = _sim_pwm_next();
+    if (sim_regs_vars.spim.active && sim_regs_vars.spim.next<next) {
+        next = sim_regs_vars.spim.next;
+    }
+    return next;
+}
+
+void sim_run(uint64_t until) {
+    uint64_t next;
+
+    // what is due, in order
+    while ((next = sim_next_event())<=until) {
+        if (next>sim_regs_vars.now) {
+            sim_regs_vars.now          = next;
+        }
+        _sim_step();
+    }
+    if (until>sim_regs_vars.now) {
+        sim_regs_vars.now              = until;
+    }
+}
+
+void sim_pin_hook(sim_pin_hook_t hook) {
+    sim_regs_vars.pin_hook             = hook;
+}
+
+uint8_t sim_irq_pending(IRQn_Type irq, uint64_t* since) {
+    _sim_writes();
+    *since = sim_regs_vars.irq_since[irq];
+    return sim_regs_vars.irq_pending[irq];
+}
+
+void sim_irq_enter(IRQn_Type irq) {
+    sim_regs_vars.irq_pending[irq]     = 0;
+    sim_regs_vars.irq_active[irq]      = 1;
+}
+
+void sim_irq_exit(IRQn_Type irq) {
+    // level sensitive, pending again if the handler left an event set
+    sim_regs_vars.irq_active[irq]      = 0;
+    sim_regs_sync();
+}
+
+uint32_t sim_spim_unprotected(void) {
+    return sim_regs_vars.spim.unprotected;
+}
+
+//=== NVIC
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority) {
+    (void)irq;
+    (void)priority;
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq) {
+    sim_regs_vars.irq_enabled[irq]     = 1;
+}
+
+void NVIC_DisableIRQ(IRQn_Type irq) {
+    sim_regs_vars.irq_enabled[irq]     = 0;
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq) {
+    // the registers written so far apply first, an INTENCLR just before
+    // drops the line
+    _sim_writes();
+    sim_regs_vars.irq_pending[irq]     = 0;
+    _sim_irqs();
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type irq) {
+    if (sim_regs_vars.irq_pending[irq]==0) {
+        sim_regs_vars.irq_pending[irq] = 1;
+        sim_regs_vars.irq_since[irq]   = sim_regs_vars.now;
+    }
+}
+
+//=========================== private =========================================
+
+void _sim_writes(void) {
+
+    // SET/CLR registers fold into the one they set and clear
+    P0->OUT                           |=  P0->OUTSET;
+    P0->OUT                           &= ~P0->OUTCLR;
+    P0->OUTSET                         = 0;
+    P0->OUTCLR                         = 0;
+    _sim_inten(&PWM0->INTEN);
+    _sim_inten(&SPIM3->INTEN);
+    _sim_inten(&TIMER3->INTEN);
+    PPI->CHEN                         |=  PPI->CHENSET;
+    PPI->CHEN                         &= ~PPI->CHENCLR;
+    PPI->CHENSET                       = 0;
+    PPI->CHENCLR                       = 0;
+
+    // tasks, then what they changed
+    _sim_nvmc_sync();
+    _sim_ppi_tasks();
+    _sim_timer_tasks();
+    _sim_pwm_tasks();
+    _sim_spim_tasks();
+    _sim_pins();
+    _sim_irqs();
+}
+
+void _sim_inten(volatile uint32_t* inten) {
+    inten[0]                          |=  inten[1];
+    inten[0]                          &= ~inten[2];
+    inten[1]                           = 0;
+    inten[2]                           = 0;
+}
+
+void _sim_event(volatile uint32_t* event) {
+    uint32_t addr;
+    uint32_t chen;
+    uint8_t  ch;
+
+    *event                             = 1;
+
+    // every channel on it, as enabled now, whatever its tasks change
+    addr = (uint32_t)(uintptr_t)event;
+    chen = PPI->CHEN;
+    for (ch=0;ch<SIM_NUM_PPI_CH;ch++) {
+        if ((chen & (0x00000001 << ch)) && PPI->CH[ch].EEP==addr) {
+            _sim_task(PPI->CH[ch].TEP);
+            _sim_task(PPI->FORK[ch].TEP);
+        }
+    }
+}
+
+void _sim_task(uint32_t addr) {
+    if (addr==0) {
+        return;
+    }
+    *(volatile uint32_t*)(uintptr_t)addr = 1;
+    switch (addr & 0xfffff000) {
+        case NRF_PWM0_BASE:   _sim_pwm_tasks();   break;
+        case NRF_SPIM3_BASE:  _sim_spim_tasks();  break;
+        case NRF_TIMER3_BASE: _sim_timer_tasks(); break;
+        case NRF_PPI_BASE:    _sim_ppi_tasks();   break;
+        default:                                  break;
+    }
+}
+
+void _sim_step(void) {
+    uint64_t now;
+    uint8_t  ch;
+
+    now = sim_regs_vars.now;
+    if (sim_regs_vars.spim.active && sim_regs_vars.spim.next<=now) {
+        _sim_spim_edge();
+    }
+    if (sim_regs_vars.pwm.running) {
+        for (ch=0;ch<SIM_NUM_PWM_CH;ch++) {
+            if (sim_regs_vars.pwm.edge[ch]<=now) {
+                sim_regs_vars.pwm.out[ch]  = sim_regs_vars.pwm.edge_level[ch];
+                sim_regs_vars.pwm.edge[ch] = SIM_NEVER;
+            }
+        }
+        if (sim_regs_vars.pwm.period_end<=now) {
+            _sim_pwm_period();
+        }
+    }
+    _sim_pins();
+    _sim_irqs();
+}
+
+void _sim_pins(void) {
+    uint32_t pins;
+    uint32_t changed;
+    uint32_t psel;
+    uint8_t  ch;
+    uint8_t  pin;
+
+    // GPIO, then the peripherals that took pins over
+    pins = P0->OUT;
+    if (PWM0->ENABLE) {
+        for (ch=0;ch<SIM_NUM_PWM_CH;ch++) {
+            psel = PWM0->PSEL.OUT[ch];
+            if ((psel & SIM_PSEL_DISCONNECTED)==0) {
+                pins = (pins & ~(0x00000001 << (psel & 0x1f))) | (sim_regs_vars.pwm.out[ch] << (psel & 0x1f));
+            }
+        }
+    }
+    if (SPIM3->ENABLE==0x00000007) {
+        psel = SPIM3->PSEL.SCK;
+        if ((psel & SIM_PSEL_DISCONNECTED)==0) {
+            pins = (pins & ~(0x00000001 << (psel & 0x1f))) | (sim_regs_vars.spim.sck << (psel & 0x1f));
+        }
+        psel = SPIM3->PSEL.MOSI;
+        if ((psel & SIM_PSEL_DISCONNECTED)==0) {
+            pins = (pins & ~(0x00000001 << (psel & 0x1f))) | (sim_regs_vars.spim.mosi << (psel & 0x1f));
+        }
+    }
+
+    changed                            = pins ^ sim_regs_vars.pins;
+    sim_regs_vars.pins                 = pins;
+    for (pin=0;changed && pin<32;pin++) {
+        if ((changed & (0x00000001 << pin)) && sim_regs_vars.pin_hook) {
+            sim_regs_vars.pin_hook(pin, (pins >> pin) & 1, sim_regs_vars.now);
+        }
+    }
+}
+
+void _sim_irqs(void) {
+    _sim_irq_line(PWM0_IRQn,   NRF_PWM0_BASE);
+    _sim_irq_line(SPIM3_IRQn,  NRF_SPIM3_BASE);
+    _sim_irq_line(TIMER3_IRQn, NRF_TIMER3_BASE);
+}
+
+void _sim_irq_line(IRQn_Type irq, uintptr_t base) {
+    volatile uint32_t* regs;
+    uint32_t           inten;
+    uint8_t            i;
+
+    // INTEN bit i is the event at 0x100+4*i, on every peripheral
+    regs  = (volatile uint32_t*)base;
+    inten = regs[0x300/4];
+    if (sim_regs_vars.irq_enabled[irq]==0 || sim_regs_vars.irq_pending[irq] ||
+        sim_regs_vars.irq_active[irq] || inten==0) {
+        return;
+    }
+    for (i=0;i<32;i++) {
+        if ((inten & (0x00000001 << i)) && regs[0x100/4+i]) {
+            NVIC_SetPendingIRQ(irq);
+            return;
+        }
+    }
+}
+
+//=== NVMC
+
+void _sim_nvmc_sync(void) {
+    uint32_t page;
+
+    // a partial erase takes ERASEPAGEPARTIALCFG ms, the CPU stalled; the page
+    // reads erased once they add up to tERASEPAGE
+    if (NVMC->ERASEPAGEPARTIAL==0) {
+        return;
+    }
+    page                               = NVMC->ERASEPAGEPARTIAL/SIM_FLASH_PAGE_SIZE;
+    if (NVMC->CONFIG==0x00000002 && page<SIM_FLASH_NUM_PAGES) {
+        sim_regs_vars.erase_ms[page]  += NVMC->ERASEPAGEPARTIALCFG;
+        if (sim_regs_vars.erase_ms[page]>=SIM_ERASE_PAGE_MS) {
+            memset((void*)(uintptr_t)(page*SIM_FLASH_PAGE_SIZE), 0xff, SIM_FLASH_PAGE_SIZE);
+            sim_regs_vars.erase_ms[page] = 0;
+        }
+    }
+    NVMC->ERASEPAGEPARTIAL             = 0;
+}
+
+//=== PWM0
+
+void _sim_pwm_tasks(void) {
+    sim_pwm_t* pwm;
+    uint8_t    seq;
+    uint8_t    ch;
+
+    pwm = &sim_regs_vars.pwm;
+    if (PWM0->ENABLE==0 && pwm->running) {
+        // disabled under way, the pins go back to GPIO
+        pwm->running                   = 0;
+        pwm->stopping                  = 0;
+    }
+    for (seq=0;seq<2;seq++) {
+        if (PWM0->TASKS_SEQSTART[seq]) {
+            PWM0->TASKS_SEQSTART[seq]  = 0;
+            if (PWM0->ENABLE && PWM0->SEQ[seq].CNT) {
+                pwm->running           = 1;
+                pwm->stopping          = 0;
+                pwm->seq               = seq;
+                pwm->step              = 0;
+                pwm->loops             = 0;
+                pwm->period_end        = sim_regs_vars.now;
+                for (ch=0;ch<SIM_NUM_PWM_CH;ch++) {
+                    pwm->edge[ch]      = SIM_NEVER;
+                }
+                _sim_event(&PWM0->EVENTS_SEQSTARTED[seq]);
+                _sim_pwm_edges();
+            }
+        }
+    }
+    if (PWM0->TASKS_STOP) {
+        PWM0->TASKS_STOP               = 0;
+        if (pwm->running) {
+            pwm->stopping              = 1;
+        } else {
+            _sim_event(&PWM0->EVENTS_STOPPED);
+        }
+    }
+}
+
+void _sim_pwm_period(void) {
+    sim_pwm_t* pwm;
+    uint32_t   steps;
+
+    pwm = &sim_regs_vars.pwm;
+    _sim_event(&PWM0->EVENTS_PWMPERIODEND);
+    if (pwm->stopping) {
+        // the outputs keep their level
+        pwm->running                   = 0;
+        pwm->stopping                  = 0;
+        _sim_event(&PWM0->EVENTS_STOPPED);
+        return;
+    }
+
+    // next value, of this sequence or of the next one
+    pwm->step++;
+    steps = PWM0->SEQ[pwm->seq].CNT/2;
+    if (pwm->step>=steps) {
+        pwm->step                      = 0;
+        if (pwm->seq==0 && PWM0->LOOP && PWM0->SEQ[1].CNT) {
+            pwm->seq                   = 1;
+        } else {
+            pwm->loops                += pwm->seq;
+            if (PWM0->LOOP==0 || pwm->loops>=PWM0->LOOP) {
+                pwm->running           = 0;
+                _sim_event(&PWM0->EVENTS_LOOPSDONE);
+                if (PWM0->SHORTS & 0x00000004) {
+                    _sim_task((uint32_t)(uintptr_t)&PWM0->TASKS_SEQSTART[0]);
+                } else if (PWM0->SHORTS & 0x00000008) {
+                    _sim_task((uint32_t)(uintptr_t)&PWM0->TASKS_SEQSTART[1]);
+                } else {
+                    _sim_event(&PWM0->EVENTS_STOPPED);
+                }
+                return;
+            }
+            pwm->seq                   = 0;
+        }
+        _sim_event(&PWM0->EVENTS_SEQSTARTED[pwm->seq]);
+    }
+    _sim_pwm_edges();
+}
+
+void _sim_pwm_edges(void) {
+    sim_pwm_t*      pwm;
+    const uint16_t* values;
+    uint64_t        tick;
+    uint32_t        top;
+    uint16_t        value;
+    uint16_t        cmp;
+    uint8_t         initial;
+    uint8_t         seq;
+    uint8_t         ch;
+
+    // the value of this period, read from RAM now, grouped: [ch0,1][ch2,3]
+    pwm    = &sim_regs_vars.pwm;
+    seq    = pwm->seq;
+    values = (const uint16_t*)(uintptr_t)PWM0->SEQ[seq].PTR;
+    top    = PWM0->COUNTERTOP;
+    tick   = SIM_TICK_PS << PWM0->PRESCALER;
+    for (ch=0;ch<SIM_NUM_PWM_CH;ch++) {
+        value                          = values[2*pwm->step+ch/2];
+        cmp                            = value & 0x7fff;
+        initial                        = (value & 0x8000) ? 0 : 1;  // bit 15: rising edge
+        pwm->out[ch]                   = initial;
+        pwm->edge[ch]                  = SIM_NEVER;
+        if (cmp==0) {
+            pwm->out[ch]               = initial ^ 1;
+        } else if (cmp<top) {
+            pwm->edge[ch]              = pwm->period_end+cmp*tick;
+            pwm->edge_level[ch]        = initial ^ 1;
+        }
+    }
+    pwm->period_end                   += top*tick;
+
+    // the last value of the sequence is in
+    if (pwm->step==PWM0->SEQ[seq].CNT/2-1) {
+        _sim_event(&PWM0->EVENTS_SEQEND[seq]);
+        if (PWM0->SHORTS & (0x00000001 << seq)) {
+            _sim_task((uint32_t)(uintptr_t)&PWM0->TASKS_STOP);
+        }
+    }
+}
+
+uint64_t _sim_pwm_next(void) {
+    uint64_t next;
+    uint8_t  ch;
+
+    if (sim_regs_vars.pwm.running==0) {
+        return SIM_NEVER;
+    }
+    next = sim_regs_vars.pwm.period_end;
+    for (ch=0;ch<SIM_NUM_PWM_CH;ch++) {
+        if (sim_regs_vars.pwm.edge[ch]<next) {
+            next = sim_regs_vars.pwm.edge[ch];
+        }
+    }
+    return next;
+}
+
+//=== SPIM3
+
+void _sim_spim_tasks(void) {
+    sim_spim_t* spim;
+    uint32_t    ptr;
+    uint32_t    blocks;
+    uint32_t    block;
+    uint32_t    bps;
+
+    spim = &sim_regs_vars.spim;
+    if (SPIM3->ENABLE!=0x00000007) {
+        spim->active                   = 0;
+        spim->sck                      = 0;
+        spim->mosi                     = 0;
+    }
+    if (SPIM3->TASKS_STOP) {
+        SPIM3->TASKS_STOP              = 0;
+        spim->active                   = 0;
+        spim->sck                      = 0;
+        _sim_event(&SPIM3->EVENTS_STOPPED);
+    }
+    if (SPIM3->TASKS_START==0) {
+        return;
+    }
+    SPIM3->TASKS_START                 = 0;
+    if (SPIM3->ENABLE!=0x00000007 || spim->active) {
+        return;
+    }
+
+    // EasyDMA reads TXD.PTR on, anomaly 198 wants the RAM blocks it reads
+    // from given to SPIM3, the blocks above 0x20010000 are one
+    ptr    = SPIM3->TXD.PTR;
+    blocks = *(volatile uint32_t*)(uintptr_t)SIM_ANOMALY_198;
+    block  = (ptr>=0x20010000) ? 8 : ((ptr>>13) & 0x7);
+    if ((blocks & (0x00000001 << block))==0) {
+        spim->unprotected++;
+    }
+
+    switch (SPIM3->FREQUENCY) {
+        case 0x02000000: bps =   125000; break;
+        case 0x04000000: bps =   250000; break;
+        case 0x08000000: bps =   500000; break;
+        case 0x10000000: bps =  1000000; break;
+        case 0x20000000: bps =  2000000; break;
+        case 0x40000000: bps =  4000000; break;
+        case 0x80000000: bps =  8000000; break;
+        case 0x0A000000: bps = 16000000; break;
+        case 0x14000000: bps = 32000000; break;
+        default:         bps =   250000; break;
+    }
+    spim->active                       = 1;
+    spim->bit                          = 0;
+    spim->num_bits                     = SPIM3->TXD.MAXCNT*8;
+    spim->period                       = 1000000000000ULL/bps;
+    spim->t0                           = sim_regs_vars.now+SIM_SPIM_START_PS;
+    spim->next                         = spim->t0;
+    spim->phase                        = 0;
+    _sim_event(&SPIM3->EVENTS_STARTED);
+}
+
+void _sim_spim_edge(void) {
+    sim_spim_t* spim;
+    uint8_t*    tx;
+
+    // mode 0: DATA with the falling edge of the bit before, CLK high the
+    // second half of the bit
+    spim = &sim_regs_vars.spim;
+    if (spim->bit==spim->num_bits) {
+        // done with the last falling edge
+        spim->active                   = 0;
+        SPIM3->TXD.AMOUNT              = SPIM3->TXD.MAXCNT;
+        if (SPIM3->TXD.LIST==0x00000001) {
+            SPIM3->TXD.PTR            += SPIM3->TXD.MAXCNT;
+        }
+        _sim_event(&SPIM3->EVENTS_ENDTX);
+        _sim_event(&SPIM3->EVENTS_END);
+        return;
+    }
+    switch (spim->phase) {
+        case 0:
+            if ((spim->bit & 7)==0) {
+                tx                     = (uint8_t*)(uintptr_t)SPIM3->TXD.PTR;
+                spim->byte             = tx[spim->bit/8];
+            }
+            spim->mosi                 = (spim->byte >> (7-(spim->bit & 7))) & 1;
+            spim->phase                = 1;
+            spim->next                 = spim->t0+spim->bit*spim->period+spim->period/2;
+            break;
+        case 1:
+            spim->sck                  = 1;
+            spim->phase                = 2;
+            spim->next                 = spim->t0+(spim->bit+1)*spim->period;
+            break;
+        default:
+            spim->sck                  = 0;
+            spim->bit++;
+            spim->phase                = 0;
+            break;
+    }
+}
+
+//=== TIMER3
+
+void _sim_timer_tasks(void) {
+    sim_timer_t* timer;
+    uint32_t     mask;
+    uint8_t      i;
+
+    timer = &sim_regs_vars.timer;
+    if (TIMER3->TASKS_START) {
+        TIMER3->TASKS_START            = 0;
+        timer->running                 = 1;
+    }
+    if (TIMER3->TASKS_STOP) {
+        TIMER3->TASKS_STOP             = 0;
+        timer->running                 = 0;
+    }
+    if (TIMER3->TASKS_CLEAR) {
+        TIMER3->TASKS_CLEAR            = 0;
+        timer->count                   = 0;
+    }
+    if (TIMER3->TASKS_COUNT) {
+        TIMER3->TASKS_COUNT            = 0;
+        if (timer->running==0 || TIMER3->MODE==0) {
+            return;
+        }
+        switch (TIMER3->BITMODE) {
+            case 0:  mask = 0x0000ffff; break;
+            case 1:  mask = 0x000000ff; break;
+            case 2:  mask = 0x00ffffff; break;
+            default: mask = 0xffffffff; break;
+        }
+        timer->count                   = (timer->count+1) & mask;
+        for (i=0;i<6;i++) {
+            if (timer->count==TIMER3->CC[i]) {
+                _sim_event(&TIMER3->EVENTS_COMPARE[i]);
+                if (TIMER3->SHORTS & (0x00000001 << i)) {
+                    timer->count       = 0;
+                }
+                if (TIMER3->SHORTS & (0x00000100 << i)) {
+                    timer->running     = 0;
+                }
+            }
+        }
+    }
+}
+
+//=== PPI
+
+void _sim_ppi_tasks(void) {
+    uint8_t chg;
+
+    for (chg=0;chg<SIM_NUM_PPI_CHG;chg++) {
+        if (PPI->TASKS_CHG[chg].EN) {
+            PPI->TASKS_CHG[chg].EN     = 0;
+            PPI->CHEN                 |= PPI->CHG[chg];
+        }
+        if (PPI->TASKS_CHG[chg].DIS) {
+            PPI->TASKS_CHG[chg].DIS    = 0;
+            PPI->CHEN                 &= ~PPI->CHG[chg];
+        }
+    }
+}
@@ -0,0 +1,306 @@
+/**
+Stand-in for the nRF52840 device header, for the host builds.
+
+The register blocks the modules built on the host touch, laid out as on the
+chip and mapped at the chip's addresses by sim_regs_init() (nrf52840.c), so
+that addresses taken from them fit in the firmware's 32-bit integers. Every
+NRF_xxx goes through sim_reg(), which first completes what the previous
+accesses started: a write to a task or command register takes effect at the
+next register access, as the peripheral would have acted on it by then.
+Each access also moves simulated time on by SIM_ACCESS_PS, so that a loop
+polling a register sees the peripheral progress. Modelled:
+- NVMC: ERASEPAGEPARTIAL erases for ERASEPAGEPARTIALCFG ms, the page reads
+  erased once tERASEPAGE is reached; flash writes go straight to memory
+- P0: OUT, OUTSET, OUTCLR, every pin an output
+- PWM0: up counter, grouped decoder, two sequences, LOOP, the SEQEND/
+  LOOPSDONE shortcuts, STOP at the end of the period
+- SPIM3: mode 0, MSB first, TXD only, ArrayList, SPIM_START_PS from START
+  to the first bit
+- TIMER3: counter mode only
+- PPI: CH[0..19], channel groups, FORK
+- NVIC: enable and pending per IRQ, level sensitive as on the chip; the
+  host build runs the handlers itself, see sim_irq_pending()
+Pin changes, as the peripheral or P0 drives them, go to the hook given to
+sim_pin_hook(), with their time.
+
+DWT and CoreDebug are plain variables, the CMSIS intrinsics need no masking
+with a single thread of execution.
+*/
+
+#ifndef __NRF52840_H
+#define __NRF52840_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+#define NRF_POWER_BASE              0x40000000UL
+#define NRF_TIMER3_BASE             0x4001A000UL
+#define NRF_PWM0_BASE               0x4001C000UL
+#define NRF_NVMC_BASE               0x4001E000UL
+#define NRF_PPI_BASE                0x4001F000UL
+#define NRF_SPIM3_BASE              0x4002F000UL
+#define NRF_P0_BASE                 0x50000000UL
+
+#define SIM_TICK_PS                 62500ULL // 16MHz, TIMER2/timestamp_get()
+#define SIM_ACCESS_PS               15625ULL // one 64MHz CPU cycle per register access
+#define SIM_SPIM_START_PS           250000ULL // START to the first bit, assumed
+#define SIM_NEVER                   0xffffffffffffffffULL
+
+//=========================== typedef =========================================
+
+typedef enum {
+    TIMER3_IRQn                     = 26,
+    PWM0_IRQn                       = 28,
+    SPIM3_IRQn                      = 47,
+    SIM_NUM_IRQS                    = 48,
+} IRQn_Type;
+
+typedef struct {
+    volatile uint32_t RESERVED0[256];
+    volatile uint32_t READY;                // 0x400
+    volatile uint32_t RESERVED1;
+    volatile uint32_t READYNEXT;            // 0x408
+    volatile uint32_t RESERVED2[62];
+    volatile uint32_t CONFIG;               // 0x504
+    volatile uint32_t ERASEPAGE;            // 0x508
+    volatile uint32_t ERASEALL;             // 0x50c
+    volatile uint32_t ERASEPCR0;            // 0x510
+    volatile uint32_t ERASEUICR;            // 0x514
+    volatile uint32_t ERASEPAGEPARTIAL;     // 0x518
+    volatile uint32_t ERASEPAGEPARTIALCFG;  // 0x51c
+} NRF_NVMC_Type;
+
+typedef struct {
+    volatile uint32_t RESERVED0[321];
+    volatile uint32_t OUT;                  // 0x504
+    volatile uint32_t OUTSET;               // 0x508
+    volatile uint32_t OUTCLR;               // 0x50c
+    volatile uint32_t IN;                   // 0x510
+    volatile uint32_t DIR;                  // 0x514
+    volatile uint32_t DIRSET;               // 0x518
+    volatile uint32_t DIRCLR;               // 0x51c
+    volatile uint32_t LATCH;                // 0x520
+    volatile uint32_t DETECTMODE;           // 0x524
+    volatile uint32_t RESERVED1[118];
+    volatile uint32_t PIN_CNF[32];          // 0x700
+} NRF_GPIO_Type;
+
+typedef struct {
+    volatile uint32_t PTR;
+    volatile uint32_t CNT;
+    volatile uint32_t REFRESH;
+    volatile uint32_t ENDDELAY;
+    volatile uint32_t RESERVED[4];
+} PWM_SEQ_Type;
+
+typedef struct {
+    volatile uint32_t OUT[4];
+} PWM_PSEL_Type;
+
+typedef struct {
+    volatile uint32_t RESERVED0;
+    volatile uint32_t TASKS_STOP;           // 0x004
+    volatile uint32_t TASKS_SEQSTART[2];    // 0x008
+    volatile uint32_t TASKS_NEXTSTEP;       // 0x010
+    volatile uint32_t RESERVED1[60];
+    volatile uint32_t EVENTS_STOPPED;       // 0x104
+    volatile uint32_t EVENTS_SEQSTARTED[2]; // 0x108
+    volatile uint32_t EVENTS_SEQEND[2];     // 0x110
+    volatile uint32_t EVENTS_PWMPERIODEND;  // 0x118
+    volatile uint32_t EVENTS_LOOPSDONE;     // 0x11c
+    volatile uint32_t RESERVED2[56];
+    volatile uint32_t SHORTS;               // 0x200
+    volatile uint32_t RESERVED3[63];
+    volatile uint32_t INTEN;                // 0x300
+    volatile uint32_t INTENSET;             // 0x304
+    volatile uint32_t INTENCLR;             // 0x308
+    volatile uint32_t RESERVED4[125];
+    volatile uint32_t ENABLE;               // 0x500
+    volatile uint32_t MODE;                 // 0x504
+    volatile uint32_t COUNTERTOP;           // 0x508
+    volatile uint32_t PRESCALER;            // 0x50c
+    volatile uint32_t DECODER;              // 0x510
+    volatile uint32_t LOOP;                 // 0x514
+    volatile uint32_t RESERVED5[2];
+    PWM_SEQ_Type      SEQ[2];               // 0x520
+    PWM_PSEL_Type     PSEL;                 // 0x560
+} NRF_PWM_Type;
+
+typedef struct {
+    volatile uint32_t SCK;
+    volatile uint32_t MOSI;
+    volatile uint32_t MISO;
+    volatile uint32_t CSN;
+} SPIM_PSEL_Type;
+
+typedef struct {
+    volatile uint32_t PTR;
+    volatile uint32_t MAXCNT;
+    volatile uint32_t AMOUNT;
+    volatile uint32_t LIST;
+} SPIM_DMA_Type;
+
+typedef struct {
+    volatile uint32_t RESERVED0[4];
+    volatile uint32_t TASKS_START;          // 0x010
+    volatile uint32_t TASKS_STOP;           // 0x014
+    volatile uint32_t RESERVED1;
+    volatile uint32_t TASKS_SUSPEND;        // 0x01c
+    volatile uint32_t TASKS_RESUME;         // 0x020
+    volatile uint32_t RESERVED2[56];
+    volatile uint32_t EVENTS_STOPPED;       // 0x104
+    volatile uint32_t RESERVED3[2];
+    volatile uint32_t EVENTS_ENDRX;         // 0x110
+    volatile uint32_t RESERVED4;
+    volatile uint32_t EVENTS_END;           // 0x118
+    volatile uint32_t RESERVED5;
+    volatile uint32_t EVENTS_ENDTX;         // 0x120
+    volatile uint32_t RESERVED6[10];
+    volatile uint32_t EVENTS_STARTED;       // 0x14c
+    volatile uint32_t RESERVED7[44];
+    volatile uint32_t SHORTS;               // 0x200
+    volatile uint32_t RESERVED8[63];
+    volatile uint32_t INTEN;                // 0x300, not on the chip, INTENSET reads it there
+    volatile uint32_t INTENSET;             // 0x304
+    volatile uint32_t INTENCLR;             // 0x308
+    volatile uint32_t RESERVED9[125];
+    volatile uint32_t ENABLE;               // 0x500
+    volatile uint32_t RESERVED10;
+    SPIM_PSEL_Type    PSEL;                 // 0x508
+    volatile uint32_t RESERVED11[3];
+    volatile uint32_t FREQUENCY;            // 0x524
+    volatile uint32_t RESERVED12[3];
+    SPIM_DMA_Type     RXD;                  // 0x534
+    SPIM_DMA_Type     TXD;                  // 0x544
+    volatile uint32_t CONFIG;               // 0x554
+    volatile uint32_t RESERVED13[26];
+    volatile uint32_t ORC;                  // 0x5c0
+} NRF_SPIM_Type;
+
+typedef struct {
+    volatile uint32_t TASKS_START;          // 0x000
+    volatile uint32_t TASKS_STOP;           // 0x004
+    volatile uint32_t TASKS_COUNT;          // 0x008
+    volatile uint32_t TASKS_CLEAR;          // 0x00c
+    volatile uint32_t TASKS_SHUTDOWN;       // 0x010
+    volatile uint32_t RESERVED0[11];
+    volatile uint32_t TASKS_CAPTURE[6];     // 0x040
+    volatile uint32_t RESERVED1[58];
+    volatile uint32_t EVENTS_COMPARE[6];    // 0x140
+    volatile uint32_t RESERVED2[42];
+    volatile uint32_t SHORTS;               // 0x200
+    volatile uint32_t RESERVED3[63];
+    volatile uint32_t INTEN;                // 0x300, not on the chip, INTENSET reads it there
+    volatile uint32_t INTENSET;             // 0x304
+    volatile uint32_t INTENCLR;             // 0x308
+    volatile uint32_t RESERVED4[126];
+    volatile uint32_t MODE;                 // 0x504
+    volatile uint32_t BITMODE;              // 0x508
+    volatile uint32_t RESERVED5;
+    volatile uint32_t PRESCALER;            // 0x510
+    volatile uint32_t RESERVED6[11];
+    volatile uint32_t CC[6];                // 0x540
+} NRF_TIMER_Type;
+
+typedef struct {
+    volatile uint32_t EN;
+    volatile uint32_t DIS;
+} PPI_TASKS_CHG_Type;
+
+typedef struct {
+    volatile uint32_t EEP;
+    volatile uint32_t TEP;
+} PPI_CH_Type;
+
+typedef struct {
+    volatile uint32_t TEP;
+} PPI_FORK_Type;
+
+typedef struct {
+    PPI_TASKS_CHG_Type TASKS_CHG[6];        // 0x000
+    volatile uint32_t RESERVED0[308];
+    volatile uint32_t CHEN;                 // 0x500
+    volatile uint32_t CHENSET;              // 0x504
+    volatile uint32_t CHENCLR;              // 0x508
+    volatile uint32_t RESERVED1;
+    PPI_CH_Type       CH[20];               // 0x510
+    volatile uint32_t RESERVED2[148];
+    volatile uint32_t CHG[6];               // 0x800
+    volatile uint32_t RESERVED3[62];
+    PPI_FORK_Type     FORK[32];             // 0x910
+} NRF_PPI_Type;
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef void (*sim_pin_hook_t)(uint8_t pin, uint8_t level, uint64_t ps);
+
+//=========================== variables =======================================
+
+// in nrf52840.c
+extern DWT_Type       sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+
+//=========================== defines =========================================
+
+#define NRF_NVMC                    ((NRF_NVMC_Type*)sim_reg(NRF_NVMC_BASE))
+#define NRF_P0                      ((NRF_GPIO_Type*)sim_reg(NRF_P0_BASE))
+#define NRF_PWM0                    ((NRF_PWM_Type*)sim_reg(NRF_PWM0_BASE))
+#define NRF_SPIM3                   ((NRF_SPIM_Type*)sim_reg(NRF_SPIM3_BASE))
+#define NRF_TIMER3                  ((NRF_TIMER_Type*)sim_reg(NRF_TIMER3_BASE))
+#define NRF_PPI                     ((NRF_PPI_Type*)sim_reg(NRF_PPI_BASE))
+#define DWT                         (&sim_dwt)
+#define CoreDebug                   (&sim_core_debug)
+
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+
+//=========================== prototypes ======================================
+
+// register file
+void     sim_regs_init(void);
+void*    sim_reg(uintptr_t base);
+void     sim_regs_sync(void);
+// scheduler, in ps
+uint64_t sim_time(void);
+uint64_t sim_next_event(void);
+void     sim_run(uint64_t until);
+void     sim_pin_hook(sim_pin_hook_t hook);
+uint8_t  sim_irq_pending(IRQn_Type irq, uint64_t* since);
+void     sim_irq_enter(IRQn_Type irq);
+void     sim_irq_exit(IRQn_Type irq);
+uint32_t sim_spim_unprotected(void);
+// NVIC
+void     NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void     NVIC_EnableIRQ(IRQn_Type irq);
+void     NVIC_DisableIRQ(IRQn_Type irq);
+void     NVIC_ClearPendingIRQ(IRQn_Type irq);
+void     NVIC_SetPendingIRQ(IRQn_Type irq);
+
+//=========================== intrinsics ======================================
+
+static inline void     __disable_irq(void)            { }
+static inline void     __enable_irq(void)             { }
+static inline uint32_t __get_PRIMASK(void)            { return 0; }
+static inline void     __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void     __DMB(void)                    { __sync_synchronize(); }
+static inline uint32_t __RBIT(uint32_t v) {
+    uint32_t r;
+    uint8_t  i;
+
+    r = 0;
+    for (i=0;i<32;i++) {
+        r = (r << 1) | ((v >> i) & 1);
+    }
+    return r;
+}
+static inline uint8_t  __CLZ(uint32_t v)              { return v ? __builtin_clz(v) : 32; }
+
+#endif
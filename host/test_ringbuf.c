@@ -0,0 +1,121 @@
+/**
+ringbuf.h stress test, on the host.
+
+A producer thread writes a counting byte pattern in random-sized pieces,
+the main thread consumes it with ringbuf_read() and with
+ringbuf_peek()/ringbuf_release() in turn, and checks every byte. The ring
+is small, so it wraps and runs full and empty all the time; both sides
+only ever touch their own counter, as the ISR and the main loop do on the
+nRF52840.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ringbuf.h"
+
+//=========================== defines =========================================
+
+#define TEST_RING_SIZE              256
+#define TEST_NUM_BYTES              50000000u
+#define TEST_WRITE_MAX              37  // not a divisor of the ring size
+#define TEST_READ_MAX               64
+
+#define TEST_PATTERN(i)             ((uint8_t)((i)*7+((i)>>8)))
+
+//=========================== variables =======================================
+
+uint8_t   test_mem[TEST_RING_SIZE];
+ringbuf_t test_ring;
+
+//=========================== private =========================================
+
+void* _test_producer(void* arg) {
+    uint8_t  buf[TEST_WRITE_MAX];
+    unsigned seed;
+    uint32_t sent;
+    uint32_t len;
+    uint32_t i;
+
+    (void)arg;
+    seed = 1;
+    sent = 0;
+    while (sent<TEST_NUM_BYTES) {
+        len = 1+rand_r(&seed)%TEST_WRITE_MAX;
+        if (len>TEST_NUM_BYTES-sent) {
+            len = TEST_NUM_BYTES-sent;
+        }
+        for (i=0;i<len;i++) {
+            buf[i] = TEST_PATTERN(sent+i);
+        }
+        len = ringbuf_write(&test_ring, buf, len);
+        if (len==0) {
+            // full, single-core hosts need the consumer to run
+            sched_yield();
+        }
+        sent += len;
+    }
+    return NULL;
+}
+
+uint8_t _test_check(const uint8_t* buf, uint32_t len, uint32_t received) {
+    uint32_t i;
+
+    for (i=0;i<len;i++) {
+        if (buf[i]!=TEST_PATTERN(received+i)) {
+            printf("FAIL byte %u: 0x%02x, expected 0x%02x\n",
+                   received+i, buf[i], TEST_PATTERN(received+i));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//=========================== main ============================================
+
+int main(void) {
+    pthread_t      producer;
+    uint8_t        buf[TEST_READ_MAX];
+    const uint8_t* data;
+    unsigned       seed;
+    uint32_t       received;
+    uint32_t       len;
+
+    seed = 2;
+    ringbuf_init(&test_ring, test_mem, TEST_RING_SIZE);
+    pthread_create(&producer, NULL, _test_producer, NULL);
+
+    received = 0;
+    while (received<TEST_NUM_BYTES) {
+        if (received & 1) {
+            // copy out
+            len  = ringbuf_read(&test_ring, buf, 1+rand_r(&seed)%TEST_READ_MAX);
+            data = buf;
+        } else {
+            // in place, as EasyDMA does, released afterwards
+            data = ringbuf_peek(&test_ring, &len);
+            if (len>TEST_READ_MAX) {
+                len = TEST_READ_MAX;
+            }
+        }
+        if (len && _test_check(data, len, received)) {
+            return 1;
+        }
+        if (data!=buf) {
+            ringbuf_release(&test_ring, len);
+        }
+        if (len==0) {
+            sched_yield();
+        }
+        received += len;
+    }
+    pthread_join(producer, NULL);
+    if (ringbuf_used(&test_ring)!=0) {
+        printf("FAIL %u bytes left in the ring\n", ringbuf_used(&test_ring));
+        return 1;
+    }
+
+    printf("ringbuf: %u bytes through a %u-byte ring, ok\n", received, TEST_RING_SIZE);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+'''
+Link.load() of tools/scum_programmer.py against the firmware's protocol, run
+by ./sim, over a link that drops and reorders frames.
+
+The fake serial port below is what Link opens: frames to the programmer are
+dropped, or held back and sent after the next one; frames from it, other
+than BOOT responses, are dropped. Each load must still stage exactly the
+image, which VERIFY checks against zlib's CRC32, and, when SCuM is booted,
+SCUM_VERIFY against SCuM's SRAM.
+'''
+
+import os
+import random
+import select
+import struct
+import subprocess
+import sys
+import types
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', 'tools'))
+
+DROP_TX  = 0.05     # to the programmer
+HOLD_TX  = 0.05     # to the programmer, after the next frame
+DROP_RX  = 0.02     # from the programmer
+
+#============================ link ============================================
+
+class LossySerial(object):
+    '''
+    serial.Serial over the pipes of ./sim, losing and reordering frames.
+    '''
+
+    sim = None
+
+    def __init__(self, port, baudrate, **kwargs):
+        self.held    = None         # frame sent after the next one
+        self.rx      = bytearray()  # from the programmer, not a whole frame yet
+        self.out     = bytearray()  # whole frames, for read()
+        self.dropped = 0
+        self.swapped = 0
+
+    @property
+    def in_waiting(self):
+        return len(self.out)
+
+    def write(self, data):
+        # Link writes one frame at a time
+        r = random.random()
+        if r < DROP_TX:
+            self.dropped += 1
+        elif r < DROP_TX + HOLD_TX and self.held is None:
+            self.held     = data
+        else:
+            self.sim.stdin.write(data)
+            if self.held is not None:
+                self.sim.stdin.write(self.held)
+                self.held     = None
+                self.swapped += 1
+        return len(data)
+
+    def read(self, size):
+        if not self.out:
+            (r, _, _) = select.select([self.sim.stdout], [], [], 0.1)
+            if not r:
+                # nothing else to overtake it
+                if self.held is not None:
+                    self.sim.stdin.write(self.held)
+                    self.held = None
+                return b''
+            self.rx += os.read(self.sim.stdout.fileno(), 4096)
+            while 0x7e in self.rx[1:]:
+                end   = self.rx.index(0x7e, 1) + 1
+                frame = bytes(self.rx[:end])
+                del self.rx[:end - 1]
+                # the BOOT response of a streamed load is sent once, not retried
+                if len(frame) > 3 and frame[1] != sp.RESPONSE | sp.CMD_BOOT and random.random() < DROP_RX:
+                    self.dropped += 1
+                else:
+                    self.out += frame
+        data = bytes(self.out[:size])
+        del self.out[:size]
+        return data
+
+sys.modules['serial'] = types.SimpleNamespace(Serial=LossySerial)
+
+import scum_programmer as sp
+
+#============================ helpers =========================================
+
+def code_image(size):
+    # Thumb-like: a few instruction patterns, literal pools, padding
+    out = bytearray()
+    ops = [bytes([random.randrange(256), random.choice((0x46, 0x68, 0x60, 0xb5, 0xbd, 0xf0, 0x47))]) for _ in range(64)]
+    while len(out) < size:
+        if random.random() < 0.1:
+            out += struct.pack('<I', random.choice((0x40000000, 0x20000000, random.getrandbits(32))))
+        else:
+            out += random.choice(ops)
+    return bytes(out[:size])
+
+def check_staged(link, image, name):
+    (length, crc) = struct.unpack('<II', link.request(sp.CMD_VERIFY))
+    if (length, crc) != (len(image), zlib.crc32(image) & 0xffffffff):
+        sys.exit('{0}: staged {1} bytes, CRC32 {2:08x}, sent {3} bytes, CRC32 {4:08x}'.format(
+            name, length, crc, len(image), zlib.crc32(image) & 0xffffffff))
+
+def check_scum(link, name):
+    resp = link.request(sp.CMD_SCUM_VERIFY, timeout=3.0)
+    if resp[0] != 0:
+        sys.exit('{0}: SCuM SRAM differs from the image at 0x{1:04x}'.format(name, struct.unpack('<I', resp[1:5])[0]))
+
+#============================ main ============================================
+
+def main():
+    seed = int(sys.argv[1]) if len(sys.argv) > 1 else 1
+    random.seed(seed)
+
+    sim = subprocess.Popen([os.path.join(HERE, 'sim')], stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0)
+    LossySerial.sim = sim
+    link = sp.Link('sim', 0)
+
+    image  = code_image(24 * 1024 + 100)
+    loads  = (
+        ('plain', image, dict()),
+        ('lz4',   image, dict(lz4=True)),
+        ('boot',  image, dict(lz4=True, boot=True)),
+    )
+    for (name, data, kwargs) in loads:
+        (retransmits, frames) = link.load(data, **kwargs)
+        if kwargs.get('boot'):
+            link.wait_boot()
+            check_scum(link, name)
+        check_staged(link, data, name)
+        print('{0:6}: {1} bytes, {2} frames, {3} resent'.format(name, len(data), frames, retransmits))
+
+    # a few chunks changed, the rest kept from the staged image
+    patched = bytearray(image)
+    for i in random.sample(range(len(image) // 256), 8):
+        patched[i*256:(i+1)*256] = bytes(random.randrange(256) for _ in range(256))
+    patched = bytes(patched)
+    (_, crcs) = link.staged_blocks()
+    keep = frozenset(i for (i, crc) in enumerate(crcs)
+                     if zlib.crc32(patched[i*256:(i+1)*256]) & 0xffffffff == crc and (i+1)*256 <= len(patched))
+    (retransmits, frames) = link.load(patched, keep=keep)
+    check_staged(link, patched, 'keep')
+    print('{0:6}: {1} bytes, {2} frames, {3} kept, {4} resent'.format('keep', len(patched), frames, len(keep), retransmits))
+
+    print('seed {0}: {1} frames dropped, {2} reordered'.format(seed, link.serial.dropped, link.serial.swapped))
+    if link.serial.dropped == 0 or link.serial.swapped == 0:
+        sys.exit('seed {0}: the link lost nothing, nothing was tested'.format(seed))
+    sim.stdin.close()
+    sim.wait()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,355 @@
+/**
+3WB loads, threewb.c on the stub's PWM0, SPIM3, TIMER3, PPI and P0, into a
+model of SCuM's receiver.
+
+threewb.c is the firmware's own. The stub plays what it programs, edge by
+edge in simulated time, and hands the pin changes to the receiver below;
+this file runs the handlers of the pending interrupts TEST_LATENCY after
+they are raised, as the NVIC would with the CPU busy elsewhere, and feeds
+streamed loads on a schedule. It is built without PIE, so that the
+firmware's 32-bit casts of RAM addresses are lossless.
+
+SCuM's receiver: while EN is high, DATA is sampled on each rising edge of
+CLK, MSB first. Checked on every edge:
+- setup: the last DATA change before a rising edge, and EN's rise before
+  the first one, SCUM_SETUP_PS at least
+- hold: the first DATA change after a rising edge, and EN's fall after the
+  last one, SCUM_HOLD_PS at least
+- CLK high and low, SCUM_PULSE_PS at least
+The thresholds are assumptions, SCuM's documentation gives none; they are
+meant to include the skew between CLK and DATA on the board. What SCuM
+latched is compared with the image, bit for bit.
+
+Usage: test_threewb
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "scum-programmer.h"
+#include "threewb.h"
+#include "prof.h"
+#include "trace.h"
+
+//=========================== defines =========================================
+
+#define SCUM_SETUP_PS               10000ULL
+#define SCUM_HOLD_PS                10000ULL
+#define SCUM_PULSE_PS               10000ULL
+
+#define TEST_RAM_ADDR               0x20000000UL
+#define TEST_RAM_SIZE               0x00040000
+#define TEST_IMAGE_ADDR             0x20008000UL // straddles RAM blocks, as .scum_image does
+#define TEST_LATENCY_PS             2000000ULL   // 2us, the USB and UART ISRs can hold the CPU that long
+#define TEST_RX_MAX                 (2*SCUM_IMAGE_SIZE)
+
+//=========================== variables =======================================
+
+typedef struct {
+    const char*    name;
+    uint8_t        mode;            // THREEWB_MODE_*
+    uint32_t       bit_period;      // ns
+    uint32_t       len;
+    uint32_t       avail;           // at the start, then fed
+    uint32_t       feed;            // bytes per feed
+    uint64_t       feed_ps;         // between feeds
+    uint64_t       latency_ps;      // of the 3WB interrupts
+    uint8_t        abort;           // abort at the first stall
+    uint8_t        exact;           // 1: bit-exact expected, 0: a mismatch expected
+} test_load_t;
+
+typedef struct {
+    uint8_t        en;
+    uint8_t        clk;
+    uint8_t        data;
+    uint8_t        rose;            // a rising edge since the last DATA change
+    uint64_t       ps_en;
+    uint64_t       ps_data;
+    uint64_t       ps_rise;
+    uint64_t       ps_fall;
+    uint32_t       num_bits;
+    uint8_t        bits[TEST_RX_MAX];
+    uint32_t       num_loads;       // EN pulses
+    // smallest seen, and below the threshold
+    uint64_t       min_setup;
+    uint64_t       min_hold;
+    uint64_t       min_pulse;
+    uint32_t       num_setup;
+    uint32_t       num_hold;
+    uint32_t       num_pulse;
+} scum_rx_t;
+
+typedef struct {
+    uint32_t       events;
+    uint8_t*       image;
+    scum_rx_t      rx;
+} test_vars_t;
+
+test_vars_t test_vars;
+
+// as in scum-programmer.c
+app_dbg_t      app_dbg;
+app_bench_t    app_bench;
+
+static const test_load_t test_loads[] = {
+    // name             mode               period len     avail  feed  feed_ps         latency          abort exact
+    {"pwm, 4us",        THREEWB_MODE_PWM,  4000,  8192,   8192,  0,    0,              TEST_LATENCY_PS, 0,    1},
+    {"pwm, 500ns",      THREEWB_MODE_PWM,  500,   65536,  65536, 0,    0,              TEST_LATENCY_PS, 0,    1},
+    {"pwm, streamed",   THREEWB_MODE_PWM,  500,   16384,  1000,  1000, 8000000000ULL,  TEST_LATENCY_PS, 0,    1},
+    {"pwm, late ISR",   THREEWB_MODE_PWM,  500,   8192,   8192,  0,    0,              200000000ULL,    0,    0},
+    {"pwm, abort",      THREEWB_MODE_PWM,  500,   16384,  1000,  0,    0,              TEST_LATENCY_PS, 1,    1},
+    {"spim, 31ns",      THREEWB_MODE_SPIM, 31,    65436,  65436, 0,    0,              TEST_LATENCY_PS, 0,    1},
+    {"spim, short",     THREEWB_MODE_SPIM, 31,    100,    100,   0,    0,              TEST_LATENCY_PS, 0,    1},
+    {"spim, 4us",       THREEWB_MODE_SPIM, 4000,  4096+7, 4103,  0,    0,              TEST_LATENCY_PS, 0,    1},
+    {"spim, streamed",  THREEWB_MODE_SPIM, 62,    20000,  3000,  3000, 3000000000ULL,  TEST_LATENCY_PS, 0,    1},
+};
+
+//=========================== prototypes ======================================
+
+void    PWM0_IRQHandler(void);
+void    SPIM3_IRQHandler(void);
+void    TIMER3_IRQHandler(void);
+
+uint8_t _test_load(const test_load_t* load);
+uint8_t _test_isr(uint64_t latency_ps, uint64_t* due);
+void    _scum_pin(uint8_t pin, uint8_t level, uint64_t ps);
+void    _scum_check(uint64_t ps, uint64_t limit, uint64_t* min, uint32_t* num);
+
+//=========================== main ============================================
+
+int main(void) {
+    uint32_t seed;
+    uint32_t failed;
+    uint32_t i;
+
+    if (mmap((void*)(uintptr_t)TEST_RAM_ADDR, TEST_RAM_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)==MAP_FAILED) {
+        perror("test_threewb: mapping the RAM");
+        return 1;
+    }
+    sim_regs_init();
+    sim_pin_hook(_scum_pin);
+
+    // the image, xorshift32
+    test_vars.image = (uint8_t*)(uintptr_t)TEST_IMAGE_ADDR;
+    seed            = 0x5c0de;
+    for (i=0;i<SCUM_IMAGE_SIZE;i++) {
+        seed ^= seed<<13;
+        seed ^= seed>>17;
+        seed ^= seed<<5;
+        test_vars.image[i] = seed & 0xff;
+    }
+
+    prof_init();
+    threewb_init();
+    failed = 0;
+    for (i=0;i<sizeof(test_loads)/sizeof(test_loads[0]);i++) {
+        failed += _test_load(&test_loads[i]);
+    }
+    if (failed) {
+        printf("%u load(s) not as expected\n", failed);
+        return 1;
+    }
+    return 0;
+}
+
+//=========================== private =========================================
+
+uint8_t _test_load(const test_load_t* load) {
+    scum_rx_t* rx;
+    uint32_t   late_refills;
+    uint32_t   stalls;
+    uint32_t   avail;
+    uint32_t   mismatch;
+    uint64_t   start;
+    uint64_t   next;
+    uint64_t   due;
+    uint64_t   feed_at;
+    uint8_t    exact;
+    uint8_t    ok;
+    uint32_t   i;
+
+    rx = &test_vars.rx;
+    memset(rx, 0, sizeof(scum_rx_t));
+    rx->min_setup = rx->min_hold = rx->min_pulse = SIM_NEVER;
+    late_refills           = app_dbg.num_3wb_late_refills;
+    stalls                 = app_dbg.num_3wb_stalls;
+    test_vars.events       = 0;
+
+    if (threewb_set_mode(load->mode)!=RC_OK || threewb_set_bit_period(load->bit_period)!=RC_OK ||
+        threewb_load_stream(test_vars.image, load->len, load->avail)!=RC_OK) {
+        printf("%-16s refused\n", load->name);
+        return 1;
+    }
+    start   = sim_time();
+    avail   = load->avail;
+    feed_at = (load->feed) ? start+load->feed_ps : SIM_NEVER;
+
+    // interrupts, feeds, and the peripherals in between
+    while (threewb_is_busy()) {
+        if (sim_time()-start>(uint64_t)load->len*8*load->bit_period*1000*4+load->feed_ps*(load->len/(load->feed+1)+2)+1000000000ULL) {
+            printf("%-16s never ends\n", load->name);
+            return 1;
+        }
+        if (_test_isr(load->latency_ps, &due)) {
+            continue;
+        }
+        if (load->abort && app_dbg.num_3wb_stalls>stalls) {
+            if (threewb_abort()!=RC_OK || sim_next_event()!=SIM_NEVER) {
+                printf("%-16s abort left the bus running\n", load->name);
+                return 1;
+            }
+            break;
+        }
+        if (sim_time()>=feed_at) {
+            avail   = (avail+load->feed<load->len) ? avail+load->feed : load->len;
+            threewb_feed(avail);
+            feed_at = (avail<load->len) ? sim_time()+load->feed_ps : SIM_NEVER;
+            continue;
+        }
+        next = sim_next_event();
+        next = (due<next)     ? due     : next;
+        next = (feed_at<next) ? feed_at : next;
+        if (next==SIM_NEVER) {
+            printf("%-16s stuck, nothing left to happen\n", load->name);
+            return 1;
+        }
+        sim_run(next);
+    }
+
+    // what SCuM latched, against the image
+    mismatch = rx->num_bits;
+    for (i=0;i<rx->num_bits && i<load->len*8;i++) {
+        if (((rx->bits[i/8] >> (7-i%8)) & 1)!=((test_vars.image[i/8] >> (7-i%8)) & 1)) {
+            mismatch = i;
+            break;
+        }
+    }
+    exact = (rx->num_loads==1 && mismatch==rx->num_bits &&
+             (load->abort ? rx->num_bits<=load->len*8 : rx->num_bits==load->len*8));
+    ok    = (exact==load->exact) && (exact==0 || rx->num_setup+rx->num_hold+rx->num_pulse==0) &&
+            (load->exact || app_dbg.num_3wb_late_refills>late_refills) &&
+            (load->mode!=THREEWB_MODE_SPIM || sim_spim_unprotected()==0) &&
+            (load->abort==0 || threewb_result()==RC_INVALID) &&
+            (load->feed==0 || app_dbg.num_3wb_stalls>stalls) &&
+            (load->abort || (test_vars.events & (0x00000001 << EVT_3WB_DONE)));
+
+    printf("%-16s %6u bytes %8u bits %-10s setup %7.2fns hold %7.2fns pulse %7.2fns %3u late %3u stalls %6.2fms %s\n",
+           load->name, load->len, rx->num_bits, exact ? "bit-exact" : "MISMATCH",
+           rx->min_setup/1000.0, rx->min_hold/1000.0, rx->min_pulse/1000.0,
+           app_dbg.num_3wb_late_refills-late_refills, app_dbg.num_3wb_stalls-stalls,
+           (sim_time()-start)/1e9, ok ? "ok" : "FAILED");
+    if (rx->num_setup+rx->num_hold+rx->num_pulse) {
+        printf("%-16s %u setup, %u hold, %u pulse width violations\n", "",
+               rx->num_setup, rx->num_hold, rx->num_pulse);
+    }
+    return ok ? 0 : 1;
+}
+
+uint8_t _test_isr(uint64_t latency_ps, uint64_t* due) {
+    static const IRQn_Type irqs[]                  = {PWM0_IRQn, SPIM3_IRQn, TIMER3_IRQn};
+    static void (* const handlers[])(void)         = {PWM0_IRQHandler, SPIM3_IRQHandler, TIMER3_IRQHandler};
+    uint64_t since;
+    uint8_t  i;
+
+    // the first one due runs, due says when the next one is
+    *due = SIM_NEVER;
+    for (i=0;i<sizeof(irqs)/sizeof(irqs[0]);i++) {
+        if (sim_irq_pending(irqs[i], &since)==0) {
+            continue;
+        }
+        if (sim_time()>=since+latency_ps) {
+            sim_dwt.CYCCNT = (uint32_t)(sim_time()/SIM_ACCESS_PS);
+            sim_irq_enter(irqs[i]);
+            handlers[i]();
+            sim_irq_exit(irqs[i]);
+            return 1;
+        }
+        if (since+latency_ps<*due) {
+            *due = since+latency_ps;
+        }
+    }
+    return 0;
+}
+
+//=========================== SCuM ============================================
+
+void _scum_pin(uint8_t pin, uint8_t level, uint64_t ps) {
+    scum_rx_t* rx;
+
+    rx = &test_vars.rx;
+    switch (pin) {
+        case PIN_3WB_EN:
+            rx->en                     = level;
+            if (level) {
+                rx->ps_en              = ps;
+                rx->num_loads++;
+            } else if (rx->num_bits) {
+                _scum_check(ps-rx->ps_rise, SCUM_HOLD_PS, &rx->min_hold, &rx->num_hold);
+            }
+            break;
+        case PIN_3WB_DATA:
+            rx->data                   = level;
+            rx->ps_data                = ps;
+            if (rx->en && rx->rose) {
+                _scum_check(ps-rx->ps_rise, SCUM_HOLD_PS, &rx->min_hold, &rx->num_hold);
+            }
+            rx->rose                   = 0;
+            break;
+        case PIN_3WB_CLK:
+            rx->clk                    = level;
+            if (rx->en==0) {
+                break;
+            }
+            if (level==0) {
+                _scum_check(ps-rx->ps_rise, SCUM_PULSE_PS, &rx->min_pulse, &rx->num_pulse);
+                rx->ps_fall            = ps;
+                break;
+            }
+            // latched
+            if (rx->num_bits==0) {
+                _scum_check(ps-rx->ps_en, SCUM_SETUP_PS, &rx->min_setup, &rx->num_setup);
+            } else {
+                _scum_check(ps-rx->ps_fall, SCUM_PULSE_PS, &rx->min_pulse, &rx->num_pulse);
+            }
+            _scum_check(ps-rx->ps_data, SCUM_SETUP_PS, &rx->min_setup, &rx->num_setup);
+            if (rx->num_bits<TEST_RX_MAX*8) {
+                rx->bits[rx->num_bits/8] = (rx->bits[rx->num_bits/8] & ~(0x80 >> (rx->num_bits%8))) |
+                                           (rx->data << (7-rx->num_bits%8));
+                rx->num_bits++;
+            }
+            rx->ps_rise                = ps;
+            rx->rose                   = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+void _scum_check(uint64_t ps, uint64_t limit, uint64_t* min, uint32_t* num) {
+    if (ps<*min) {
+        *min = ps;
+    }
+    if (ps<limit) {
+        (*num)++;
+    }
+}
+
+//=========================== others ==========================================
+
+void events_post(uint8_t evt) {
+    test_vars.events                  |= (0x00000001 << evt);
+}
+
+uint32_t timestamp_get(void) {
+    // 16MHz, as TIMER2, reading it takes an access
+    sim_regs_sync();
+    return (uint32_t)(sim_time()/SIM_TICK_PS);
+}
+
+void trace(uint8_t id, uint8_t arg8, uint16_t arg16) {
+    (void)id;
+    (void)arg8;
+    (void)arg16;
+}
@@ -0,0 +1,96 @@
+/**
+SCuM calibration reference.
+
+Toggles PIN_SCUM_CAL every period_ticks of the 32kHz crystal, num_periods
+times, for SCuM to count its own oscillators against. RTC2 COMPARE[0]
+toggles the pin through PPI and GPIOTE, and clears RTC2 through a PPI fork,
+so the edges are as accurate as the crystal. The interrupt only counts.
+*/
+
+#include "scum-programmer.h"
+#include "calib.h"
+#include "prof.h"
+
+//=========================== variables =======================================
+
+typedef struct {
+    uint16_t       num_periods;     // periods left
+    uint8_t        busy;
+} calib_vars_t;
+
+calib_vars_t calib_vars;
+
+//=========================== public ==========================================
+
+void calib_init(void) {
+
+    // pin, output, low
+    NRF_P0->OUTCLR                     = (0x00000001 << PIN_SCUM_CAL);
+    NRF_P0->PIN_CNF[PIN_SCUM_CAL]      = 0x00000003;       // output, input buffer disconnected
+
+    // RTC2, 32768Hz
+    NRF_RTC2->PRESCALER                = 0;
+    NRF_RTC2->EVTENSET                 = 0x00010000;       // enable compare 0 event routing
+    NRF_RTC2->INTENSET                 = 0x00010000;       // enable compare 0 interrupts
+
+    // PPI, compare 0 toggles the pin and restarts the period
+    NRF_PPI->CH[PPI_CH_CALIB].EEP      = (uint32_t)&NRF_RTC2->EVENTS_COMPARE[0];
+    NRF_PPI->CH[PPI_CH_CALIB].TEP      = (uint32_t)&NRF_GPIOTE->TASKS_OUT[GPIOTE_CH_CALIB];
+    NRF_PPI->FORK[PPI_CH_CALIB].TEP    = (uint32_t)&NRF_RTC2->TASKS_CLEAR;
+    NRF_PPI->CHENSET                   = (0x00000001 << PPI_CH_CALIB);
+
+    // enable interrupts
+    NVIC_SetPriority(RTC2_IRQn, IRQ_PRIO_CALIB);
+    NVIC_ClearPendingIRQ(RTC2_IRQn);
+    NVIC_EnableIRQ(RTC2_IRQn);
+}
+
+uint8_t calib_start(uint16_t num_periods, uint16_t period_ticks) {
+
+    if (calib_vars.busy) {
+        return RC_BUSY;
+    }
+    if (num_periods==0 || period_ticks<2) {
+        return RC_INVALID;
+    }
+    calib_vars.num_periods             = num_periods;
+    calib_vars.busy                    = 1;
+
+    // GPIOTE takes over the pin, initially low, toggles on TASKS_OUT
+    NRF_GPIOTE->CONFIG[GPIOTE_CH_CALIB] = 0x00030003 | (PIN_SCUM_CAL<<8); // task mode, toggle
+
+    NRF_RTC2->CC[0]                    = period_ticks-1; // CLEAR lands one tick after COMPARE
+    NRF_RTC2->TASKS_CLEAR              = 0x00000001;
+    NRF_RTC2->TASKS_START              = 0x00000001;
+
+    return RC_OK;
+}
+
+uint8_t calib_is_busy(void) {
+    return calib_vars.busy;
+}
+
+//=========================== interrupt handlers ==============================
+
+void RTC2_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_RTC2_IRQHandler++;
+
+    if (NRF_RTC2->EVENTS_COMPARE[0] == 0x00000001) {
+        NRF_RTC2->EVENTS_COMPARE[0]    = 0x00000000;
+
+        calib_vars.num_periods--;
+        if (calib_vars.num_periods==0) {
+            NRF_RTC2->TASKS_STOP       = 0x00000001;
+            NRF_GPIOTE->CONFIG[GPIOTE_CH_CALIB] = 0x00000000;
+            NRF_P0->OUTCLR             = (0x00000001 << PIN_SCUM_CAL);
+            calib_vars.busy            = 0;
+        }
+    }
+
+    prof_stop(PROF_ISR_RTC2, prof);
+}
@@ -0,0 +1,16 @@
+/**
+SCuM calibration reference.
+*/
+
+#ifndef __CALIB_H
+#define __CALIB_H
+
+#include <stdint.h>
+
+//=========================== prototypes ======================================
+
+void    calib_init(void);
+uint8_t calib_start(uint16_t num_periods, uint16_t period_ticks);
+uint8_t calib_is_busy(void);
+
+#endif
@@ -0,0 +1,35 @@
+/**
+CRC computations.
+*/
+
+#ifndef __CRC_H
+#define __CRC_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+#define CRC16_INIT                  0xffff
+#define CRC16_GOOD                  0xf0b8 // residue over data followed by its FCS
+#define CRC32_INIT                  0xffffffff
+
+#define CRC16_UPDATE_BYTE(crc,b)    ((uint16_t)(crc16_table[((crc) ^ (b)) & 0xff] ^ ((crc) >> 8)))
+
+//=========================== variables =======================================
+
+extern const uint16_t crc16_table[256];
+
+//=========================== prototypes ======================================
+
+void     crc_init(void);
+
+// CRC-16/X.25, the HDLC FCS, sent LSB first
+uint16_t crc16_update(uint16_t crc, const uint8_t* buf, uint32_t len);
+uint16_t crc16(const uint8_t* buf, uint32_t len);
+// CRC-32 (IEEE 802.3, as zlib), update from CRC32_INIT, finish with crc32_final()
+// crc32_update() needs crc_init() first
+uint32_t crc32_update(uint32_t crc, const uint8_t* buf, uint32_t len);
+uint32_t crc32_final(uint32_t crc);
+uint32_t crc32(const uint8_t* buf, uint32_t len);
+
+#endif
@@ -0,0 +1,172 @@
+/**
+HDLC-like framing of the host link.
+*/
+
+#include <stddef.h>
+#include "hdlc.h"
+#include "crc.h"
+
+//=========================== prototypes ======================================
+
+void     _hdlc_rx_reset(hdlc_rx_t* rx);
+uint32_t _hdlc_put(uint8_t* out, uint8_t b);
+
+//=========================== public ==========================================
+
+void hdlc_rx_init(hdlc_rx_t* rx, uint8_t* buf, uint16_t size, hdlc_route_t route, uint16_t route_at) {
+    rx->buf                            = buf;
+    rx->size                           = size;
+    rx->frame_len                      = 0;
+    rx->frame_dst                      = NULL;
+    rx->route                          = route;
+    rx->route_at                       = route_at;
+    _hdlc_rx_reset(rx);
+}
+
+uint8_t hdlc_rx(hdlc_rx_t* rx, const uint8_t* buf, uint32_t len, uint32_t* used) {
+    uint32_t i;
+    uint8_t  b;
+    uint8_t  ret;
+    uint16_t n;
+    uint16_t fcs;
+    uint8_t  escape;
+    uint8_t* dst;
+    uint16_t dst_len;
+    uint8_t  tail0;
+    uint8_t  tail1;
+
+    // the state lives in registers while decoding: every byte stored
+    // through a uint8_t* could alias *rx, and would have it reloaded
+    n       = rx->len;
+    fcs     = rx->fcs;
+    escape  = rx->escape;
+    dst     = rx->dst;
+    dst_len = rx->dst_len;
+    tail0   = rx->tail[0];
+    tail1   = rx->tail[1];
+
+    // returns after each frame, *used tells where to resume
+    for (i=0;i<len;i++) {
+        b = buf[i];
+
+        if (b==HDLC_FLAG) {
+            // closing flag, or idle/opening flag if nothing was received
+            ret = HDLC_RX_NONE;
+            if (escape) {
+                ret = HDLC_RX_ERROR_ABORT;
+            } else if (rx->overflow) {
+                ret = HDLC_RX_ERROR_OVERFLOW;
+            } else if (n) {
+                if (n<2 || fcs!=CRC16_GOOD) {
+                    ret = HDLC_RX_ERROR_FCS;
+                } else {
+                    rx->frame_len      = n-2;
+                    rx->frame_dst      = dst;
+                    ret = HDLC_RX_FRAME;
+                }
+            }
+            _hdlc_rx_reset(rx);
+            n                          = 0;
+            fcs                        = CRC16_INIT;
+            escape                     = 0;
+            dst                        = NULL;
+            dst_len                    = 0;
+            if (ret!=HDLC_RX_NONE) {
+                *used = i+1;
+                return ret;
+            }
+            continue;
+        }
+
+        if (b==HDLC_ESCAPE) {
+            escape                     = 1;
+            continue;
+        }
+        if (escape) {
+            b                         ^= HDLC_XOR;
+            escape                     = 0;
+        }
+        fcs                            = CRC16_UPDATE_BYTE(fcs, b);
+
+        if (dst) {
+            // routed, write out the byte two behind
+            if (n-rx->route_at>=2) {
+                if (dst_len==rx->dst_size) {
+                    rx->overflow       = 1;
+                } else {
+                    dst[dst_len++]     = tail0;
+                }
+                tail0                  = tail1;
+                tail1                  = b;
+            } else if (n==rx->route_at) {
+                tail0                  = b;
+            } else {
+                tail1                  = b;
+            }
+            n++;
+            continue;
+        }
+
+        if (n==rx->size) {
+            rx->overflow               = 1;
+            continue;
+        }
+        rx->buf[n++]                   = b;
+        if (n==rx->route_at && rx->route) {
+            dst                        = rx->route(rx->buf, &rx->dst_size);
+        }
+    }
+    rx->len                            = n;
+    rx->fcs                            = fcs;
+    rx->escape                         = escape;
+    rx->dst                            = dst;
+    rx->dst_len                        = dst_len;
+    rx->tail[0]                        = tail0;
+    rx->tail[1]                        = tail1;
+    *used = len;
+    return HDLC_RX_NONE;
+}
+
+uint32_t hdlc_encode(uint8_t* out, const uint8_t* hdr, uint32_t hdr_len, const uint8_t* payload, uint32_t len) {
+    uint32_t n;
+    uint16_t fcs;
+    uint32_t i;
+
+    n   = 0;
+    fcs = CRC16_INIT;
+    out[n++] = HDLC_FLAG;
+    for (i=0;i<hdr_len;i++) {
+        fcs  = CRC16_UPDATE_BYTE(fcs, hdr[i]);
+        n   += _hdlc_put(&out[n], hdr[i]);
+    }
+    for (i=0;i<len;i++) {
+        fcs  = CRC16_UPDATE_BYTE(fcs, payload[i]);
+        n   += _hdlc_put(&out[n], payload[i]);
+    }
+    fcs ^= 0xffff;
+    n   += _hdlc_put(&out[n], fcs & 0xff);
+    n   += _hdlc_put(&out[n], fcs >> 8);
+    out[n++] = HDLC_FLAG;
+    return n;
+}
+
+//=========================== private =========================================
+
+void _hdlc_rx_reset(hdlc_rx_t* rx) {
+    rx->len                            = 0;
+    rx->fcs                            = CRC16_INIT;
+    rx->escape                         = 0;
+    rx->overflow                       = 0;
+    rx->dst                            = NULL;
+    rx->dst_len                        = 0;
+}
+
+uint32_t _hdlc_put(uint8_t* out, uint8_t b) {
+    if (b==HDLC_FLAG || b==HDLC_ESCAPE) {
+        out[0] = HDLC_ESCAPE;
+        out[1] = b ^ HDLC_XOR;
+        return 2;
+    }
+    out[0] = b;
+    return 1;
+}
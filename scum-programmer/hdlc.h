@@ -0,0 +1,64 @@
+/**
+HDLC-like framing of the host link.
+
+A frame is its content followed by the CRC-16/X.25 FCS (LSB first), between
+0x7e flags; 0x7e and 0x7d inside the frame are sent as 0x7d, byte^0x20.
+
+The decoder runs straight over the receive buffers. Once the first
+route_at bytes of a frame are in, an optional route function may hand
+back a destination for the rest of it, which is then decoded in place
+there; the last two bytes are held back, so the FCS never lands in it.
+*/
+
+#ifndef __HDLC_H
+#define __HDLC_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+#define HDLC_FLAG                   0x7e
+#define HDLC_ESCAPE                 0x7d
+#define HDLC_XOR                    0x20
+
+// encoded size of a frame with n bytes of content, worst case
+#define HDLC_ENCODED_MAX(n)         (2+2*((n)+2))
+
+// hdlc_rx() return values
+#define HDLC_RX_NONE                0 // all bytes consumed, no frame completed
+#define HDLC_RX_FRAME               1 // valid frame of rx->frame_len bytes, see hdlc_rx_t
+#define HDLC_RX_ERROR_FCS           2 // frame dropped, bad FCS or shorter than the FCS
+#define HDLC_RX_ERROR_OVERFLOW      3 // frame dropped, longer than its buffer
+#define HDLC_RX_ERROR_ABORT         4 // frame dropped, flag right after an escape
+
+//=========================== typedef =========================================
+
+// where to decode the rest of a frame, given its first route_at bytes
+// returns NULL to keep it in rx->buf, else sets *size
+typedef uint8_t* (*hdlc_route_t)(const uint8_t* hdr, uint16_t* size);
+
+typedef struct {
+    uint8_t*       buf;             // decoded content, the first route_at bytes if routed
+    uint16_t       size;
+    uint16_t       len;             // bytes decoded so far, FCS included
+    uint16_t       frame_len;       // content of the last valid frame, FCS stripped
+    uint8_t*       frame_dst;       // where the last valid frame continues after route_at, NULL if in buf
+    uint16_t       fcs;
+    uint8_t        escape;
+    uint8_t        overflow;
+    // routing
+    hdlc_route_t   route;
+    uint16_t       route_at;
+    uint8_t*       dst;             // current frame continues here, NULL if in buf
+    uint16_t       dst_size;
+    uint16_t       dst_len;
+    uint8_t        tail[2];         // last two bytes of a routed frame, maybe its FCS
+} hdlc_rx_t;
+
+//=========================== prototypes ======================================
+
+void     hdlc_rx_init(hdlc_rx_t* rx, uint8_t* buf, uint16_t size, hdlc_route_t route, uint16_t route_at);
+uint8_t  hdlc_rx(hdlc_rx_t* rx, const uint8_t* buf, uint32_t len, uint32_t* used);
+uint32_t hdlc_encode(uint8_t* out, const uint8_t* hdr, uint32_t hdr_len, const uint8_t* payload, uint32_t len);
+
+#endif
@@ -0,0 +1,306 @@
+/**
+Host serial link on UARTE0, through the DK's J-Link VCOM.
+
+1Mbaud, 8N1, RTS/CTS flow control. RX runs continuously into two EasyDMA
+buffers used in turn:
+- RXSTARTED (buffer i started): point RXD.PTR at the other buffer j, the
+  ENDRX->STARTRX shortcut switches to it without CPU involvement
+- if the main loop hasn't consumed j yet, the shortcut is disabled instead;
+  the receiver stops at the end of i, RTS tells the host to hold off, and
+  reception resumes once j has been consumed
+No byte is ever overwritten before the main loop has seen it.
+
+The main loop doesn't need to wait for a buffer to fill: every RXDRDY is
+counted by TIMER4, which tells how far the current buffer has been written,
+and restarts TIMER0, whose COMPARE[0] signals the line has gone idle.
+*/
+
+#include <string.h>
+#include "scum-programmer.h"
+#include "host_uart.h"
+#include "ringbuf.h"
+#include "prof.h"
+
+//=========================== defines =========================================
+
+#define HOST_UART_RX_BUF_SIZE       256
+#define HOST_UART_TX_BUF_SIZE       1024        // power of two
+#define HOST_UART_IDLE_TICKS        (16*30)     // 30us, 3 characters at 1Mbaud
+
+//=========================== variables =======================================
+
+typedef struct {
+    uint8_t        rx_buf[2][HOST_UART_RX_BUF_SIZE];
+    uint32_t       rx_rd;           // bytes consumed by the main loop, since boot
+    uint32_t       rx_started;      // bytes received before the buffer being written
+    uint8_t        rx_stalled;      // shortcut disabled, the other buffer isn't free
+    uint8_t        rx_stopped;      // receiver stopped at the end of a buffer
+    uint8_t        tx_buf[HOST_UART_TX_BUF_SIZE];
+    ringbuf_t      tx;              // filled by the main loop, drained by EasyDMA
+    uint32_t       tx_len;          // length of the EasyDMA transfer in progress
+    uint8_t        tx_waiting;      // post tx_evt on the next ENDTX
+    uint8_t        tx_evt;
+} host_uart_vars_t;
+
+host_uart_vars_t host_uart_vars;
+
+//=========================== prototypes ======================================
+
+uint32_t _host_uart_rx_count(void);
+uint8_t  _host_uart_rx_next_free(void);
+void     _host_uart_tx_kick(void);
+
+//=========================== public ==========================================
+
+void host_uart_init(void) {
+
+    // pins, https://infocenter.nordicsemi.com/topic/ug_nrf52840_dk/UG/dk/vir_com_port.html
+    NRF_P0->OUTSET                     = (0x00000001 << PIN_HOST_UART_TXD) |
+                                         (0x00000001 << PIN_HOST_UART_RTS);
+    NRF_P0->PIN_CNF[PIN_HOST_UART_TXD] = 0x00000003;       // output, input buffer disconnected
+    NRF_P0->PIN_CNF[PIN_HOST_UART_RTS] = 0x00000003;
+    NRF_P0->PIN_CNF[PIN_HOST_UART_RXD] = 0x00000000;       // input
+    NRF_P0->PIN_CNF[PIN_HOST_UART_CTS] = 0x00000000;
+
+    // UARTE0, 1Mbaud, 8N1, flow control
+    NRF_UARTE0->PSEL.TXD               = PIN_HOST_UART_TXD;
+    NRF_UARTE0->PSEL.RXD               = PIN_HOST_UART_RXD;
+    NRF_UARTE0->PSEL.RTS               = PIN_HOST_UART_RTS;
+    NRF_UARTE0->PSEL.CTS               = PIN_HOST_UART_CTS;
+    NRF_UARTE0->BAUDRATE               = 0x10000000;       // 1Mbaud
+    NRF_UARTE0->CONFIG                 = 0x00000001;       // HWFC, no parity
+    NRF_UARTE0->SHORTS                 = 0x00000020;       // ENDRX_STARTRX
+    // 1098 7654 3210 9876 5432 1098 7654 3210
+    // xxxx xxxx xxxx Sxxx xxxx xxEN xxxR xxxx (S=RXSTARTED, E=ERROR, N=ENDTX, R=ENDRX)
+    // 0000 0000 0000 1000 0000 0011 0001 0000
+    //    0    0    0    8    0    3    1    0 0x00080310
+    NRF_UARTE0->INTENSET               = 0x00080310;
+
+    ringbuf_init(&host_uart_vars.tx, host_uart_vars.tx_buf, HOST_UART_TX_BUF_SIZE);
+
+    // TIMER4 counts the bytes received
+    NRF_TIMER4->MODE                   = 0x00000002;       // 2==low power counter
+    NRF_TIMER4->BITMODE                = 0x00000003;       // 3==32-bit
+    NRF_TIMER4->TASKS_CLEAR            = 0x00000001;
+    NRF_TIMER4->TASKS_START            = 0x00000001;
+
+    // TIMER0 times out when the line goes idle, every byte restarts it
+    NRF_TIMER0->MODE                   = 0x00000000;       // 0==timer
+    NRF_TIMER0->BITMODE                = 0x00000000;       // 0==16-bit
+    NRF_TIMER0->PRESCALER              = 0x00000000;       // 16MHz/2^0
+    NRF_TIMER0->CC[0]                  = HOST_UART_IDLE_TICKS;
+    NRF_TIMER0->SHORTS                 = 0x00000101;       // COMPARE0_CLEAR, COMPARE0_STOP
+    NRF_TIMER0->INTENSET               = 0x00010000;       // COMPARE0
+
+    // PPI
+    NRF_PPI->CH[PPI_CH_HOST_UART_COUNT].EEP  = (uint32_t)&NRF_UARTE0->EVENTS_RXDRDY;
+    NRF_PPI->CH[PPI_CH_HOST_UART_COUNT].TEP  = (uint32_t)&NRF_TIMER4->TASKS_COUNT;
+    NRF_PPI->FORK[PPI_CH_HOST_UART_COUNT].TEP = (uint32_t)&NRF_TIMER0->TASKS_CLEAR;
+    NRF_PPI->CH[PPI_CH_HOST_UART_IDLE].EEP   = (uint32_t)&NRF_UARTE0->EVENTS_RXDRDY;
+    NRF_PPI->CH[PPI_CH_HOST_UART_IDLE].TEP   = (uint32_t)&NRF_TIMER0->TASKS_START;
+    NRF_PPI->CHENSET                   = (0x00000001 << PPI_CH_HOST_UART_COUNT) |
+                                         (0x00000001 << PPI_CH_HOST_UART_IDLE);
+
+    // enable interrupts
+    NVIC_SetPriority(UARTE0_UART0_IRQn, IRQ_PRIO_HOST_UART);
+    NVIC_ClearPendingIRQ(UARTE0_UART0_IRQn);
+    NVIC_EnableIRQ(UARTE0_UART0_IRQn);
+    NVIC_SetPriority(TIMER0_IRQn, IRQ_PRIO_HOST_UART);
+    NVIC_ClearPendingIRQ(TIMER0_IRQn);
+    NVIC_EnableIRQ(TIMER0_IRQn);
+
+    // start receiving into buffer 0, RXSTARTED arms buffer 1
+    NRF_UARTE0->ENABLE                 = 0x00000008;       // 8==UARTE
+    NRF_UARTE0->RXD.PTR                = (uint32_t)host_uart_vars.rx_buf[0];
+    NRF_UARTE0->RXD.MAXCNT             = HOST_UART_RX_BUF_SIZE;
+    NRF_UARTE0->TASKS_STARTRX          = 0x00000001;
+}
+
+uint8_t* host_uart_rx_peek(uint32_t* len) {
+    uint32_t avail;
+    uint32_t offset;
+
+    // contiguous bytes received and not consumed yet
+    // RXDRDY can precede the EasyDMA write by a few cycles, far less than
+    // it takes the main loop to get here
+    avail  = _host_uart_rx_count()-host_uart_vars.rx_rd;
+    offset = host_uart_vars.rx_rd%HOST_UART_RX_BUF_SIZE;
+    if (avail>HOST_UART_RX_BUF_SIZE-offset) {
+        avail = HOST_UART_RX_BUF_SIZE-offset;
+    }
+    *len   = avail;
+    if (avail==0) {
+        return NULL;
+    }
+    return &host_uart_vars.rx_buf[(host_uart_vars.rx_rd/HOST_UART_RX_BUF_SIZE)%2][offset];
+}
+
+void host_uart_rx_release(uint32_t len) {
+
+    host_uart_vars.rx_rd              += len;
+
+    // let the ISR resume reception if it was waiting for this
+    if (host_uart_vars.rx_stalled) {
+        NVIC_SetPendingIRQ(UARTE0_UART0_IRQn);
+    }
+}
+
+uint32_t host_uart_tx(const uint8_t* buf, uint32_t len) {
+    uint32_t num;
+
+    num = ringbuf_write(&host_uart_vars.tx, buf, len);
+    NVIC_DisableIRQ(UARTE0_UART0_IRQn);
+    _host_uart_tx_kick();
+    NVIC_EnableIRQ(UARTE0_UART0_IRQn);
+    return num;
+}
+
+uint32_t host_uart_tx_free(void) {
+    return ringbuf_free(&host_uart_vars.tx);
+}
+
+void host_uart_tx_wait(uint8_t evt) {
+
+    // posted once EasyDMA has freed some of the TX ring
+    NVIC_DisableIRQ(UARTE0_UART0_IRQn);
+    if (host_uart_vars.tx_len==0) {
+        // nothing in flight, the space won't come from an ENDTX
+        events_post(evt);
+    } else {
+        host_uart_vars.tx_waiting      = 1;
+        host_uart_vars.tx_evt          = evt;
+    }
+    NVIC_EnableIRQ(UARTE0_UART0_IRQn);
+}
+
+//=========================== private =========================================
+
+uint32_t _host_uart_rx_count(void) {
+    uint32_t primask;
+    uint32_t count;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    NRF_TIMER4->TASKS_CAPTURE[0]       = 0x00000001;
+    count                              = NRF_TIMER4->CC[0];
+    __set_PRIMASK(primask);
+
+    return count;
+}
+
+uint8_t _host_uart_rx_next_free(void) {
+    // the other buffer holds the bytes just before the current one
+    return host_uart_vars.rx_rd>=host_uart_vars.rx_started;
+}
+
+void _host_uart_tx_kick(void) {
+    uint8_t* data;
+    uint32_t len;
+
+    if (host_uart_vars.tx_len) {
+        return;
+    }
+
+    // contiguous part of the ring, EasyDMA reads it in place
+    data = ringbuf_peek(&host_uart_vars.tx, &len);
+    if (len==0) {
+        return;
+    }
+    host_uart_vars.tx_len              = len;
+    NRF_UARTE0->TXD.PTR                = (uint32_t)data;
+    NRF_UARTE0->TXD.MAXCNT             = len;
+    NRF_UARTE0->TASKS_STARTTX          = 0x00000001;
+}
+
+//=========================== interrupt handlers ==============================
+
+void UARTE0_UART0_IRQHandler(void) {
+    uint32_t errorsrc;
+    uint8_t  next;
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_UARTE0_UART0_IRQHandler++;
+
+    // ENDRX first, the next buffer's RXSTARTED may already be pending too
+    if (NRF_UARTE0->EVENTS_ENDRX == 0x00000001) {
+        NRF_UARTE0->EVENTS_ENDRX       = 0x00000000;
+
+        host_uart_vars.rx_started     += HOST_UART_RX_BUF_SIZE;
+        if (host_uart_vars.rx_stalled) {
+            host_uart_vars.rx_stopped  = 1;
+        }
+        events_post(EVT_HOST_UART_RX);
+    }
+
+    if (NRF_UARTE0->EVENTS_RXSTARTED == 0x00000001) {
+        NRF_UARTE0->EVENTS_RXSTARTED   = 0x00000000;
+
+        // arm the other buffer, if the main loop is done with it
+        next = ((host_uart_vars.rx_started/HOST_UART_RX_BUF_SIZE)+1)%2;
+        if (_host_uart_rx_next_free()) {
+            NRF_UARTE0->RXD.PTR        = (uint32_t)host_uart_vars.rx_buf[next];
+            NRF_UARTE0->SHORTS         = 0x00000020;       // ENDRX_STARTRX
+        } else {
+            NRF_UARTE0->SHORTS         = 0x00000000;
+            host_uart_vars.rx_stalled  = 1;
+            app_dbg.num_host_uart_rx_stalls++;
+        }
+    }
+
+    // resume a stopped receiver once the main loop has freed the buffer
+    if (host_uart_vars.rx_stopped && host_uart_vars.rx_rd>=host_uart_vars.rx_started-HOST_UART_RX_BUF_SIZE) {
+        next = (host_uart_vars.rx_started/HOST_UART_RX_BUF_SIZE)%2;
+        NRF_UARTE0->RXD.PTR            = (uint32_t)host_uart_vars.rx_buf[next];
+        NRF_UARTE0->TASKS_STARTRX      = 0x00000001;
+        host_uart_vars.rx_stalled      = 0;
+        host_uart_vars.rx_stopped      = 0;
+    }
+
+    if (NRF_UARTE0->EVENTS_ERROR == 0x00000001) {
+        NRF_UARTE0->EVENTS_ERROR       = 0x00000000;
+
+        errorsrc                       = NRF_UARTE0->ERRORSRC;
+        NRF_UARTE0->ERRORSRC           = errorsrc;         // write 1 to clear
+        if (errorsrc & 0x00000001) {
+            app_dbg.num_host_uart_overruns++;
+        }
+        if (errorsrc & 0x00000004) {
+            app_dbg.num_host_uart_framing_errors++;
+        }
+    }
+
+    if (NRF_UARTE0->EVENTS_ENDTX == 0x00000001) {
+        NRF_UARTE0->EVENTS_ENDTX       = 0x00000000;
+
+        ringbuf_release(&host_uart_vars.tx, host_uart_vars.tx_len);
+        host_uart_vars.tx_len          = 0;
+        _host_uart_tx_kick();
+        if (host_uart_vars.tx_waiting) {
+            host_uart_vars.tx_waiting  = 0;
+            events_post(host_uart_vars.tx_evt);
+        }
+    }
+
+    prof_stop(PROF_ISR_UARTE0, prof);
+}
+
+void TIMER0_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_TIMER0_IRQHandler++;
+
+    if (NRF_TIMER0->EVENTS_COMPARE[0] == 0x00000001) {
+        NRF_TIMER0->EVENTS_COMPARE[0]  = 0x00000000;
+
+        // line idle, hand over what is in the current buffer
+        events_post(EVT_HOST_UART_RX);
+    }
+
+    prof_stop(PROF_ISR_TIMER0, prof);
+}
@@ -0,0 +1,20 @@
+/**
+Host serial link on UARTE0, through the DK's J-Link VCOM.
+*/
+
+#ifndef __HOST_UART_H
+#define __HOST_UART_H
+
+#include <stdint.h>
+
+//=========================== prototypes ======================================
+
+void     host_uart_init(void);
+// main loop only
+uint8_t* host_uart_rx_peek(uint32_t* len);
+void     host_uart_rx_release(uint32_t len);
+uint32_t host_uart_tx(const uint8_t* buf, uint32_t len);
+uint32_t host_uart_tx_free(void);
+void     host_uart_tx_wait(uint8_t evt);
+
+#endif
@@ -0,0 +1,98 @@
+/**
+LZ4 block decoder.
+
+See https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md. Each
+sequence is a token (literal length:4, match length-4:4), the literals,
+then a 16-bit little-endian offset; a length nibble of 15 continues in
+the following bytes, up to a byte that isn't 255. The last sequence has
+no match.
+*/
+
+#include <string.h>
+#include "lz4.h"
+
+//=========================== prototypes ======================================
+
+uint8_t _lz4_length(const uint8_t** src, const uint8_t* end, uint32_t* len);
+
+//=========================== public ==========================================
+
+int32_t lz4_decode(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_size) {
+    const uint8_t* end;
+    const uint8_t* match;
+    uint8_t*       out;
+    uint8_t*       out_end;
+    uint32_t       len;
+    uint32_t       offset;
+    uint32_t       copy;
+    uint8_t        token;
+
+    end     = src+src_len;
+    out     = dst;
+    out_end = dst+dst_size;
+
+    while (src<end) {
+        token = *src++;
+
+        // literals
+        len = token>>4;
+        if (len==15 && _lz4_length(&src, end, &len)) {
+            return -1;
+        }
+        if (len>(uint32_t)(end-src) || len>(uint32_t)(out_end-out)) {
+            return -1;
+        }
+        memcpy(out, src, len);
+        out += len;
+        src += len;
+        if (src==end) {
+            break;                  // last sequence
+        }
+
+        // match
+        if (end-src<2) {
+            return -1;
+        }
+        offset  = src[0] | (src[1]<<8);
+        src    += 2;
+        if (offset==0 || offset>(uint32_t)(out-dst)) {
+            return -1;
+        }
+        len = token & 0x0f;
+        if (len==15 && _lz4_length(&src, end, &len)) {
+            return -1;
+        }
+        len += 4;
+        if (len>(uint32_t)(out_end-out)) {
+            return -1;
+        }
+        // the match may overlap what it produces (runs): it repeats every
+        // offset bytes, so whatever lies between match and out can be
+        // copied at once, and that span doubles each time
+        match = out-offset;
+        while (len) {
+            copy = (uint32_t)(out-match);
+            copy = (copy<len) ? copy : len;
+            memcpy(out, match, copy);
+            out += copy;
+            len -= copy;
+        }
+    }
+    return (int32_t)(out-dst);
+}
+
+//=========================== private =========================================
+
+uint8_t _lz4_length(const uint8_t** src, const uint8_t* end, uint32_t* len) {
+    uint8_t b;
+
+    // returns 1 if the input ends in the middle of the length
+    do {
+        if (*src==end) {
+            return 1;
+        }
+        b     = *(*src)++;
+        *len += b;
+    } while (b==255);
+    return 0;
+}
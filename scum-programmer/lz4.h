@@ -0,0 +1,16 @@
+/**
+LZ4 block decoder.
+*/
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+#include <stdint.h>
+
+//=========================== prototypes ======================================
+
+// returns the number of bytes written to dst, -1 if src is malformed or
+// doesn't fit; matches may only reach back into this block's output
+int32_t lz4_decode(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_size);
+
+#endif
@@ -0,0 +1,75 @@
+/**
+Cycle-count profiling of the ISRs and main loop tasks.
+
+The DWT cycle counter runs at the CPU clock, 64MHz. Each handler reads it
+on entry with prof_start(), and hands the start value to prof_stop() on
+every way out; prof_stop() updates that handler's count, min, max, total
+and log2 histogram. An ISR's cycles include those of any higher priority
+ISR preempting it, a task's those of every ISR.
+*/
+
+#include <string.h>
+#include "scum-programmer.h"
+#include "prof.h"
+
+//=========================== variables =======================================
+
+prof_stats_t prof_vars[PROF_MAX];
+
+//=========================== public ==========================================
+
+void prof_init(void) {
+
+    // DWT needs trace enabled, it is when a debugger is attached, not otherwise
+    CoreDebug->DEMCR                  |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT                        = 0;
+    DWT->CTRL                         |= DWT_CTRL_CYCCNTENA_Msk;
+
+    prof_reset();
+}
+
+void prof_reset(void) {
+    uint8_t id;
+
+    __disable_irq();
+    memset(prof_vars, 0, sizeof(prof_vars));
+    for (id=0;id<PROF_MAX;id++) {
+        prof_vars[id].cycles_min       = 0xffffffff;
+    }
+    __enable_irq();
+}
+
+const prof_stats_t* prof_stats(uint8_t id) {
+    if (id>=PROF_MAX) {
+        return NULL;
+    }
+    return &prof_vars[id];
+}
+
+void prof_stop(uint8_t id, uint32_t start) {
+    prof_stats_t* stats;
+    uint32_t      cycles;
+    uint32_t      bin;
+
+    cycles                             = DWT->CYCCNT-start;
+    stats                              = &prof_vars[id];
+
+    stats->count++;
+    stats->cycles_total               += cycles;
+    if (cycles<stats->cycles_min) {
+        stats->cycles_min              = cycles;
+    }
+    if (cycles>stats->cycles_max) {
+        stats->cycles_max              = cycles;
+    }
+
+    // log2 bin
+    bin = 0;
+    if (cycles>>PROF_HIST_LOG2_MIN) {
+        bin = 32-__CLZ(cycles>>PROF_HIST_LOG2_MIN);
+        if (bin>PROF_HIST_BINS-1) {
+            bin = PROF_HIST_BINS-1;
+        }
+    }
+    stats->hist[bin]++;
+}
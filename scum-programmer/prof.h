@@ -0,0 +1,55 @@
+/**
+Cycle-count profiling of the ISRs and main loop tasks.
+*/
+
+#ifndef __PROF_H
+#define __PROF_H
+
+#include <stdint.h>
+#include "scum-programmer.h"
+
+//=========================== defines =========================================
+
+// what is profiled, ISRs then one per EVT_*
+#define PROF_ISR_RTC0               0
+#define PROF_ISR_GPIOTE             1
+#define PROF_ISR_PWM0               2 // 3WB PWM mode
+#define PROF_ISR_SPIM3              3
+#define PROF_ISR_TIMER3             4
+#define PROF_ISR_POWER_CLOCK        5
+#define PROF_ISR_USBD               6
+#define PROF_ISR_UARTE0             7
+#define PROF_ISR_TIMER0             8
+#define PROF_ISR_RTC2               9
+#define PROF_ISR_UARTE1             10
+#define PROF_ISR_RTC1               11
+#define PROF_NUM_ISRS               12
+#define PROF_TASK(evt)              (PROF_NUM_ISRS+(evt))
+#define PROF_MAX                    (PROF_NUM_ISRS+EVT_MAX)
+
+// histogram, bin 0 below 2^PROF_HIST_LOG2_MIN cycles, each next bin twice as wide, the last one open
+#define PROF_HIST_BINS              8
+#define PROF_HIST_LOG2_MIN          6  // 64 cycles, 1us at 64MHz
+
+//=========================== typedef =========================================
+
+typedef struct {
+    uint32_t       count;
+    uint32_t       cycles_min;
+    uint32_t       cycles_max;
+    uint32_t       cycles_total;   // wraps after 2^32 cycles, 67s of handler time
+    uint32_t       hist[PROF_HIST_BINS];
+} prof_stats_t;
+
+//=========================== prototypes ======================================
+
+void                prof_init(void);
+void                prof_reset(void);
+const prof_stats_t* prof_stats(uint8_t id);
+void                prof_stop(uint8_t id, uint32_t start);
+
+static inline uint32_t prof_start(void) {
+    return DWT->CYCCNT;
+}
+
+#endif
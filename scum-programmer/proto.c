@@ -0,0 +1,783 @@
+/**
+Host command protocol, see proto.h.
+*/
+
+#include <string.h>
+#include "scum-programmer.h"
+#include "proto.h"
+#include "hdlc.h"
+#include "crc.h"
+#include "usb.h"
+#include "host_uart.h"
+#include "threewb.h"
+#include "calib.h"
+#include "store.h"
+#include "scum_uart.h"
+#include "lz4.h"
+#include "prof.h"
+#include "trace.h"
+
+//=========================== defines =========================================
+
+extern const uint8_t APP_VERSION[];
+
+//=========================== variables =======================================
+
+typedef struct {
+    hdlc_rx_t      rx[PROTO_NUM_LINKS];
+    uint8_t        rx_buf[PROTO_NUM_LINKS][PROTO_FRAME_MAX+2];
+    uint8_t        tx_buf[HDLC_ENCODED_MAX(3+sizeof(app_dbg_t))];
+    // LOAD_CHUNK streaming
+    uint32_t       load_len;        // announced by LOAD_START, done when load_offset reaches it
+    uint32_t       load_offset;     // first chunk not received yet, all before it are
+    uint32_t       load_received;   // chunks received past load_offset, bit 0 is load_offset
+    uint32_t       load_nacked;     // holes already reported, same indexing
+    uint8_t        load_flags;      // PROTO_LOAD_*
+    uint8_t        load_link;
+    uint8_t        load_seq;        // seq of the last chunk accepted
+    uint8_t        load_unacked;    // chunks accepted since the last ACK
+    uint8_t        load_dup_acked;  // a duplicate was answered since the last ACK
+    uint32_t       load_dup_ts;     // timestamp_get() of that answer
+    uint32_t       load_ack_offset; // load_offset in the last ACK, the host's window starts there
+    uint32_t       load_crc;        // running CRC32 of the first load_crc_len bytes
+    uint32_t       load_crc_len;
+    uint32_t       load_start;      // timestamp_get() at LOAD_START
+    // BOOT and STORE_BOOT, answered when the 3WB load completes
+    uint8_t        boot_pending;
+    uint8_t        boot_cmd;
+    uint8_t        boot_link;
+    uint8_t        boot_seq;
+    uint8_t        boot_resp[9];
+    uint8_t        boot_resp_len;
+    // STORE_SAVE, answered when the image is in flash
+    uint8_t        save_pending;
+    uint8_t        save_link;
+    uint8_t        save_seq;
+    uint8_t        verify_pending;
+    uint8_t        verify_link;
+    uint8_t        verify_seq;
+    // SCuM UART bridge, BRIDGE_RX goes to the link of BRIDGE_START
+    uint8_t        bridge_link;
+    uint8_t        bridge_seq;
+} proto_vars_t;
+
+proto_vars_t proto_vars;
+
+//=========================== prototypes ======================================
+
+void     _proto_frame(uint8_t link, const uint8_t* frame, uint32_t len);
+uint8_t* _proto_route(const uint8_t* hdr, uint16_t* size);
+void     _proto_load_chunk(uint8_t link, uint8_t seq, const uint8_t* payload, uint32_t len, const uint8_t* data);
+void     _proto_load_chunk_lz4(uint8_t link, uint8_t seq, const uint8_t* payload, uint32_t len);
+uint32_t _proto_load_claim(uint8_t link, uint32_t offset, uint32_t num_chunks);
+void     _proto_load_commit(uint8_t seq, uint32_t mask);
+void     _proto_load_crc(void);
+void     _proto_load_ack(uint8_t status);
+void     _proto_load_dup_ack(void);
+void     _proto_store_list(uint8_t link, uint8_t seq);
+void     _proto_block_crcs(uint8_t link, uint8_t seq, uint16_t first, uint16_t count);
+void     _proto_respond(uint8_t link, uint8_t cmd, uint8_t seq, uint8_t status, const uint8_t* payload, uint32_t len);
+uint32_t _proto_get32(const uint8_t* buf);
+void     _proto_put32(uint8_t* buf, uint32_t val);
+
+//=========================== public ==========================================
+
+void proto_init(void) {
+    uint8_t link;
+
+    for (link=0;link<PROTO_NUM_LINKS;link++) {
+        hdlc_rx_init(&proto_vars.rx[link], proto_vars.rx_buf[link], sizeof(proto_vars.rx_buf[link]), _proto_route, 2+4);
+    }
+}
+
+void proto_rx(uint8_t link, const uint8_t* buf, uint32_t len) {
+    hdlc_rx_t* rx;
+    uint32_t   used;
+
+    // single pass over the receive buffer, LOAD_CHUNK data is decoded
+    // straight into scum_image, see _proto_route()
+    rx = &proto_vars.rx[link];
+    while (len) {
+        switch (hdlc_rx(rx, buf, len, &used)) {
+            case HDLC_RX_FRAME:
+                _proto_frame(link, rx->buf, rx->frame_len);
+                break;
+            case HDLC_RX_ERROR_FCS:
+                app_dbg.num_hdlc_fcs_errors++;
+                break;
+            case HDLC_RX_ERROR_OVERFLOW:
+                app_dbg.num_hdlc_overflows++;
+                break;
+            case HDLC_RX_ERROR_ABORT:
+                app_dbg.num_hdlc_aborts++;
+                break;
+        }
+        buf += used;
+        len -= used;
+    }
+}
+
+void proto_3wb_done(void) {
+
+    if (proto_vars.boot_pending==0) {
+        return;
+    }
+    proto_vars.boot_pending            = 0;
+    if (threewb_result()!=RC_OK) {
+        // streamed load abandoned, the chunks still coming are refused
+        proto_vars.load_len            = 0;
+        proto_vars.boot_resp_len       = 0;
+    }
+    _proto_respond(proto_vars.boot_link, proto_vars.boot_cmd, proto_vars.boot_seq, threewb_result(),
+                   proto_vars.boot_resp, proto_vars.boot_resp_len);
+}
+
+uint8_t proto_is_loading(void) {
+    return proto_vars.load_offset<proto_vars.load_len;
+}
+
+void proto_store_done(void) {
+    uint8_t resp[5];
+    uint8_t slot;
+
+    if (proto_vars.save_pending==0) {
+        return;
+    }
+    proto_vars.save_pending            = 0;
+    slot                               = store_saved_slot();
+    resp[0]                            = slot;
+    _proto_put32(&resp[1], store_entry(slot)->seq);
+    _proto_respond(proto_vars.save_link, PROTO_CMD_STORE_SAVE, proto_vars.save_seq, RC_OK, resp, sizeof(resp));
+}
+
+void proto_scum_verify_done(void) {
+    uint8_t  resp[5];
+    uint32_t mismatch;
+
+    if (proto_vars.verify_pending==0) {
+        return;
+    }
+    proto_vars.verify_pending          = 0;
+    resp[0]                            = scum_uart_verify_result(&mismatch);
+    _proto_put32(&resp[1], mismatch);
+    _proto_respond(proto_vars.verify_link, PROTO_CMD_SCUM_VERIFY, proto_vars.verify_seq, RC_OK, resp, sizeof(resp));
+}
+
+uint32_t proto_bridge_rx(const uint8_t* buf, uint32_t len) {
+    uint32_t space;
+
+    if (len>PROTO_BRIDGE_RX_MAX) {
+        len = PROTO_BRIDGE_RX_MAX;
+    }
+
+    // whole frames only, the bytes wait in the SCuM UART ring otherwise
+    if (proto_vars.bridge_link==PROTO_LINK_USB) {
+        space = usb_cdc_tx_free();
+    } else {
+        space = host_uart_tx_free();
+    }
+    if (space<HDLC_ENCODED_MAX(3+len)) {
+        return 0;
+    }
+    proto_vars.bridge_seq++;
+    _proto_respond(proto_vars.bridge_link, PROTO_CMD_BRIDGE_RX, proto_vars.bridge_seq, RC_OK, buf, len);
+    return len;
+}
+
+void proto_bridge_wait(uint8_t evt) {
+
+    // evt is posted when the bridge's link has sent something
+    if (proto_vars.bridge_link==PROTO_LINK_USB) {
+        usb_cdc_tx_wait(evt);
+    } else {
+        host_uart_tx_wait(evt);
+    }
+}
+
+//=========================== private =========================================
+
+void _proto_frame(uint8_t link, const uint8_t* frame, uint32_t len) {
+    uint8_t  cmd;
+    uint8_t  seq;
+    uint8_t  status;
+    uint8_t  resp[8];
+    uint32_t resp_len;
+    uint32_t crc;
+    uint32_t num;
+    uint8_t  slot;
+
+    if (len<2) {
+        app_dbg.num_proto_bad_frames++;
+        return;
+    }
+    cmd      = frame[0];
+    seq      = frame[1];
+    frame   += 2;
+    len     -= 2;
+    slot     = STORE_SLOT_NONE;          // STORE_BOOT only
+    status   = RC_OK;
+    resp_len = 0;
+    app_dbg.num_proto_frames++;
+    trace(TRACE_EVT_PROTO_FRAME, cmd, seq);
+
+    switch (cmd) {
+        case PROTO_CMD_GET_VERSION:
+            resp[0]                    = APP_VERSION[0];
+            resp[1]                    = APP_VERSION[1];
+            resp_len                   = 2;
+            break;
+        case PROTO_CMD_LOAD_START:
+            if (proto_vars.boot_pending && proto_vars.boot_cmd==PROTO_CMD_BOOT &&
+                (proto_vars.load_flags & PROTO_LOAD_BOOT) && threewb_abort()==RC_OK) {
+                // the host gave up on a streamed load, it is not answered
+                proto_vars.boot_pending    = 0;
+                proto_vars.load_len        = 0;
+            }
+            if ((len!=4 && len!=5) || _proto_get32(frame)==0 || _proto_get32(frame)>SCUM_IMAGE_SIZE ||
+                threewb_is_busy() || store_is_busy() || usb_vendor_is_busy()) {
+                status                 = RC_INVALID;
+                break;
+            }
+            proto_vars.load_len        = _proto_get32(frame);
+            proto_vars.load_flags      = (len==5) ? frame[4] : 0;
+            proto_vars.load_offset     = 0;
+            proto_vars.load_link       = link;
+            proto_vars.load_received   = 0;
+            proto_vars.load_nacked     = 0;
+            proto_vars.load_unacked    = 0;
+            proto_vars.load_dup_acked  = 0;
+            proto_vars.load_ack_offset = 0;
+            memset(&app_bench, 0, sizeof(app_bench));
+            app_bench.image_len        = proto_vars.load_len;
+            proto_vars.load_start      = timestamp_get();
+            proto_vars.load_crc        = CRC32_INIT;
+            proto_vars.load_crc_len    = 0;
+            scum_image_len             = 0;
+            if (proto_vars.load_flags & PROTO_LOAD_BOOT) {
+                // start loading SCuM now, answered as a BOOT by proto_3wb_done()
+                if (proto_vars.boot_pending || threewb_load_stream(scum_image, proto_vars.load_len, 0)!=RC_OK) {
+                    proto_vars.load_len    = 0;
+                    status                 = RC_BUSY;
+                    break;
+                }
+                proto_vars.boot_pending    = 1;
+                proto_vars.boot_cmd        = PROTO_CMD_BOOT;
+                proto_vars.boot_link       = link;
+                proto_vars.boot_seq        = seq;
+                proto_vars.boot_resp_len   = 0;
+            }
+            resp[0]                    = PROTO_WINDOW & 0xff;
+            resp[1]                    = PROTO_WINDOW >> 8;
+            resp[2]                    = PROTO_CHUNK_MAX & 0xff;
+            resp[3]                    = PROTO_CHUNK_MAX >> 8;
+            resp_len                   = 4;
+            break;
+        case PROTO_CMD_LOAD_CHUNK:
+            _proto_load_chunk(link, seq, frame, len, proto_vars.rx[link].frame_dst);
+            return;
+        case PROTO_CMD_LOAD_CHUNK_LZ4:
+            _proto_load_chunk_lz4(link, seq, frame, len);
+            return;
+        case PROTO_CMD_BLOCK_CRCS:
+            if (len!=4) {
+                status                 = RC_INVALID;
+                break;
+            }
+            _proto_block_crcs(link, seq, frame[0] | (frame[1]<<8), frame[2] | (frame[3]<<8));
+            return;
+        case PROTO_CMD_STORE_STAGE:
+            if (len!=1) {
+                status                 = RC_INVALID;
+                break;
+            }
+            if (scum_image_in_use() || usb_vendor_is_busy()) {
+                status                 = RC_BUSY;
+                break;
+            }
+            status                     = store_load(frame[0], scum_image, &scum_image_len, &scum_image_crc);
+            break;
+        case PROTO_CMD_VERIFY:
+            // known since it was staged, no pass over the image
+            crc                        = scum_image_crc;
+            _proto_put32(&resp[0], scum_image_len);
+            _proto_put32(&resp[4], crc);
+            resp_len                   = 8;
+            break;
+        case PROTO_CMD_STORE_FIND:
+            // stage it if the library has it, the host then skips the upload
+            if (len!=8) {
+                status                 = RC_INVALID;
+                break;
+            }
+            if (scum_image_in_use() || usb_vendor_is_busy()) {
+                status                 = RC_BUSY;
+                break;
+            }
+            slot                       = store_find(_proto_get32(&frame[0]), _proto_get32(&frame[4]));
+            if (slot==STORE_SLOT_NONE) {
+                status                 = RC_INVALID;
+                break;
+            }
+            status                     = store_load(slot, scum_image, &scum_image_len, &scum_image_crc);
+            resp[0]                    = slot;
+            resp_len                   = 1;
+            break;
+        case PROTO_CMD_STORE_BOOT:
+            if (len>1) {
+                status                 = RC_INVALID;
+                break;
+            }
+            if (proto_vars.boot_pending || scum_image_in_use() || usb_vendor_is_busy()) {
+                status                 = RC_BUSY;
+                break;
+            }
+            slot                       = (len==1) ? frame[0] : store_last();
+            status                     = store_load(slot, scum_image, &scum_image_len, &scum_image_crc);
+            if (status!=RC_OK) {
+                break;
+            }
+            // fall through
+        case PROTO_CMD_BOOT:
+            if (scum_image_len==0 || proto_vars.boot_pending) {
+                status                 = RC_INVALID;
+                break;
+            }
+            if (store_is_busy()) {
+                // the CPU stalls on flash operations, the 3WB would glitch
+                status                 = RC_BUSY;
+                break;
+            }
+            if (usb_vendor_is_busy()) {
+                // a vendor upload is writing scum_image
+                status                 = RC_BUSY;
+                break;
+            }
+            status                     = threewb_load(scum_image, scum_image_len);
+            if (status==RC_OK) {
+                // answered by proto_3wb_done()
+                proto_vars.boot_resp_len = 0;
+                if (cmd==PROTO_CMD_STORE_BOOT) {
+                    proto_vars.boot_resp[0] = slot;
+                    _proto_put32(&proto_vars.boot_resp[1], store_entry(slot)->len);
+                    _proto_put32(&proto_vars.boot_resp[5], store_entry(slot)->crc);
+                    proto_vars.boot_resp_len = 9;
+                }
+                proto_vars.boot_pending = 1;
+                proto_vars.boot_cmd    = cmd;
+                proto_vars.boot_link   = link;
+                proto_vars.boot_seq    = seq;
+                return;
+            }
+            break;
+        case PROTO_CMD_STORE_SAVE:
+            if (proto_vars.save_pending || threewb_is_busy() || usb_vendor_is_busy()) {
+                status                 = RC_BUSY;
+                break;
+            }
+            status                     = store_save(scum_image, scum_image_len);
+            if (status==RC_OK) {
+                // answered by proto_store_done()
+                proto_vars.save_pending = 1;
+                proto_vars.save_link   = link;
+                proto_vars.save_seq    = seq;
+                return;
+            }
+            break;
+        case PROTO_CMD_CALIBRATE:
+            if (len!=4) {
+                status                 = RC_INVALID;
+                break;
+            }
+            status                     = calib_start(frame[0] | (frame[1]<<8), frame[2] | (frame[3]<<8));
+            break;
+        case PROTO_CMD_SET_3WB:
+            if (len!=5) {
+                status                 = RC_INVALID;
+                break;
+            }
+            status                     = threewb_set_mode(frame[0]);
+            if (status==RC_OK) {
+                status                 = threewb_set_bit_period(_proto_get32(&frame[1]));
+            }
+            break;
+        case PROTO_CMD_SCUM_VERIFY:
+            if (scum_image_len==0) {
+                status                 = RC_INVALID;
+                break;
+            }
+            if (proto_vars.verify_pending || threewb_is_busy() || usb_vendor_is_busy()) {
+                status                 = RC_BUSY;
+                break;
+            }
+            status                     = scum_uart_verify(scum_image, scum_image_len);
+            if (status==RC_OK) {
+                // answered by proto_scum_verify_done()
+                proto_vars.verify_pending = 1;
+                proto_vars.verify_link = link;
+                proto_vars.verify_seq  = seq;
+                return;
+            }
+            break;
+        case PROTO_CMD_GET_BENCH:
+            _proto_respond(link, cmd, seq, RC_OK, (const uint8_t*)&app_bench, sizeof(app_bench));
+            return;
+        case PROTO_CMD_GET_PROF:
+            // one at a time, all of them don't fit in a frame
+            if (len!=1 || prof_stats(frame[0])==NULL) {
+                status                 = RC_INVALID;
+                break;
+            }
+            _proto_respond(link, cmd, seq, RC_OK, (const uint8_t*)prof_stats(frame[0]), sizeof(prof_stats_t));
+            return;
+        case PROTO_CMD_RESET_PROF:
+            prof_reset();
+            break;
+        case PROTO_CMD_GET_DBG:
+            _proto_respond(link, cmd, seq, RC_OK, (const uint8_t*)&app_dbg, sizeof(app_dbg));
+            return;
+        case PROTO_CMD_STORE_LIST:
+            _proto_store_list(link, seq);
+            return;
+        case PROTO_CMD_BRIDGE_START:
+            if (len!=0 && len!=4) {
+                status                 = RC_INVALID;
+                break;
+            }
+            if (proto_vars.verify_pending) {
+                status                 = RC_BUSY;
+                break;
+            }
+            status                     = scum_uart_bridge_start(len ? _proto_get32(frame) : SCUM_UART_BAUDRATE_DEFAULT);
+            if (status==RC_OK) {
+                proto_vars.bridge_link = link;
+                proto_vars.bridge_seq  = seq;
+            }
+            break;
+        case PROTO_CMD_BRIDGE_STOP:
+            scum_uart_bridge_stop();
+            break;
+        case PROTO_CMD_BRIDGE_TX:
+            if (scum_uart_bridge_is_on()==0) {
+                status                 = RC_INVALID;
+                break;
+            }
+            num                        = scum_uart_tx(frame, len);
+            resp[0]                    = (num >> 0) & 0xff;
+            resp[1]                    = (num >> 8) & 0xff;
+            resp_len                   = 2;
+            break;
+        default:
+            status                     = RC_UNKNOWN;
+            break;
+    }
+    _proto_respond(link, cmd, seq, status, resp, resp_len);
+}
+
+uint8_t* _proto_route(const uint8_t* hdr, uint16_t* size) {
+    uint32_t offset;
+    uint32_t idx;
+
+    // only LOAD_CHUNK data goes straight to scum_image, and only where a
+    // chunk is still missing: the header is routed on before the FCS is
+    // checked, a frame that fails it leaves garbage in that chunk, which
+    // the host sends again. Not with PROTO_LOAD_KEEP, a missing chunk may
+    // be one the host keeps, a corrupted offset would damage it; the
+    // frame is staged in the frame buffer then, and copied once good
+    if (hdr[0]!=PROTO_CMD_LOAD_CHUNK || proto_vars.load_offset>=proto_vars.load_len ||
+        (proto_vars.load_flags & PROTO_LOAD_KEEP)) {
+        return NULL;
+    }
+    offset = _proto_get32(&hdr[2]);
+    if ((offset%PROTO_CHUNK_MAX)!=0 || offset<proto_vars.load_offset || offset>=proto_vars.load_len) {
+        return NULL;
+    }
+    idx = (offset-proto_vars.load_offset)/PROTO_CHUNK_MAX;
+    if (idx>=PROTO_WINDOW || (proto_vars.load_received & (0x00000001<<idx))) {
+        return NULL;
+    }
+    *size = PROTO_CHUNK_MAX;
+    if (proto_vars.load_len-offset<PROTO_CHUNK_MAX) {
+        *size = proto_vars.load_len-offset;
+    }
+    return &scum_image[offset];
+}
+
+void _proto_load_chunk(uint8_t link, uint8_t seq, const uint8_t* payload, uint32_t len, const uint8_t* data) {
+    uint32_t offset;
+    uint32_t mask;
+
+    if (proto_vars.load_len==0 || len<4 || len-4>PROTO_CHUNK_MAX) {
+        app_dbg.num_proto_bad_frames++;
+        return;
+    }
+    offset   = _proto_get32(payload);
+    len     -= 4;
+    if (data==NULL) {
+        data = payload+4;           // not routed, still in the frame buffer
+    }
+
+    // chunks are PROTO_CHUNK_MAX bytes at PROTO_CHUNK_MAX boundaries, except
+    // the last; an empty one keeps what is staged there, if LOAD_START allowed it
+    if ((offset%PROTO_CHUNK_MAX)!=0 || offset+len>proto_vars.load_len ||
+        (len==0 && ((proto_vars.load_flags & PROTO_LOAD_KEEP)==0 || offset>=proto_vars.load_len)) ||
+        (len!=0 && len!=PROTO_CHUNK_MAX && offset+len!=proto_vars.load_len)) {
+        app_dbg.num_proto_bad_frames++;
+        return;
+    }
+    mask = _proto_load_claim(link, offset, 1);
+    if (mask==0) {
+        return;
+    }
+    if (data!=&scum_image[offset]) {
+        memcpy(&scum_image[offset], data, len);
+    }
+    _proto_load_commit(seq, mask);
+}
+
+void _proto_load_chunk_lz4(uint8_t link, uint8_t seq, const uint8_t* payload, uint32_t len) {
+    uint32_t offset;
+    uint32_t out_len;
+    uint32_t mask;
+    uint32_t start;
+
+    if (proto_vars.load_len==0 || len<6) {
+        app_dbg.num_proto_bad_frames++;
+        return;
+    }
+    offset   = _proto_get32(payload);
+    out_len  = payload[4] | (payload[5]<<8);
+
+    // whole chunks, the last one may be short
+    if ((offset%PROTO_CHUNK_MAX)!=0 || out_len==0 || out_len>PROTO_LZ4_OUT_MAX ||
+        offset+out_len>proto_vars.load_len ||
+        ((out_len%PROTO_CHUNK_MAX)!=0 && offset+out_len!=proto_vars.load_len)) {
+        app_dbg.num_proto_bad_frames++;
+        return;
+    }
+    mask = _proto_load_claim(link, offset, (out_len+PROTO_CHUNK_MAX-1)/PROTO_CHUNK_MAX);
+    if (mask==0) {
+        return;
+    }
+    start = timestamp_get();
+    if (lz4_decode(&payload[6], len-6, &scum_image[offset], out_len)!=(int32_t)out_len) {
+        app_dbg.num_lz4_errors++;
+        return;
+    }
+    app_bench.lz4_ticks               += timestamp_get()-start;
+    app_dbg.num_lz4_bytes_in          += len-6;
+    app_dbg.num_lz4_bytes_out         += out_len;
+    _proto_load_commit(seq, mask);
+}
+
+uint32_t _proto_load_claim(uint8_t link, uint32_t offset, uint32_t num_chunks) {
+    uint32_t idx;
+    uint32_t mask;
+
+    // returns the window bits the chunks go in, 0 if they're not wanted
+    proto_vars.load_link               = link;
+
+    // already have them, the host didn't see our ACK; one goes out now
+    if (offset<proto_vars.load_offset) {
+        app_dbg.num_proto_chunks_duplicate++;
+        _proto_load_dup_ack();
+        return 0;
+    }
+    idx = (offset-proto_vars.load_offset)/PROTO_CHUNK_MAX;
+    if (idx+num_chunks>PROTO_WINDOW) {
+        app_dbg.num_proto_chunks_dropped++;
+        return 0;
+    }
+    mask = (0xffffffff>>(32-num_chunks))<<idx;
+    if (proto_vars.load_received & mask) {
+        app_dbg.num_proto_chunks_duplicate++;
+        _proto_load_dup_ack();
+        return 0;
+    }
+    if (proto_vars.load_nacked & mask) {
+        app_dbg.num_proto_retransmits++;
+    }
+    return mask;
+}
+
+void _proto_load_commit(uint8_t seq, uint32_t mask) {
+    uint32_t holes;
+    uint32_t top;
+
+    proto_vars.load_received          |= mask;
+    proto_vars.load_seq                = seq;
+    proto_vars.load_unacked           += 32-__CLZ(mask)-__CLZ(__RBIT(mask));
+
+    // slide the window over what is now contiguous
+    while (proto_vars.load_received & 0x00000001) {
+        proto_vars.load_received     >>= 1;
+        proto_vars.load_nacked       >>= 1;
+        proto_vars.load_offset        += PROTO_CHUNK_MAX;
+    }
+    if (proto_vars.load_offset>proto_vars.load_len) {
+        proto_vars.load_offset         = proto_vars.load_len;
+    }
+    trace(TRACE_EVT_PROTO_CHUNKS, seq, proto_vars.load_offset/PROTO_CHUNK_MAX);
+
+    // streamed boot, the 3WB follows what is contiguous
+    if (proto_vars.load_flags & PROTO_LOAD_BOOT) {
+        threewb_feed(proto_vars.load_offset);
+    }
+
+    // CRC32 of the contiguous part, each byte once as it is staged
+    _proto_load_crc();
+
+    if (proto_vars.load_offset==proto_vars.load_len) {
+        scum_image_crc                 = crc32_final(proto_vars.load_crc);
+        app_bench.upload_ticks         = timestamp_get()-proto_vars.load_start;
+        scum_image_len                 = proto_vars.load_len;
+        _proto_load_ack(RC_OK);
+        return;
+    }
+
+    // holes below the last chunk received, not reported yet
+    holes = 0;
+    if (proto_vars.load_received) {
+        holes = ~proto_vars.load_received & ~proto_vars.load_nacked &
+                ((0x00000001<<(31-__CLZ(proto_vars.load_received)))-1);
+    }
+
+    // end of the last chunk received, the host can't send past the window
+    // of the last ACK it got
+    top = proto_vars.load_offset+(32-__CLZ(proto_vars.load_received))*PROTO_CHUNK_MAX;
+
+    // ACK every PROTO_ACK_EVERY chunks, or when the host has to wait for one
+    if (holes) {
+        proto_vars.load_nacked        |= holes;
+        app_dbg.num_proto_nacks++;
+        _proto_load_ack(RC_INVALID);
+    } else if (proto_vars.load_unacked>=PROTO_ACK_EVERY ||
+               top>=proto_vars.load_ack_offset+PROTO_WINDOW*PROTO_CHUNK_MAX) {
+        _proto_load_ack(RC_OK);
+    }
+}
+
+void _proto_load_dup_ack(void) {
+
+    // a resent burst is answered once, the ACK carries the whole window;
+    // the next burst, after the host timed out again, gets its own
+    if (proto_vars.load_dup_acked &&
+        timestamp_get()-proto_vars.load_dup_ts<PROTO_DUP_ACK_HOLDOFF) {
+        return;
+    }
+    _proto_load_ack(RC_OK);
+    proto_vars.load_dup_acked          = 1;
+    proto_vars.load_dup_ts             = timestamp_get();
+}
+
+void _proto_load_crc(void) {
+    uint32_t start;
+    uint32_t ticks;
+    uint32_t len;
+
+    len = proto_vars.load_offset-proto_vars.load_crc_len;
+    if (len==0) {
+        return;
+    }
+    start                              = timestamp_get();
+    proto_vars.load_crc                = crc32_update(proto_vars.load_crc, &scum_image[proto_vars.load_crc_len], len);
+    proto_vars.load_crc_len            = proto_vars.load_offset;
+    ticks                              = timestamp_get()-start;
+
+    // cost, 4 CPU cycles per 16MHz tick
+    app_dbg.crc_ticks                 += ticks;
+    app_bench.staging_ticks           += ticks;
+    app_dbg.crc_bytes                 += len;
+    app_dbg.crc_cycles_per_kib         = (uint32_t)(((uint64_t)app_dbg.crc_ticks*4*1024)/app_dbg.crc_bytes);
+    if (proto_vars.load_crc_len==proto_vars.load_len) {
+        app_dbg.crc_image              = crc32_final(proto_vars.load_crc);
+    }
+}
+
+void _proto_load_ack(uint8_t status) {
+    uint8_t resp[8];
+
+    proto_vars.load_unacked            = 0;
+    proto_vars.load_dup_acked          = 0;
+    proto_vars.load_ack_offset         = proto_vars.load_offset;
+    trace(TRACE_EVT_PROTO_ACK, status, proto_vars.load_offset/PROTO_CHUNK_MAX);
+    _proto_put32(&resp[0], proto_vars.load_offset);
+    _proto_put32(&resp[4], proto_vars.load_received);
+    _proto_respond(proto_vars.load_link, PROTO_CMD_LOAD_CHUNK, proto_vars.load_seq, status, resp, sizeof(resp));
+}
+
+void _proto_block_crcs(uint8_t link, uint8_t seq, uint16_t first, uint16_t count) {
+    uint8_t  resp[PROTO_BLOCK_CRCS_MAX*4];
+    uint32_t num_blocks;
+    uint32_t offset;
+    uint32_t len;
+    uint16_t i;
+
+    // CRC32 of each PROTO_CHUNK_MAX block of the staged image, the last one may be short
+    num_blocks = (scum_image_len+PROTO_CHUNK_MAX-1)/PROTO_CHUNK_MAX;
+    if (first>=num_blocks) {
+        count = 0;
+    } else if (count>num_blocks-first) {
+        count = num_blocks-first;
+    }
+    if (count>PROTO_BLOCK_CRCS_MAX) {
+        count = PROTO_BLOCK_CRCS_MAX;
+    }
+    for (i=0;i<count;i++) {
+        offset = (first+i)*PROTO_CHUNK_MAX;
+        len    = scum_image_len-offset;
+        if (len>PROTO_CHUNK_MAX) {
+            len = PROTO_CHUNK_MAX;
+        }
+        _proto_put32(&resp[i*4], crc32(&scum_image[offset], len));
+    }
+    _proto_respond(link, PROTO_CMD_BLOCK_CRCS, seq, RC_OK, resp, count*4);
+}
+
+void _proto_store_list(uint8_t link, uint8_t seq) {
+    const store_entry_t* entry;
+    uint8_t              resp[STORE_NUM_SLOTS*13];
+    uint32_t             resp_len;
+    uint8_t              slot;
+
+    resp_len = 0;
+    for (slot=0;slot<STORE_NUM_SLOTS;slot++) {
+        entry = store_entry(slot);
+        if (entry==NULL) {
+            continue;
+        }
+        resp[resp_len]                 = slot;
+        _proto_put32(&resp[resp_len+1], entry->len);
+        _proto_put32(&resp[resp_len+5], entry->crc);
+        _proto_put32(&resp[resp_len+9], entry->seq);
+        resp_len                      += 13;
+    }
+    _proto_respond(link, PROTO_CMD_STORE_LIST, seq, RC_OK, resp, resp_len);
+}
+
+void _proto_respond(uint8_t link, uint8_t cmd, uint8_t seq, uint8_t status, const uint8_t* payload, uint32_t len) {
+    uint8_t  hdr[3];
+    uint32_t n;
+
+    hdr[0] = cmd | PROTO_RESPONSE;
+    hdr[1] = seq;
+    hdr[2] = status;
+    n      = hdlc_encode(proto_vars.tx_buf, hdr, sizeof(hdr), payload, len);
+
+    // what doesn't fit in the TX ring is dropped, the host retries
+    if (link==PROTO_LINK_USB) {
+        usb_cdc_tx(proto_vars.tx_buf, n);
+    } else {
+        host_uart_tx(proto_vars.tx_buf, n);
+    }
+}
+
+uint32_t _proto_get32(const uint8_t* buf) {
+    return buf[0] | (buf[1]<<8) | (buf[2]<<16) | ((uint32_t)buf[3]<<24);
+}
+
+void _proto_put32(uint8_t* buf, uint32_t val) {
+    buf[0] = (val >>  0) & 0xff;
+    buf[1] = (val >>  8) & 0xff;
+    buf[2] = (val >> 16) & 0xff;
+    buf[3] = (val >> 24) & 0xff;
+}
@@ -0,0 +1,107 @@
+/**
+Host command protocol, carried in HDLC-like frames over CDC-ACM and the
+host UART.
+
+Request:  [cmd][seq][payload]
+Response: [cmd|0x80][seq][status][payload]
+
+LOAD_CHUNK is streamed, selective repeat: the image is cut in chunks of
+PROTO_CHUNK_MAX bytes (the last one shorter), the host keeps up to
+PROTO_WINDOW of them in flight past the first one not yet received. The
+programmer acknowledges cumulatively every PROTO_ACK_EVERY chunks, when
+the window of its last acknowledgement is full, on the last chunk, and
+once per burst of duplicates (bursts are PROTO_DUP_ACK_HOLDOFF apart);
+the acknowledgement carries which chunks of the window already arrived.
+A corrupted chunk is dropped by the FCS check; when a later chunk shows
+the hole, the acknowledgement goes out right away with RC_INVALID (a
+NACK), and the host resends only the chunks missing below the last one
+received.
+
+To send only what changed, the host compares BLOCK_CRCS (one CRC32 per
+chunk of what is staged, possibly after STORE_STAGE) with its image, then
+sends LOAD_START with PROTO_LOAD_KEEP, and an empty LOAD_CHUNK for each
+chunk that is already right.
+
+LOAD_CHUNK_LZ4 carries up to PROTO_LZ4_OUT_MAX bytes of image, a run of
+whole chunks, as an LZ4 block that doesn't refer outside of itself; it is
+decoded straight into the staging buffer, and counts as all these chunks
+in the window.
+
+With PROTO_LOAD_BOOT, the 3WB starts right away and follows the
+contiguous part of the image, load and boot overlap; the host gets the
+BOOT response, with the seq of LOAD_START, once SCuM has it all.
+
+Between BRIDGE_START and BRIDGE_STOP, SCuM's UART is passed through on the
+link BRIDGE_START came in on: BRIDGE_TX sends to SCuM, what SCuM sends
+arrives in unsolicited BRIDGE_RX frames, seq counting up from the one of
+BRIDGE_START. All other commands still work, except SCUM_VERIFY.
+*/
+
+#ifndef __PROTO_H
+#define __PROTO_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+// links
+#define PROTO_LINK_USB              0 // CDC-ACM
+#define PROTO_LINK_UART             1 // UARTE0, J-Link VCOM
+#define PROTO_NUM_LINKS             2
+
+// commands
+#define PROTO_CMD_GET_VERSION       0x01 // -> [major][minor]
+#define PROTO_CMD_LOAD_START        0x02 // [len u32][flags u8, optional] -> [window u16][chunk max u16]
+#define PROTO_CMD_LOAD_CHUNK        0x03 // [offset u32][data], no response, see above
+#define PROTO_CMD_VERIFY            0x04 // -> [len u32][crc32 u32]
+#define PROTO_CMD_BOOT              0x05 // -> once the image is in SCuM
+#define PROTO_CMD_CALIBRATE         0x06 // [periods u16][period 32kHz ticks u16]
+#define PROTO_CMD_BRIDGE_START      0x07 // [baudrate u32, optional, 19200]
+#define PROTO_CMD_SET_3WB           0x08 // [mode u8][bit period ns u32]
+#define PROTO_CMD_GET_DBG           0x09 // -> app_dbg_t
+#define PROTO_CMD_STORE_SAVE        0x0a // -> [slot u8][seq u32], once the staged image is in flash
+#define PROTO_CMD_STORE_BOOT        0x0b // [slot u8], optional -> [slot u8][len u32][crc32 u32], once in SCuM
+#define PROTO_CMD_STORE_FIND        0x0c // [len u32][crc32 u32] -> [slot u8], and stages it
+#define PROTO_CMD_STORE_LIST        0x0d // -> [slot u8][len u32][crc32 u32][seq u32] per image
+#define PROTO_CMD_STORE_STAGE       0x0e // [slot u8], copies it to the staging buffer
+#define PROTO_CMD_BLOCK_CRCS        0x0f // [first u16][count u16] -> [crc32 u32] per chunk of the staged image
+#define PROTO_CMD_LOAD_CHUNK_LZ4    0x10 // [offset u32][len u16][LZ4 block], as LOAD_CHUNK
+#define PROTO_CMD_SCUM_VERIFY       0x11 // -> [result u8][address u32], once SCuM's SRAM is read back
+#define PROTO_CMD_GET_BENCH         0x12 // -> app_bench_t
+#define PROTO_CMD_GET_PROF          0x13 // [id u8] -> prof_stats_t of this ISR or task
+#define PROTO_CMD_RESET_PROF        0x14 // clears all prof_stats_t
+#define PROTO_CMD_BRIDGE_STOP       0x15
+#define PROTO_CMD_BRIDGE_TX         0x16 // [data] -> [accepted u16], the rest doesn't fit
+#define PROTO_CMD_BRIDGE_RX         0x17 // no request, [0x97][seq][RC_OK][data]
+#define PROTO_RESPONSE              0x80
+
+// LOAD_CHUNK acknowledgement:
+// [0x83][seq of the last chunk][status][next offset u32][received u32]
+// bit n of received: chunk at next offset+n*PROTO_CHUNK_MAX arrived
+#define PROTO_CHUNK_MAX             256
+#define PROTO_WINDOW                32 // chunks, bits in the received bitmap
+#define PROTO_ACK_EVERY             8
+#define PROTO_DUP_ACK_HOLDOFF       (16000000/4) // 16MHz ticks, under the host's 1s resend timeout
+#define PROTO_BLOCK_CRCS_MAX        32 // per response
+#define PROTO_LZ4_OUT_MAX           (16*PROTO_CHUNK_MAX) // decoded size of a LOAD_CHUNK_LZ4
+#define PROTO_BRIDGE_RX_MAX         128 // data per BRIDGE_RX
+
+// LOAD_START flags
+#define PROTO_LOAD_KEEP             0x01 // empty LOAD_CHUNKs keep the staged data
+#define PROTO_LOAD_BOOT             0x02 // load SCuM as the image arrives, answered as a BOOT
+
+// largest frame content, a LOAD_CHUNK_LZ4
+#define PROTO_FRAME_MAX             (2+6+PROTO_CHUNK_MAX)
+
+//=========================== prototypes ======================================
+
+void     proto_init(void);
+void     proto_rx(uint8_t link, const uint8_t* buf, uint32_t len);
+void     proto_3wb_done(void);
+void     proto_store_done(void);
+void     proto_scum_verify_done(void);
+uint8_t  proto_is_loading(void);
+uint32_t proto_bridge_rx(const uint8_t* buf, uint32_t len);
+void     proto_bridge_wait(uint8_t evt);
+
+#endif
@@ -0,0 +1,138 @@
+/**
+Single-producer, single-consumer byte ring, for data handed between an
+ISR and the main loop.
+
+The size is a power of two. wr and rd are free-running counters, each
+written by one side only: wr by the producer, rd by the consumer. Their
+difference is what is in the ring, an index is a counter masked with
+size-1. Neither side needs a critical section; a barrier orders the data
+against the counter that publishes it:
+- producer: copy the data in, DMB, then advance wr
+- consumer: read wr, DMB, copy the data out, DMB, then advance rd
+
+ringbuf_peek()/ringbuf_release() let the consumer hand the contiguous part
+to EasyDMA in place, and free it once the transfer is over.
+
+Header only, and plain C apart from the barrier, so it also builds on a
+host.
+*/
+
+#ifndef __RINGBUF_H
+#define __RINGBUF_H
+
+#include <stdint.h>
+#include <string.h>
+
+//=========================== defines =========================================
+
+#if defined(__ARM_ARCH)
+#define RINGBUF_DMB()               __asm volatile ("dmb 0xF" ::: "memory")
+#else
+#define RINGBUF_DMB()               __sync_synchronize()
+#endif
+
+//=========================== typedef =========================================
+
+typedef struct {
+    uint8_t*          buf;
+    uint32_t          mask;         // size-1
+    volatile uint32_t wr;           // bytes written, producer only
+    volatile uint32_t rd;           // bytes read, consumer only
+} ringbuf_t;
+
+//=========================== public ==========================================
+
+// size must be a power of two
+static inline void ringbuf_init(ringbuf_t* rb, uint8_t* buf, uint32_t size) {
+    rb->buf                            = buf;
+    rb->mask                           = size-1;
+    rb->wr                             = 0;
+    rb->rd                             = 0;
+}
+
+static inline uint32_t ringbuf_used(const ringbuf_t* rb) {
+    return rb->wr-rb->rd;
+}
+
+static inline uint32_t ringbuf_free(const ringbuf_t* rb) {
+    return rb->mask+1-(rb->wr-rb->rd);
+}
+
+//=== producer
+
+// returns the number of bytes written, less than len when full
+static inline uint32_t ringbuf_write(ringbuf_t* rb, const uint8_t* buf, uint32_t len) {
+    uint32_t wr;
+    uint32_t num;
+    uint32_t first;
+
+    wr    = rb->wr;
+    num   = rb->mask+1-(wr-rb->rd);
+    if (num>len) {
+        num = len;
+    }
+    // the consumer's reads of this space are over before it is overwritten
+    RINGBUF_DMB();
+
+    // up to the end of the buffer, then from the start
+    first = rb->mask+1-(wr&rb->mask);
+    if (first>num) {
+        first = num;
+    }
+    memcpy(&rb->buf[wr&rb->mask], buf, first);
+    memcpy(rb->buf, &buf[first], num-first);
+
+    RINGBUF_DMB();
+    rb->wr                             = wr+num;
+    return num;
+}
+
+//=== consumer
+
+// contiguous bytes that can be read in place, NULL when empty
+static inline uint8_t* ringbuf_peek(const ringbuf_t* rb, uint32_t* len) {
+    uint32_t rd;
+    uint32_t num;
+
+    rd    = rb->rd;
+    num   = rb->wr-rd;
+    RINGBUF_DMB();
+    if (num>rb->mask+1-(rd&rb->mask)) {
+        num = rb->mask+1-(rd&rb->mask);
+    }
+    *len  = num;
+    if (num==0) {
+        return NULL;
+    }
+    return &rb->buf[rd&rb->mask];
+}
+
+// frees len bytes returned by ringbuf_peek()
+static inline void ringbuf_release(ringbuf_t* rb, uint32_t len) {
+    RINGBUF_DMB();
+    rb->rd                             = rb->rd+len;
+}
+
+// returns the number of bytes read, less than len when empty
+static inline uint32_t ringbuf_read(ringbuf_t* rb, uint8_t* buf, uint32_t len) {
+    const uint8_t* data;
+    uint32_t       avail;
+    uint32_t       num;
+
+    num = 0;
+    while (num<len) {
+        data = ringbuf_peek(rb, &avail);
+        if (data==NULL) {
+            break;
+        }
+        if (avail>len-num) {
+            avail = len-num;
+        }
+        memcpy(&buf[num], data, avail);
+        ringbuf_release(rb, avail);
+        num += avail;
+    }
+    return num;
+}
+
+#endif
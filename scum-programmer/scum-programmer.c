@@ -2,66 +2,268 @@
 SCuM programmer.
 */
 
-#include "nrf52840.h"
+#include "scum-programmer.h"
+#include "threewb.h"
+#include "usb.h"
+#include "host_uart.h"
+#include "crc.h"
+#include "calib.h"
+#include "proto.h"
+#include "store.h"
+#include "scum_uart.h"
+#include "prof.h"
+#include "trace.h"
 
 //=========================== defines =========================================
 
 const uint8_t APP_VERSION[]         = {0x00,0x01};
 
 #define NUM_LEDS                    4
-
-// https://infocenter.nordicsemi.com/index.jsp?topic=%2Fug_nrf52840_dk%2FUG%2Fdk%2Fhw_buttons_leds.html
-// Button 1 P0.11
-// Button 2 P0.12
-// Button 3 P0.24
-// Button 4 P0.25
-// LED 1 P0.13
-// LED 2 P0.14
-// LED 3 P0.15
-// LED 4 P0.16
+#define BUTTON_DEBOUNCE_TICKS       (16000000/5) // 200ms
 
 //=========================== prototypes ======================================
 
-void lfxtal_start(void);
-void led_enable(void);
+void     lfxtal_start(void);
+void     hfxtal_start(void);
+void     timestamp_start(void);
+void     led_enable(void);
+void     app_tick(void);
+void     led_advance(void);
+void     app_usb_cdc_rx(void);
+void     app_usb_vendor_rx(void);
+void     app_host_uart_rx(void);
+void     app_3wb_done(void);
+void     app_store_done(void);
+void     app_button(void);
+void     app_scum_verify_done(void);
+void     app_scum_uart_rx(void);
+void     button_enable(void);
+uint32_t events_take(void);
+void     events_dispatch(void);
 
 //=========================== variables =======================================
 
+typedef void (*event_handler_t)(void);
+
+const event_handler_t event_handlers[EVT_MAX] = {
+    app_tick,                       // EVT_LED_ADVANCE
+    app_usb_cdc_rx,                 // EVT_USB_CDC_RX
+    app_usb_vendor_rx,              // EVT_USB_VENDOR_RX
+    app_host_uart_rx,               // EVT_HOST_UART_RX
+    app_3wb_done,                   // EVT_3WB_DONE
+    store_step,                     // EVT_STORE_STEP
+    app_store_done,                 // EVT_STORE_DONE
+    app_button,                     // EVT_BUTTON
+    scum_uart_step,                 // EVT_SCUM_UART
+    app_scum_verify_done,           // EVT_SCUM_VERIFY_DONE
+    app_scum_uart_rx,               // EVT_SCUM_UART_RX
+};
+
 typedef struct {
     uint32_t       led_counter;
+    uint32_t       button_ts;       // last press, for debouncing
+    volatile uint32_t events;       // pending-work bitmap, one bit per EVT_*
 } app_vars_t;
 
 app_vars_t app_vars;
 
-typedef struct {
-    uint32_t       num_task_loops;
-    uint32_t       num_ISR_RTC0_IRQHandler;
-    uint32_t       num_ISR_RTC0_IRQHandler_COMPARE0;
-} app_dbg_t;
-
 app_dbg_t app_dbg;
 
+app_bench_t app_bench;
+
+// staging buffer, the image as it will be loaded into SCuM
+// in its own RAM section, left out of the startup zeroing; scum_image_len
+// says how much of it is valid
+uint8_t  scum_image[SCUM_IMAGE_SIZE] __attribute__((section(".scum_image"), aligned(4)));
+uint32_t scum_image_len;            // bytes of scum_image holding the image
+uint32_t scum_image_crc;            // CRC32 of them, computed as they were staged
+
 //=========================== main ============================================
 
 int main(void) {
     
+    // bsp
+    prof_init();
+    trace_init();
+    crc_init();
+    lfxtal_start();
+    hfxtal_start();
+    timestamp_start();
+    led_enable();
+    button_enable();
+    threewb_init();
+    usb_init();
+    host_uart_init();
+    calib_init();
+    proto_init();
+    store_init();
+    scum_uart_init();
+
     // main loop
     while(1) {
-        
-        // bsp
-        lfxtal_start();
-        led_enable();
 
-        // wait for event
-        __SEV(); // set event
-        __WFE(); // wait for event
-        __WFE(); // wait for event
+        // sleep until an ISR posts an event
+        // interrupts are masked while testing the bitmap so a post can't slip
+        // in between the test and the WFI; a pending interrupt still wakes
+        // the core with PRIMASK set, and runs as soon as it is cleared
+        __disable_irq();
+        if (app_vars.events==0) {
+            __WFI();
+            app_dbg.num_wakeups++;
+        }
+        __enable_irq();
+
+        // handle
+        events_dispatch();
 
         // debug
         app_dbg.num_task_loops++;
     }
 }
 
+//=========================== app =============================================
+
+void app_usb_cdc_rx(void) {
+    uint8_t* buf;
+    uint32_t len;
+
+    while ((buf = usb_cdc_rx_peek(&len))) {
+        proto_rx(PROTO_LINK_USB, buf, len);
+        usb_cdc_rx_release();
+    }
+}
+
+void app_usb_vendor_rx(void) {
+    uint32_t len;
+    uint8_t  rc;
+
+    len = usb_vendor_rx_len(&rc);
+    if (rc==RC_BUSY) {
+        // refused, scum_image was in use and is left as it was
+        usb_vendor_status(RC_BUSY, 0, 0);
+        return;
+    }
+    if (rc!=RC_OK) {
+        scum_image_len             = 0;
+        usb_vendor_status(rc, len, 0);
+        return;
+    }
+    scum_image_crc                 = crc32(scum_image, len);
+    scum_image_len                 = len;
+    usb_vendor_status(RC_OK, len, scum_image_crc);
+}
+
+void app_host_uart_rx(void) {
+    uint8_t* buf;
+    uint32_t len;
+
+    while ((buf = host_uart_rx_peek(&len))) {
+        proto_rx(PROTO_LINK_UART, buf, len);
+        host_uart_rx_release(len);
+    }
+}
+
+void app_3wb_done(void) {
+    proto_3wb_done();
+}
+
+void app_store_done(void) {
+    proto_store_done();
+}
+
+void app_scum_verify_done(void) {
+    proto_scum_verify_done();
+}
+
+void app_scum_uart_rx(void) {
+    uint8_t* buf;
+    uint32_t len;
+    uint32_t num;
+
+    while ((buf = scum_uart_rx_peek(&len)) && len) {
+        num = proto_bridge_rx(buf, len);
+        if (num==0) {
+            // host link full, back when it has sent something
+            proto_bridge_wait(EVT_SCUM_UART_RX);
+            return;
+        }
+        scum_uart_rx_release(num);
+    }
+}
+
+void app_button(void) {
+    uint32_t now;
+
+    // debounce
+    now = timestamp_get();
+    if (now-app_vars.button_ts<BUTTON_DEBOUNCE_TICKS) {
+        return;
+    }
+    app_vars.button_ts                 = now;
+
+    // re-load SCuM with the most recently used stored image
+    if (threewb_is_busy() || usb_vendor_is_busy() ||
+        store_load(store_last(), scum_image, &scum_image_len, &scum_image_crc)!=RC_OK) {
+        return;
+    }
+    threewb_load(scum_image, scum_image_len);
+}
+
+//=========================== events ==========================================
+
+void events_post(uint8_t evt) {
+    uint32_t events;
+
+    // atomic OR, safe against preemption by a higher priority ISR
+    do {
+        events = __LDREXW(&app_vars.events);
+    } while (__STREXW(events | (0x00000001<<evt), &app_vars.events));
+}
+
+uint32_t events_take(void) {
+    uint32_t events;
+
+    // atomic swap with 0
+    do {
+        events = __LDREXW(&app_vars.events);
+    } while (__STREXW(0, &app_vars.events));
+
+    return events;
+}
+
+void events_dispatch(void) {
+    uint32_t events;
+    uint32_t ts_start;
+    uint32_t ts_duration;
+    uint32_t prof;
+    uint8_t  evt;
+
+    events = events_take();
+    if (events==0) {
+        return;
+    }
+    ts_start = timestamp_get();
+
+    // call the handler of each pending event, lowest bit first
+    while (events) {
+        evt     = __CLZ(__RBIT(events));
+        events &= ~(0x00000001<<evt);
+        trace(TRACE_EVT_TASK_START, evt, 0);
+        prof    = prof_start();
+        event_handlers[evt]();
+        prof_stop(PROF_TASK(evt), prof);
+        trace(TRACE_EVT_TASK_END, evt, 0);
+        app_dbg.num_events_dispatched++;
+    }
+
+    // debug
+    ts_duration                        = timestamp_get()-ts_start;
+    app_dbg.loop_ticks_total          += ts_duration;
+    if (ts_duration>app_dbg.loop_ticks_max) {
+        app_dbg.loop_ticks_max         = ts_duration;
+    }
+}
+
 //=========================== bsp =============================================
 
 //=== lfxtal
@@ -76,6 +278,50 @@ void lfxtal_start(void) {
 
 }
 
+//=== hfxtal
+
+void hfxtal_start(void) {
+
+    // start 64MHz XTAL, USBD requires it
+    NRF_CLOCK->EVENTS_HFCLKSTARTED     = 0;
+    NRF_CLOCK->TASKS_HFCLKSTART        = 0x00000001;
+    while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
+}
+
+//=== timestamp
+
+void timestamp_start(void) {
+
+    // TIMER2 free-running at 16MHz, 32-bit, wraps every ~268s
+    NRF_TIMER2->MODE                   = 0x00000000;       // 0==timer
+    NRF_TIMER2->BITMODE                = 0x00000003;       // 3==32-bit
+    NRF_TIMER2->PRESCALER              = 0x00000000;       // 16MHz/2^0
+    NRF_TIMER2->TASKS_CLEAR            = 0x00000001;
+    NRF_TIMER2->TASKS_START            = 0x00000001;
+}
+
+uint32_t timestamp_get(void) {
+    uint32_t primask;
+    uint32_t ts;
+
+    // CC[0] is shared by all callers, don't let an ISR capture in between
+    primask = __get_PRIMASK();
+    __disable_irq();
+    NRF_TIMER2->TASKS_CAPTURE[0]       = 0x00000001;
+    ts                                 = NRF_TIMER2->CC[0];
+    __set_PRIMASK(primask);
+
+    return ts;
+}
+
+// scum_image is being loaded, stored or written by LOAD_CHUNKs, a vendor
+// upload must not touch it
+uint8_t scum_image_in_use(void) {
+    return threewb_is_busy() || store_is_busy() || proto_is_loading();
+}
+
+//=== led
+
 void led_enable(void) {
     
     // enable all LEDs
@@ -93,7 +339,7 @@ void led_enable(void) {
     NRF_RTC0->INTENSET                 = 0x00010000;       // enable compare 0 interrupts
 
     // enable interrupts
-    NVIC_SetPriority(RTC0_IRQn, 1);
+    NVIC_SetPriority(RTC0_IRQn, IRQ_PRIO_RTC0);
     NVIC_ClearPendingIRQ(RTC0_IRQn);
     NVIC_EnableIRQ(RTC0_IRQn);
     
@@ -102,6 +348,11 @@ void led_enable(void) {
     NRF_RTC0->TASKS_START              = 0x00000001;       // start RTC0
 }
 
+void app_tick(void) {
+    led_advance();
+    threewb_tick();
+}
+
 void led_advance(void) {
     
     // bump
@@ -120,9 +371,34 @@ void led_advance(void) {
     }
 }
 
+//=== button
+
+void button_enable(void) {
+
+    // button 1, input with pull-up, pressed pulls it low
+    NRF_P0->PIN_CNF[PIN_BUTTON_1]      = 0x0000000c;
+
+    // GPIOTE event on the falling edge
+    // 1098 7654 3210 9876 5432 1098 7654 3210
+    // xxxx xxxx xxxx xxDD xxxP PPPP xxxx xxMM (D=polarity, P=pin, M=mode)
+    // 0000 0000 0000 0010 0000 1011 0000 0001
+    //    0    0    0    2    0    b    0    1 0x00020b01
+    NRF_GPIOTE->CONFIG[GPIOTE_CH_BUTTON] = 0x00020001 | (PIN_BUTTON_1<<8);
+    NRF_GPIOTE->EVENTS_IN[GPIOTE_CH_BUTTON] = 0x00000000;
+    NRF_GPIOTE->INTENSET               = (0x00000001 << GPIOTE_CH_BUTTON);
+
+    // enable interrupts
+    NVIC_SetPriority(GPIOTE_IRQn, IRQ_PRIO_BUTTON);
+    NVIC_ClearPendingIRQ(GPIOTE_IRQn);
+    NVIC_EnableIRQ(GPIOTE_IRQn);
+}
+
 //=========================== interrupt handlers ==============================
 
 void RTC0_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
 
     // debug
     app_dbg.num_ISR_RTC0_IRQHandler++;
@@ -140,7 +416,25 @@ void RTC0_IRQHandler(void) {
         app_dbg.num_ISR_RTC0_IRQHandler_COMPARE0++;
 
         // handle
-        led_advance();
+        events_post(EVT_LED_ADVANCE);
      }
 
-}
\ No newline at end of file
+
+    prof_stop(PROF_ISR_RTC0, prof);
+}
+
+void GPIOTE_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_GPIOTE_IRQHandler++;
+
+    if (NRF_GPIOTE->EVENTS_IN[GPIOTE_CH_BUTTON] == 0x00000001) {
+        NRF_GPIOTE->EVENTS_IN[GPIOTE_CH_BUTTON] = 0x00000000;
+        events_post(EVT_BUTTON);
+    }
+
+    prof_stop(PROF_ISR_GPIOTE, prof);
+}
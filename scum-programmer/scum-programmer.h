@@ -0,0 +1,202 @@
+/**
+SCuM programmer, declarations shared between the modules.
+*/
+
+#ifndef __SCUM_PROGRAMMER_H
+#define __SCUM_PROGRAMMER_H
+
+#include "nrf52840.h"
+
+//=========================== defines =========================================
+
+// return codes
+#define RC_OK                       0
+#define RC_BUSY                     1
+#define RC_INVALID                  2
+#define RC_UNKNOWN                  3 // command not supported
+
+// events, posted by the ISRs into app_vars.events, handled by the main loop
+#define EVT_LED_ADVANCE             0 // RTC0 compare 0 fired, every 125ms
+#define EVT_USB_CDC_RX              1 // CDC-ACM packet received
+#define EVT_USB_VENDOR_RX           2 // vendor image upload complete
+#define EVT_HOST_UART_RX            3 // UARTE0 buffer filled or line idle
+#define EVT_3WB_DONE                4 // image loaded into SCuM
+#define EVT_STORE_STEP              5 // image store, next erase/write step
+#define EVT_STORE_DONE              6 // image store, save completed
+#define EVT_BUTTON                  7 // button 1 pressed
+#define EVT_SCUM_UART               8 // UARTE1 answer received, or timed out
+#define EVT_SCUM_VERIFY_DONE        9 // read-back verify of SCuM's SRAM over UARTE1 done, result ready
+#define EVT_SCUM_UART_RX            10 // bridge, bytes from SCuM in the ring
+#define EVT_MAX                     11
+
+// https://infocenter.nordicsemi.com/index.jsp?topic=%2Fug_nrf52840_dk%2FUG%2Fdk%2Fhw_buttons_leds.html
+// Button 1 P0.11
+// Button 2 P0.12
+// Button 3 P0.24
+// Button 4 P0.25
+// LED 1 P0.13
+// LED 2 P0.14
+// LED 3 P0.15
+// LED 4 P0.16
+#define PIN_BUTTON_1                11
+
+// host UART, J-Link VCOM
+// TXD P0.06
+// RXD P0.08
+// RTS P0.05
+// CTS P0.07
+#define PIN_HOST_UART_TXD           6
+#define PIN_HOST_UART_RXD           8
+#define PIN_HOST_UART_RTS           5
+#define PIN_HOST_UART_CTS           7
+
+// SCuM
+// HRESET    P0.28 (active low)
+// 3WB CLK   P0.29 (SCuM samples DATA on the rising edge), PWM0 or SPIM3 SCK
+// 3WB DATA  P0.30 (MSB first), PWM0 or SPIM3 MOSI
+// 3WB EN    P0.31 (active high, held for the whole image)
+// CAL       P0.27 (calibration reference, toggled off the 32kHz crystal)
+#define PIN_SCUM_CAL                27
+#define PIN_SCUM_HRESET             28
+#define PIN_3WB_CLK                 29
+#define PIN_3WB_DATA                30
+#define PIN_3WB_EN                  31
+
+// SCuM UART
+// TXD P0.02 (to SCuM's UART RX)
+// RXD P0.03 (from SCuM's UART TX)
+#define PIN_SCUM_UART_TXD           2
+#define PIN_SCUM_UART_RXD           3
+
+// SCuM's SRAM holds the whole image
+#define SCUM_IMAGE_SIZE             (64*1024)
+
+// interrupt priorities, 0 is the highest
+#define IRQ_PRIO_3WB                0
+#define IRQ_PRIO_RTC0               1
+#define IRQ_PRIO_USB                2
+#define IRQ_PRIO_HOST_UART          2
+#define IRQ_PRIO_SCUM_UART          2
+#define IRQ_PRIO_CALIB              3
+#define IRQ_PRIO_BUTTON             3
+
+// PPI channels
+#define PPI_CH_3WB_SPIM_CHAIN       2
+#define PPI_CH_3WB_SPIM_COUNT       3
+#define PPI_CH_3WB_SPIM_LAST        4
+#define PPI_CH_HOST_UART_COUNT      5
+#define PPI_CH_HOST_UART_IDLE       6
+#define PPI_CH_CALIB                7
+
+// PPI channel groups
+#define PPI_CHG_3WB_SPIM            0
+
+// GPIOTE channels
+#define GPIOTE_CH_CALIB             1
+#define GPIOTE_CH_BUTTON            2
+
+//=========================== typedef =========================================
+
+typedef struct {
+    uint32_t       num_task_loops;
+    uint32_t       num_ISR_RTC0_IRQHandler;
+    uint32_t       num_ISR_RTC0_IRQHandler_COMPARE0;
+    uint32_t       num_wakeups;
+    uint32_t       num_events_dispatched;
+    uint32_t       loop_ticks_total;    // 16MHz ticks spent handling events
+    uint32_t       loop_ticks_max;      // longest single pass, in 16MHz ticks
+    // 3WB
+    uint32_t       num_ISR_PWM0_IRQHandler;
+    uint32_t       num_ISR_SPIM3_IRQHandler;
+    uint32_t       num_ISR_TIMER3_IRQHandler;
+    uint32_t       num_3wb_loads;
+    uint32_t       num_3wb_late_refills; // PWM: a sequence was refilled after it had started playing
+    uint32_t       threewb_bps;         // bits/s achieved by the last load
+    uint32_t       threewb_spim_chunks; // SPIM transactions in the last load
+    uint32_t       threewb_spim_gap_ns; // average time lost per SPIM transaction
+    uint32_t       num_3wb_stalls;      // streamed load caught up with the image
+    uint32_t       num_3wb_aborts;      // streamed load abandoned while stalled
+    uint32_t       threewb_stall_ticks; // 16MHz ticks the last load spent waiting for the image
+    // USB
+    uint32_t       num_ISR_POWER_CLOCK_IRQHandler;
+    uint32_t       num_ISR_USBD_IRQHandler;
+    uint32_t       num_usb_naks;        // OUT packets left on the endpoint, no free buffer
+    uint32_t       num_usb_vendor_refused; // uploads answered RC_BUSY, scum_image in use
+    uint32_t       num_usb_stalls;      // unsupported control requests
+    uint32_t       num_usb_bytes_out;   // host to device
+    uint32_t       num_usb_bytes_in;    // device to host
+    // host UART
+    uint32_t       num_ISR_UARTE0_UART0_IRQHandler;
+    uint32_t       num_ISR_TIMER0_IRQHandler;
+    uint32_t       num_host_uart_overruns;
+    uint32_t       num_host_uart_framing_errors;
+    uint32_t       num_host_uart_rx_stalls;  // receiver paused, main loop behind
+    // host protocol
+    uint32_t       num_hdlc_fcs_errors;
+    uint32_t       num_hdlc_overflows;       // frame longer than its buffer
+    uint32_t       num_hdlc_aborts;          // flag right after an escape
+    uint32_t       num_proto_frames;
+    uint32_t       num_proto_bad_frames;     // valid FCS, malformed content
+    uint32_t       num_proto_chunks_dropped; // LOAD_CHUNK past the window
+    uint32_t       num_proto_chunks_duplicate; // LOAD_CHUNK already received
+    uint32_t       num_proto_nacks;          // holes reported to the host
+    uint32_t       num_proto_retransmits;    // reported holes filled
+    uint32_t       num_lz4_errors;           // LOAD_CHUNK_LZ4 that didn't decode to its length
+    uint32_t       num_lz4_bytes_in;
+    uint32_t       num_lz4_bytes_out;
+    uint32_t       crc_image;                // CRC32 of the last image loaded over the protocol
+    uint32_t       crc_bytes;                // run through the incremental CRC32
+    uint32_t       crc_ticks;                // 16MHz ticks spent on them
+    uint32_t       crc_cycles_per_kib;       // CPU cycles, 64MHz
+    // calibration
+    uint32_t       num_ISR_RTC2_IRQHandler;
+    // image store
+    uint32_t       num_ISR_GPIOTE_IRQHandler;
+    uint32_t       num_store_erase_slices;
+    uint32_t       num_store_saves;
+    uint32_t       num_store_loads;
+    uint32_t       num_store_dedups;         // save of an image already in a slot
+    uint32_t       num_store_evictions;      // least recently used slot reused
+    uint32_t       num_store_compactions;    // directory page rewritten
+    // SCuM UART
+    uint32_t       num_ISR_UARTE1_IRQHandler;
+    uint32_t       num_ISR_RTC1_IRQHandler;
+    uint32_t       num_scum_verifies;
+    uint32_t       num_scum_verify_mismatches;
+    uint32_t       num_scum_uart_timeouts;   // no or wrong answer from SCuM
+    uint32_t       scum_verify_ticks;        // last read-back verify, 16MHz ticks
+    uint32_t       num_bridge_bytes_up;      // SCuM to host
+    uint32_t       num_bridge_bytes_down;    // host to SCuM
+    uint32_t       num_bridge_drops;         // receiver paused on a full ring, or overrun
+    uint32_t       bridge_fill_max;          // most bytes waiting in the ring
+    // trace
+    uint32_t       num_trace_drops;          // RTT buffer full
+} app_dbg_t;
+
+// where the time of the last load went, 16MHz ticks, returned by GET_BENCH
+typedef struct {
+    uint32_t       image_len;
+    uint32_t       upload_ticks;        // LOAD_START to the whole image staged
+    uint32_t       lz4_ticks;           // decoding LOAD_CHUNK_LZ4
+    uint32_t       staging_ticks;       // incremental CRC32, chunks land in place
+    uint32_t       reset_ticks;         // SCuM HRESET pulse
+    uint32_t       threewb_ticks;       // EN asserted to released
+    uint32_t       threewb_stall_ticks; // of which waiting for the image
+    uint32_t       verify_ticks;        // read-back of SCuM's SRAM
+} app_bench_t;
+
+//=========================== variables =======================================
+
+extern app_dbg_t app_dbg;
+extern app_bench_t app_bench;
+extern uint8_t   scum_image[SCUM_IMAGE_SIZE];
+extern uint32_t  scum_image_len;
+extern uint32_t  scum_image_crc;
+
+//=========================== prototypes ======================================
+
+void     events_post(uint8_t evt);
+uint32_t timestamp_get(void);
+uint8_t  scum_image_in_use(void);
+
+#endif
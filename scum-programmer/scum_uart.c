@@ -0,0 +1,495 @@
+/**
+SCuM serial port, on UARTE1.
+
+Read-back verify: once the image runs on SCuM, a verify stub in it (or
+loaded ahead of it) answers requests on SCuM's UART, and the staged image
+is checked against SCuM's SRAM without moving it back over the slow link:
+- CRC32 of each SCUM_UART_BLOCK bytes of the image, compared with the
+  staging buffer block by block
+- in the first block that differs, CRC32 of each SCUM_UART_SUBBLOCK bytes
+- in the first sub-block that differs, the bytes themselves
+Only the first level runs when the image matches, 32 CRCs for 64KiB, about
+70ms on the wire at 19200 baud.
+
+Requests, all fields little endian:
+    [op][addr u32][len u32][size u16]
+- op 'C': answers [op][crc32 u32] per size bytes of [addr, addr+len), the
+  last one possibly shorter
+- op 'R': answers [op][len bytes from addr], size unused
+The CRC32 is the zlib one. SCuM's SRAM starts at address 0, where the 3WB
+loads the image.
+
+Each answer has a known length: UARTE1 receives exactly that into its
+EasyDMA buffer, RTC1 gives up after SCUM_UART_TIMEOUT_TICKS and stops the
+receiver. The comparisons run from the main loop, in scum_uart_step().
+
+Bridge: SCuM's UART is passed through to the host, as long as it is on.
+RX runs continuously, EasyDMA writes straight into a ring, one
+SCUM_UART_RX_CHUNK at a time:
+- RXSTARTED (chunk n started): point RXD.PTR at chunk n+1, the
+  ENDRX->STARTRX shortcut switches to it without CPU involvement
+- if the main loop hasn't consumed chunk n+1's space yet, the shortcut is
+  disabled instead; the receiver stops at the end of chunk n and resumes
+  once the space is consumed. SCuM has no flow control, what it sends in
+  the meantime is lost, and counted as a drop
+Every RXDRDY advances the ring's write counter and wakes the main loop,
+which doesn't need to wait for a chunk to fill. TX goes through a second
+ring, drained by EasyDMA, as on the host UART.
+*/
+
+#include "scum-programmer.h"
+#include "scum_uart.h"
+#include "ringbuf.h"
+#include "crc.h"
+#include "prof.h"
+#include "trace.h"
+
+//=========================== defines =========================================
+
+#define SCUM_UART_BLOCK             2048        // first level, 32 per image
+#define SCUM_UART_SUBBLOCK          64          // second level, 32 per block
+#define SCUM_UART_RX_MAX            (1+32*4)    // op, then 32 CRCs or 64 bytes
+#define SCUM_UART_TIMEOUT_TICKS     32768       // 1s, SCuM hashes 64KiB in the meantime
+
+#define SCUM_UART_RX_RING_SIZE      1024        // power of two, multiple of the chunk
+#define SCUM_UART_RX_CHUNK          64
+#define SCUM_UART_TX_RING_SIZE      512         // power of two
+
+#define SCUM_UART_OP_CRCS           'C'
+#define SCUM_UART_OP_READ           'R'
+
+#define SCUM_UART_STATE_IDLE        0
+#define SCUM_UART_STATE_BLOCKS      1
+#define SCUM_UART_STATE_SUBBLOCKS   2
+#define SCUM_UART_STATE_BYTES       3
+
+//=========================== variables =======================================
+
+typedef struct {
+    uint8_t        state;
+    const uint8_t* image;
+    uint32_t       len;
+    uint32_t       start;           // timestamp_get() when the verify started
+    // request in progress
+    uint32_t       addr;
+    uint32_t       span;
+    uint16_t       size;
+    uint8_t        tx_buf[11];
+    uint8_t        rx_buf[SCUM_UART_RX_MAX];
+    uint32_t       rx_len;          // expected
+    // outcome
+    uint8_t        result;
+    uint32_t       mismatch;        // SCuM address of the first byte that differs
+    // bridge
+    uint8_t        bridge;
+    uint8_t        rx_ring_buf[SCUM_UART_RX_RING_SIZE];
+    ringbuf_t      rx_ring;         // filled by EasyDMA, counted by RXDRDY
+    uint32_t       rx_started;      // bytes received before the chunk being written
+    uint8_t        rx_stalled;      // shortcut disabled, the next chunk isn't free
+    uint8_t        rx_stopped;      // receiver stopped at the end of a chunk
+    uint8_t        tx_ring_buf[SCUM_UART_TX_RING_SIZE];
+    ringbuf_t      tx_ring;         // filled by the main loop, drained by EasyDMA
+    uint32_t       tx_len;          // length of the EasyDMA transfer in progress
+} scum_uart_vars_t;
+
+scum_uart_vars_t scum_uart_vars;
+
+//=========================== prototypes ======================================
+
+void     _scum_uart_request(uint8_t state, uint8_t op, uint32_t addr, uint32_t span, uint16_t size);
+void     _scum_uart_done(uint8_t result, uint32_t mismatch);
+uint8_t  _scum_uart_rx_chunk_free(uint32_t start);
+void     _scum_uart_tx_kick(void);
+
+//=========================== public ==========================================
+
+void scum_uart_init(void) {
+
+    // pins
+    NRF_P0->OUTSET                     = (0x00000001 << PIN_SCUM_UART_TXD);
+    NRF_P0->PIN_CNF[PIN_SCUM_UART_TXD] = 0x00000003;       // output, input buffer disconnected
+    NRF_P0->PIN_CNF[PIN_SCUM_UART_RXD] = 0x0000000c;       // input, pull-up, idle high if SCuM is off
+
+    // UARTE1, 19200 baud, 8N1, no flow control
+    NRF_UARTE1->PSEL.TXD               = PIN_SCUM_UART_TXD;
+    NRF_UARTE1->PSEL.RXD               = PIN_SCUM_UART_RXD;
+    NRF_UARTE1->BAUDRATE               = 0x004EA000;       // 19200 baud, SCUM_UART_BAUDRATE_DEFAULT
+    NRF_UARTE1->CONFIG                 = 0x00000000;
+    NRF_UARTE1->INTENSET               = 0x00000010;       // ENDRX
+    NRF_UARTE1->ENABLE                 = 0x00000008;       // 8==UARTE
+
+    // RTC1, 32768Hz, receive timeout
+    NRF_RTC1->PRESCALER                = 0;
+    NRF_RTC1->INTENSET                 = 0x00010000;       // enable compare 0 interrupts
+
+    // enable interrupts
+    NVIC_SetPriority(UARTE1_IRQn, IRQ_PRIO_SCUM_UART);
+    NVIC_ClearPendingIRQ(UARTE1_IRQn);
+    NVIC_EnableIRQ(UARTE1_IRQn);
+    NVIC_SetPriority(RTC1_IRQn, IRQ_PRIO_SCUM_UART);
+    NVIC_ClearPendingIRQ(RTC1_IRQn);
+    NVIC_EnableIRQ(RTC1_IRQn);
+}
+
+uint8_t scum_uart_verify(const uint8_t* image, uint32_t len) {
+
+    if (scum_uart_vars.state!=SCUM_UART_STATE_IDLE || scum_uart_vars.bridge) {
+        return RC_BUSY;
+    }
+    if (len==0 || len>SCUM_IMAGE_SIZE) {
+        return RC_INVALID;
+    }
+    scum_uart_vars.image               = image;
+    scum_uart_vars.len                 = len;
+    scum_uart_vars.start               = timestamp_get();
+    app_dbg.num_scum_verifies++;
+
+    _scum_uart_request(SCUM_UART_STATE_BLOCKS, SCUM_UART_OP_CRCS, 0, len, SCUM_UART_BLOCK);
+    return RC_OK;
+}
+
+uint8_t scum_uart_verify_result(uint32_t* mismatch) {
+    *mismatch = scum_uart_vars.mismatch;
+    return scum_uart_vars.result;
+}
+
+uint8_t scum_uart_is_busy(void) {
+    return scum_uart_vars.state!=SCUM_UART_STATE_IDLE;
+}
+
+uint8_t scum_uart_bridge_start(uint32_t baudrate) {
+
+    if (scum_uart_vars.state!=SCUM_UART_STATE_IDLE || scum_uart_vars.bridge) {
+        return RC_BUSY;
+    }
+    if (baudrate<1200 || baudrate>1000000) {
+        return RC_INVALID;
+    }
+    // BAUDRATE is baudrate*2^32/16MHz, with a 4096 granularity
+    NRF_UARTE1->BAUDRATE               = (uint32_t)((((uint64_t)baudrate<<32)/16000000+0x800) & 0xfffff000);
+
+    ringbuf_init(&scum_uart_vars.rx_ring, scum_uart_vars.rx_ring_buf, SCUM_UART_RX_RING_SIZE);
+    ringbuf_init(&scum_uart_vars.tx_ring, scum_uart_vars.tx_ring_buf, SCUM_UART_TX_RING_SIZE);
+    scum_uart_vars.rx_started          = 0;
+    scum_uart_vars.rx_stalled          = 0;
+    scum_uart_vars.rx_stopped          = 0;
+    scum_uart_vars.tx_len              = 0;
+    scum_uart_vars.bridge              = 1;
+
+    // left over from the verify, which doesn't clear what it doesn't use
+    NRF_UARTE1->EVENTS_RXDRDY          = 0x00000000;
+    NRF_UARTE1->EVENTS_RXSTARTED       = 0x00000000;
+    NRF_UARTE1->EVENTS_ENDRX           = 0x00000000;
+    NRF_UARTE1->EVENTS_ENDTX           = 0x00000000;
+    NRF_UARTE1->EVENTS_ERROR           = 0x00000000;
+
+    // 1098 7654 3210 9876 5432 1098 7654 3210
+    // xxxx xxxx xxxx Sxxx xxxx xxEN xxxR xxxD (S=RXSTARTED, E=ERROR, N=ENDTX, R=ENDRX, D=RXDRDY)
+    // 0000 0000 0000 1000 0000 0011 0001 0100
+    //    0    0    0    8    0    3    1    4 0x00080314
+    NRF_UARTE1->INTENSET               = 0x00080314;
+    NRF_UARTE1->SHORTS                 = 0x00000020;       // ENDRX_STARTRX
+
+    // start receiving into chunk 0, RXSTARTED arms chunk 1
+    NRF_UARTE1->RXD.PTR                = (uint32_t)scum_uart_vars.rx_ring_buf;
+    NRF_UARTE1->RXD.MAXCNT             = SCUM_UART_RX_CHUNK;
+    NRF_UARTE1->TASKS_STARTRX          = 0x00000001;
+    return RC_OK;
+}
+
+void scum_uart_bridge_stop(void) {
+
+    if (scum_uart_vars.bridge==0) {
+        return;
+    }
+    NRF_UARTE1->INTENCLR               = 0x00080304;       // RXSTARTED, ERROR, ENDTX, RXDRDY
+    NRF_UARTE1->SHORTS                 = 0x00000000;
+    NRF_UARTE1->TASKS_STOPRX           = 0x00000001;
+    NRF_UARTE1->TASKS_STOPTX           = 0x00000001;
+    scum_uart_vars.bridge              = 0;
+    NRF_UARTE1->BAUDRATE               = 0x004EA000;       // 19200 baud, for the verify stub
+}
+
+uint8_t scum_uart_bridge_is_on(void) {
+    return scum_uart_vars.bridge;
+}
+
+uint8_t* scum_uart_rx_peek(uint32_t* len) {
+    if (scum_uart_vars.bridge==0) {
+        *len = 0;
+        return NULL;
+    }
+    // RXDRDY can precede the EasyDMA write by a few cycles, far less than
+    // it takes the main loop to get here
+    return ringbuf_peek(&scum_uart_vars.rx_ring, len);
+}
+
+void scum_uart_rx_release(uint32_t len) {
+
+    ringbuf_release(&scum_uart_vars.rx_ring, len);
+    app_dbg.num_bridge_bytes_up       += len;
+
+    // let the ISR resume reception if it was waiting for this
+    if (scum_uart_vars.rx_stalled) {
+        NVIC_SetPendingIRQ(UARTE1_IRQn);
+    }
+}
+
+uint32_t scum_uart_tx(const uint8_t* buf, uint32_t len) {
+    uint32_t num;
+
+    if (scum_uart_vars.bridge==0) {
+        return 0;
+    }
+    num = ringbuf_write(&scum_uart_vars.tx_ring, buf, len);
+    app_dbg.num_bridge_bytes_down     += num;
+    NVIC_DisableIRQ(UARTE1_IRQn);
+    _scum_uart_tx_kick();
+    NVIC_EnableIRQ(UARTE1_IRQn);
+    return num;
+}
+
+void scum_uart_step(void) {
+    const uint8_t* rx;
+    uint32_t       offset;
+    uint32_t       len;
+    uint32_t       i;
+
+    if (scum_uart_vars.state==SCUM_UART_STATE_IDLE) {
+        return;
+    }
+
+    // the whole answer, or the timeout stopped the receiver short
+    rx = scum_uart_vars.rx_buf;
+    if (NRF_UARTE1->RXD.AMOUNT!=scum_uart_vars.rx_len || rx[0]!=scum_uart_vars.tx_buf[0]) {
+        app_dbg.num_scum_uart_timeouts++;
+        _scum_uart_done(SCUM_VERIFY_NO_ANSWER, 0);
+        return;
+    }
+    rx++;
+
+    if (scum_uart_vars.state==SCUM_UART_STATE_BYTES) {
+        for (i=0;i<scum_uart_vars.span;i++) {
+            if (rx[i]!=scum_uart_vars.image[scum_uart_vars.addr+i]) {
+                _scum_uart_done(SCUM_VERIFY_MISMATCH, scum_uart_vars.addr+i);
+                return;
+            }
+        }
+        // the CRC differed, the bytes don't any more
+        _scum_uart_done(SCUM_VERIFY_MISMATCH, scum_uart_vars.addr);
+        return;
+    }
+
+    // block CRCs, in image order, narrow down to the first one that differs
+    for (offset=0;offset<scum_uart_vars.span;offset+=scum_uart_vars.size) {
+        len = scum_uart_vars.span-offset;
+        if (len>scum_uart_vars.size) {
+            len = scum_uart_vars.size;
+        }
+        if (crc32(&scum_uart_vars.image[scum_uart_vars.addr+offset], len)==
+            (rx[0] | (rx[1]<<8) | (rx[2]<<16) | ((uint32_t)rx[3]<<24))) {
+            rx += 4;
+            continue;
+        }
+        if (scum_uart_vars.state==SCUM_UART_STATE_BLOCKS) {
+            _scum_uart_request(SCUM_UART_STATE_SUBBLOCKS, SCUM_UART_OP_CRCS, scum_uart_vars.addr+offset, len, SCUM_UART_SUBBLOCK);
+        } else {
+            _scum_uart_request(SCUM_UART_STATE_BYTES, SCUM_UART_OP_READ, scum_uart_vars.addr+offset, len, 0);
+        }
+        return;
+    }
+    if (scum_uart_vars.state==SCUM_UART_STATE_BLOCKS) {
+        _scum_uart_done(SCUM_VERIFY_MATCH, 0);
+    } else {
+        _scum_uart_done(SCUM_VERIFY_MISMATCH, scum_uart_vars.addr);
+    }
+}
+
+//=========================== private =========================================
+
+void _scum_uart_request(uint8_t state, uint8_t op, uint32_t addr, uint32_t span, uint16_t size) {
+    uint8_t* tx;
+
+    trace(TRACE_EVT_SCUM_UART_REQ, op, addr/64);
+    scum_uart_vars.state               = state;
+    scum_uart_vars.addr                = addr;
+    scum_uart_vars.span                = span;
+    scum_uart_vars.size                = size;
+    if (op==SCUM_UART_OP_CRCS) {
+        scum_uart_vars.rx_len          = 1+4*((span+size-1)/size);
+    } else {
+        scum_uart_vars.rx_len          = 1+span;
+    }
+
+    tx                                 = scum_uart_vars.tx_buf;
+    tx[0]                              = op;
+    tx[1]                              = (addr >>  0) & 0xff;
+    tx[2]                              = (addr >>  8) & 0xff;
+    tx[3]                              = (addr >> 16) & 0xff;
+    tx[4]                              = (addr >> 24) & 0xff;
+    tx[5]                              = (span >>  0) & 0xff;
+    tx[6]                              = (span >>  8) & 0xff;
+    tx[7]                              = (span >> 16) & 0xff;
+    tx[8]                              = (span >> 24) & 0xff;
+    tx[9]                              = (size >>  0) & 0xff;
+    tx[10]                             = (size >>  8) & 0xff;
+
+    // receiver ready before SCuM can answer
+    NRF_UARTE1->RXD.PTR                = (uint32_t)scum_uart_vars.rx_buf;
+    NRF_UARTE1->RXD.MAXCNT             = scum_uart_vars.rx_len;
+    NRF_UARTE1->TASKS_STARTRX          = 0x00000001;
+    NRF_UARTE1->TXD.PTR                = (uint32_t)scum_uart_vars.tx_buf;
+    NRF_UARTE1->TXD.MAXCNT             = sizeof(scum_uart_vars.tx_buf);
+    NRF_UARTE1->TASKS_STARTTX          = 0x00000001;
+
+    NRF_RTC1->EVENTS_COMPARE[0]        = 0x00000000;
+    NRF_RTC1->CC[0]                    = SCUM_UART_TIMEOUT_TICKS;
+    NRF_RTC1->TASKS_CLEAR              = 0x00000001;
+    NRF_RTC1->TASKS_START              = 0x00000001;
+}
+
+void _scum_uart_done(uint8_t result, uint32_t mismatch) {
+    scum_uart_vars.state               = SCUM_UART_STATE_IDLE;
+    scum_uart_vars.result              = result;
+    scum_uart_vars.mismatch            = mismatch;
+    if (result==SCUM_VERIFY_MISMATCH) {
+        app_dbg.num_scum_verify_mismatches++;
+    }
+    app_dbg.scum_verify_ticks          = timestamp_get()-scum_uart_vars.start;
+    app_bench.verify_ticks             = app_dbg.scum_verify_ticks;
+    events_post(EVT_SCUM_VERIFY_DONE);
+}
+
+uint8_t _scum_uart_rx_chunk_free(uint32_t start) {
+    // the chunk at byte count start, with everything before it, fits in the ring
+    return start+SCUM_UART_RX_CHUNK-scum_uart_vars.rx_ring.rd<=SCUM_UART_RX_RING_SIZE;
+}
+
+void _scum_uart_tx_kick(void) {
+    uint8_t* data;
+    uint32_t len;
+
+    if (scum_uart_vars.tx_len) {
+        return;
+    }
+
+    // contiguous part of the ring, EasyDMA reads it in place
+    data = ringbuf_peek(&scum_uart_vars.tx_ring, &len);
+    if (len==0) {
+        return;
+    }
+    scum_uart_vars.tx_len              = len;
+    NRF_UARTE1->TXD.PTR                = (uint32_t)data;
+    NRF_UARTE1->TXD.MAXCNT             = len;
+    NRF_UARTE1->TASKS_STARTTX          = 0x00000001;
+}
+
+//=========================== interrupt handlers ==============================
+
+void UARTE1_IRQHandler(void) {
+    uint32_t errorsrc;
+    uint32_t fill;
+    uint32_t next;
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_UARTE1_IRQHandler++;
+
+    if (scum_uart_vars.bridge==0) {
+        if (NRF_UARTE1->EVENTS_ENDRX == 0x00000001) {
+            NRF_UARTE1->EVENTS_ENDRX   = 0x00000000;
+
+            // answer complete, or cut short by the timeout
+            NRF_RTC1->TASKS_STOP       = 0x00000001;
+            events_post(EVT_SCUM_UART);
+        }
+        prof_stop(PROF_ISR_UARTE1, prof);
+        return;
+    }
+
+    // bridge, one byte more in the ring
+    if (NRF_UARTE1->EVENTS_RXDRDY == 0x00000001) {
+        NRF_UARTE1->EVENTS_RXDRDY      = 0x00000000;
+
+        scum_uart_vars.rx_ring.wr      = scum_uart_vars.rx_ring.wr+1;
+        fill                           = ringbuf_used(&scum_uart_vars.rx_ring);
+        if (fill>app_dbg.bridge_fill_max) {
+            app_dbg.bridge_fill_max    = fill;
+        }
+        events_post(EVT_SCUM_UART_RX);
+    }
+
+    // ENDRX first, the next chunk's RXSTARTED may already be pending too
+    if (NRF_UARTE1->EVENTS_ENDRX == 0x00000001) {
+        NRF_UARTE1->EVENTS_ENDRX       = 0x00000000;
+
+        scum_uart_vars.rx_started     += SCUM_UART_RX_CHUNK;
+        if (scum_uart_vars.rx_stalled) {
+            scum_uart_vars.rx_stopped  = 1;
+        }
+    }
+
+    if (NRF_UARTE1->EVENTS_RXSTARTED == 0x00000001) {
+        NRF_UARTE1->EVENTS_RXSTARTED   = 0x00000000;
+
+        // arm the next chunk, if the main loop is done with its space
+        next = scum_uart_vars.rx_started+SCUM_UART_RX_CHUNK;
+        if (_scum_uart_rx_chunk_free(next)) {
+            NRF_UARTE1->RXD.PTR        = (uint32_t)&scum_uart_vars.rx_ring_buf[next%SCUM_UART_RX_RING_SIZE];
+            NRF_UARTE1->SHORTS         = 0x00000020;       // ENDRX_STARTRX
+        } else {
+            NRF_UARTE1->SHORTS         = 0x00000000;
+            scum_uart_vars.rx_stalled  = 1;
+            app_dbg.num_bridge_drops++;
+        }
+    }
+
+    // resume a stopped receiver once the main loop has freed the chunk
+    if (scum_uart_vars.rx_stopped && _scum_uart_rx_chunk_free(scum_uart_vars.rx_started)) {
+        NRF_UARTE1->RXD.PTR            = (uint32_t)&scum_uart_vars.rx_ring_buf[scum_uart_vars.rx_started%SCUM_UART_RX_RING_SIZE];
+        NRF_UARTE1->TASKS_STARTRX      = 0x00000001;
+        scum_uart_vars.rx_stalled      = 0;
+        scum_uart_vars.rx_stopped      = 0;
+    }
+
+    if (NRF_UARTE1->EVENTS_ERROR == 0x00000001) {
+        NRF_UARTE1->EVENTS_ERROR       = 0x00000000;
+
+        errorsrc                       = NRF_UARTE1->ERRORSRC;
+        NRF_UARTE1->ERRORSRC           = errorsrc;         // write 1 to clear
+        if (errorsrc & 0x00000001) {
+            app_dbg.num_bridge_drops++;                    // overrun
+        }
+    }
+
+    if (NRF_UARTE1->EVENTS_ENDTX == 0x00000001) {
+        NRF_UARTE1->EVENTS_ENDTX       = 0x00000000;
+
+        ringbuf_release(&scum_uart_vars.tx_ring, scum_uart_vars.tx_len);
+        scum_uart_vars.tx_len          = 0;
+        _scum_uart_tx_kick();
+    }
+
+    prof_stop(PROF_ISR_UARTE1, prof);
+}
+
+void RTC1_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_RTC1_IRQHandler++;
+
+    if (NRF_RTC1->EVENTS_COMPARE[0] == 0x00000001) {
+        NRF_RTC1->EVENTS_COMPARE[0]    = 0x00000000;
+
+        // SCuM didn't answer in time, ENDRX follows
+        NRF_RTC1->TASKS_STOP           = 0x00000001;
+        NRF_UARTE1->TASKS_STOPRX       = 0x00000001;
+    }
+
+    prof_stop(PROF_ISR_RTC1, prof);
+}
@@ -0,0 +1,33 @@
+/**
+SCuM serial port, on UARTE1.
+*/
+
+#ifndef __SCUM_UART_H
+#define __SCUM_UART_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+// scum_uart_verify_result()
+#define SCUM_VERIFY_MATCH           0
+#define SCUM_VERIFY_MISMATCH        1 // at the address returned
+#define SCUM_VERIFY_NO_ANSWER       2 // no verify stub running on SCuM
+
+#define SCUM_UART_BAUDRATE_DEFAULT  19200
+
+//=========================== prototypes ======================================
+
+void     scum_uart_init(void);
+uint8_t  scum_uart_verify(const uint8_t* image, uint32_t len);
+uint8_t  scum_uart_verify_result(uint32_t* mismatch);
+uint8_t  scum_uart_is_busy(void);
+void     scum_uart_step(void);
+uint8_t  scum_uart_bridge_start(uint32_t baudrate);
+void     scum_uart_bridge_stop(void);
+uint8_t  scum_uart_bridge_is_on(void);
+uint8_t* scum_uart_rx_peek(uint32_t* len);
+void     scum_uart_rx_release(uint32_t len);
+uint32_t scum_uart_tx(const uint8_t* buf, uint32_t len);
+
+#endif
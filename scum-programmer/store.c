@@ -0,0 +1,382 @@
+/**
+SCuM image library, in the nRF52840's internal flash.
+
+STORE_NUM_SLOTS slots of one image each. The directory page is a log of
+store_entry_t, appended to without erasing: a save first frees its slot
+(an entry with len 0), then writes the image, then appends the entry that
+makes it valid. An interrupted save loses that slot only. When the log is
+full, the live entries are written to the other directory page, which is
+erased first, then a header with the next generation at its start; the
+page with the highest generation header is the directory, so the old one
+stays valid until the new one is complete. A page without a header is one
+from before the two pages, used only when neither page has a header.
+
+Images are known by length and CRC32, saving one that is already in a slot
+writes nothing. When all slots are taken, the least recently saved or
+loaded one is reused; the recency is kept in RAM, seeded from the save
+order at boot.
+
+The CPU stalls while the NVMC erases or writes, so a save is done in small
+steps from the main loop, each one rescheduling the next through
+EVT_STORE_STEP: pages are erased in 1ms partial erases, and written 1KiB
+at a time. No interrupt is served during a partial erase: the host UART's
+RXSTARTED can't re-arm its other buffer, which the ENDRX->STARTRX shortcut
+overwrites once a whole buffer more has come in, 256 bytes, 2.5ms at
+1Mbaud. 1ms is 100 bytes; tWRITE is 41us per word, interrupts are served
+between words.
+*/
+
+#include <string.h>
+#include "scum-programmer.h"
+#include "store.h"
+#include "crc.h"
+#include "trace.h"
+
+//=========================== defines =========================================
+
+#define STORE_ERASE_SLICE_MS        1    // well under HOST_UART_RX_BUF_SIZE at 1Mbaud
+#define STORE_ERASE_PAGE_MS         85   // tERASEPAGE, max
+#define STORE_WRITE_WORDS           256  // per step, ~10ms at tWRITE=41us
+
+#define STORE_STATE_IDLE            0
+#define STORE_STATE_COMPACT         1    // erasing the other directory page
+#define STORE_STATE_FREE            2    // appending the entry freeing the slot
+#define STORE_STATE_ERASE           3    // erasing the slot
+#define STORE_STATE_WRITE           4    // writing the image
+#define STORE_STATE_COMMIT          5    // appending the entry
+
+//=========================== variables =======================================
+
+typedef struct {
+    store_entry_t  dir[STORE_NUM_SLOTS]; // live entries, len 0 when free
+    uint32_t       lru[STORE_NUM_SLOTS]; // last use, in lru_clock ticks
+    uint32_t       lru_clock;
+    uint32_t       seq;             // of the last entry written
+    uint32_t       dir_addr;        // directory page in use
+    uint32_t       dir_gen;         // its generation, 0 without a header
+    uint32_t       log_next;        // offset of the first free entry in the directory page
+    // save in progress
+    uint8_t        state;
+    const uint8_t* buf;
+    store_entry_t  entry;
+    uint32_t       page;            // being erased
+    uint32_t       erase_ms;        // spent erasing it
+    uint32_t       offset;          // bytes of the image written
+    uint8_t        saved_slot;      // where the last save went
+} store_vars_t;
+
+store_vars_t store_vars;
+
+//=========================== prototypes ======================================
+
+uint32_t _store_dir_gen(uint32_t addr);
+uint8_t  _store_erase_slice(uint32_t addr);
+void     _store_append(const store_entry_t* entry);
+void     _store_write(uint32_t addr, const uint8_t* buf, uint32_t len);
+void     _store_touch(uint8_t slot);
+void     _store_done(void);
+
+//=========================== public ==========================================
+
+void store_init(void) {
+    const store_entry_t* entry;
+    const uint32_t*      words;
+    uint32_t             offset;
+    uint8_t              slot;
+    uint8_t              i;
+
+    // one partial erase per step
+    NRF_NVMC->ERASEPAGEPARTIALCFG      = STORE_ERASE_SLICE_MS;
+
+    // the directory page with the newest header
+    store_vars.dir_addr                = STORE_DIR_ADDR;
+    store_vars.dir_gen                 = _store_dir_gen(STORE_DIR_ADDR);
+    if (_store_dir_gen(STORE_DIR_ALT_ADDR)>store_vars.dir_gen) {
+        store_vars.dir_addr            = STORE_DIR_ALT_ADDR;
+        store_vars.dir_gen             = _store_dir_gen(STORE_DIR_ALT_ADDR);
+    }
+
+    // replay the directory log, up to the first erased entry
+    offset = (store_vars.dir_gen) ? sizeof(store_entry_t) : 0;
+    for (;offset+sizeof(store_entry_t)<=STORE_PAGE_SIZE;offset+=sizeof(store_entry_t)) {
+        entry = (const store_entry_t*)(uintptr_t)(store_vars.dir_addr+offset);
+        words = (const uint32_t*)entry;
+        for (i=0;i<sizeof(store_entry_t)/4;i++) {
+            if (words[i]!=0xffffffff) {
+                break;
+            }
+        }
+        if (i==sizeof(store_entry_t)/4) {
+            break;
+        }
+        if (entry->magic!=STORE_MAGIC || entry->slot>=STORE_NUM_SLOTS || entry->len>STORE_SLOT_SIZE) {
+            continue;
+        }
+        store_vars.dir[entry->slot]    = *entry;
+        if (entry->seq>store_vars.seq) {
+            store_vars.seq             = entry->seq;
+        }
+    }
+    store_vars.log_next                = offset;
+
+    // most recently saved first
+    for (slot=0;slot<STORE_NUM_SLOTS;slot++) {
+        store_vars.lru[slot]           = store_vars.dir[slot].seq;
+    }
+    store_vars.lru_clock               = store_vars.seq;
+    store_vars.saved_slot              = STORE_SLOT_NONE;
+}
+
+uint8_t store_save(const uint8_t* buf, uint32_t len) {
+    uint32_t crc;
+    uint8_t  slot;
+    uint8_t  i;
+
+    if (store_vars.state!=STORE_STATE_IDLE) {
+        return RC_BUSY;
+    }
+    if (len==0 || len>STORE_SLOT_SIZE) {
+        return RC_INVALID;
+    }
+    crc = crc32(buf, len);
+
+    // already there
+    slot = store_find(len, crc);
+    if (slot!=STORE_SLOT_NONE) {
+        _store_touch(slot);
+        store_vars.saved_slot          = slot;
+        app_dbg.num_store_dedups++;
+        events_post(EVT_STORE_DONE);
+        return RC_OK;
+    }
+
+    // a free slot, else the least recently used one
+    slot = 0;
+    for (i=0;i<STORE_NUM_SLOTS;i++) {
+        if (store_vars.dir[i].len==0) {
+            slot = i;
+            break;
+        }
+        if (store_vars.lru[i]<store_vars.lru[slot]) {
+            slot = i;
+        }
+    }
+    if (store_vars.dir[slot].len) {
+        app_dbg.num_store_evictions++;
+    }
+    store_vars.dir[slot].len           = 0;
+
+    store_vars.buf                     = buf;
+    store_vars.entry.slot              = slot;
+    store_vars.entry.len               = len;
+    store_vars.entry.crc               = crc;
+    store_vars.entry.seq               = ++store_vars.seq;
+    store_vars.entry.magic             = STORE_MAGIC;
+    store_vars.page                    = 0;
+    store_vars.erase_ms                = 0;
+    store_vars.offset                  = 0;
+
+    // room for the two entries of this save, else compact first
+    if (store_vars.log_next+2*sizeof(store_entry_t)>STORE_PAGE_SIZE) {
+        store_vars.state               = STORE_STATE_COMPACT;
+    } else {
+        store_vars.state               = STORE_STATE_FREE;
+    }
+    events_post(EVT_STORE_STEP);
+    return RC_OK;
+}
+
+uint8_t store_find(uint32_t len, uint32_t crc) {
+    uint8_t slot;
+
+    for (slot=0;slot<STORE_NUM_SLOTS;slot++) {
+        if (store_vars.dir[slot].len==len && store_vars.dir[slot].crc==crc) {
+            return slot;
+        }
+    }
+    return STORE_SLOT_NONE;
+}
+
+uint8_t store_load(uint8_t slot, uint8_t* buf, uint32_t* len, uint32_t* crc) {
+    const uint8_t* image;
+
+    if (store_vars.state!=STORE_STATE_IDLE) {
+        return RC_BUSY;
+    }
+    if (store_entry(slot)==NULL) {
+        return RC_INVALID;
+    }
+    image = (const uint8_t*)(uintptr_t)(STORE_SLOTS_ADDR+slot*STORE_SLOT_SIZE);
+    if (crc32(image, store_vars.dir[slot].len)!=store_vars.dir[slot].crc) {
+        return RC_INVALID;
+    }
+    memcpy(buf, image, store_vars.dir[slot].len);
+    *len = store_vars.dir[slot].len;
+    *crc = store_vars.dir[slot].crc;
+    _store_touch(slot);
+    app_dbg.num_store_loads++;
+    return RC_OK;
+}
+
+uint8_t store_last(void) {
+    uint8_t last;
+    uint8_t slot;
+
+    last = STORE_SLOT_NONE;
+    for (slot=0;slot<STORE_NUM_SLOTS;slot++) {
+        if (store_vars.dir[slot].len==0) {
+            continue;
+        }
+        if (last==STORE_SLOT_NONE || store_vars.lru[slot]>store_vars.lru[last]) {
+            last = slot;
+        }
+    }
+    return last;
+}
+
+uint8_t store_saved_slot(void) {
+    return store_vars.saved_slot;
+}
+
+const store_entry_t* store_entry(uint8_t slot) {
+    if (slot>=STORE_NUM_SLOTS || store_vars.dir[slot].len==0) {
+        return NULL;
+    }
+    return &store_vars.dir[slot];
+}
+
+uint8_t store_is_busy(void) {
+    return store_vars.state!=STORE_STATE_IDLE;
+}
+
+void store_step(void) {
+    store_entry_t freed;
+    store_entry_t header;
+    uint32_t      addr;
+    uint32_t      len;
+    uint8_t       slot;
+
+    trace(TRACE_EVT_STORE_STEP, store_vars.state, 0);
+    switch (store_vars.state) {
+        case STORE_STATE_COMPACT:
+            addr = (store_vars.dir_addr==STORE_DIR_ADDR) ? STORE_DIR_ALT_ADDR : STORE_DIR_ADDR;
+            if (_store_erase_slice(addr)==0) {
+                break;
+            }
+            // the live entries, the slot being saved is not one, then the
+            // header that makes the page the directory
+            store_vars.dir_addr        = addr;
+            store_vars.log_next        = sizeof(store_entry_t);
+            for (slot=0;slot<STORE_NUM_SLOTS;slot++) {
+                if (store_vars.dir[slot].len) {
+                    _store_append(&store_vars.dir[slot]);
+                }
+            }
+            memset(&header, 0, sizeof(header));
+            header.slot                = STORE_SLOT_NONE;
+            header.seq                 = ++store_vars.dir_gen;
+            header.magic               = STORE_HEADER_MAGIC;
+            _store_write(addr, (const uint8_t*)&header, sizeof(header));
+            app_dbg.num_store_compactions++;
+            store_vars.state           = STORE_STATE_ERASE;
+            break;
+        case STORE_STATE_FREE:
+            freed                      = store_vars.entry;
+            freed.len                  = 0;
+            freed.crc                  = 0;
+            _store_append(&freed);
+            store_vars.state           = STORE_STATE_ERASE;
+            break;
+        case STORE_STATE_ERASE:
+            if (_store_erase_slice(STORE_SLOTS_ADDR+store_vars.entry.slot*STORE_SLOT_SIZE+store_vars.page*STORE_PAGE_SIZE)==0) {
+                break;
+            }
+            store_vars.page++;
+            if (store_vars.page*STORE_PAGE_SIZE>=store_vars.entry.len) {
+                store_vars.state       = STORE_STATE_WRITE;
+            }
+            break;
+        case STORE_STATE_WRITE:
+            len = store_vars.entry.len-store_vars.offset;
+            if (len>STORE_WRITE_WORDS*4) {
+                len = STORE_WRITE_WORDS*4;
+            }
+            _store_write(STORE_SLOTS_ADDR+store_vars.entry.slot*STORE_SLOT_SIZE+store_vars.offset, &store_vars.buf[store_vars.offset], len);
+            store_vars.offset         += len;
+            if (store_vars.offset==store_vars.entry.len) {
+                store_vars.state       = STORE_STATE_COMMIT;
+            }
+            break;
+        case STORE_STATE_COMMIT:
+            _store_append(&store_vars.entry);
+            slot                       = store_vars.entry.slot;
+            store_vars.dir[slot]       = store_vars.entry;
+            store_vars.saved_slot      = slot;
+            _store_touch(slot);
+            _store_done();
+            return;
+        default:
+            return;
+    }
+    events_post(EVT_STORE_STEP);
+}
+
+//=========================== private =========================================
+
+uint32_t _store_dir_gen(uint32_t addr) {
+    const store_entry_t* header;
+
+    // 0 if the page has no header
+    header = (const store_entry_t*)(uintptr_t)addr;
+    if (header->magic!=STORE_HEADER_MAGIC || header->slot!=STORE_SLOT_NONE) {
+        return 0;
+    }
+    return header->seq;
+}
+
+uint8_t _store_erase_slice(uint32_t addr) {
+
+    NRF_NVMC->CONFIG                   = 0x00000002;       // 2==erase enabled
+    NRF_NVMC->ERASEPAGEPARTIAL         = addr;
+    while (NRF_NVMC->READY==0);
+    NRF_NVMC->CONFIG                   = 0x00000000;       // 0==read only
+    app_dbg.num_store_erase_slices++;
+
+    // returns 1 once the page is fully erased
+    store_vars.erase_ms               += STORE_ERASE_SLICE_MS;
+    if (store_vars.erase_ms<STORE_ERASE_PAGE_MS) {
+        return 0;
+    }
+    store_vars.erase_ms                = 0;
+    return 1;
+}
+
+void _store_append(const store_entry_t* entry) {
+    _store_write(store_vars.dir_addr+store_vars.log_next, (const uint8_t*)entry, sizeof(store_entry_t));
+    store_vars.log_next               += sizeof(store_entry_t);
+}
+
+void _store_write(uint32_t addr, const uint8_t* buf, uint32_t len) {
+    uint32_t word;
+    uint32_t i;
+
+    NRF_NVMC->CONFIG                   = 0x00000001;       // 1==write enabled
+    for (i=0;i<len;i+=4) {
+        // the last word may be partial, the rest of it stays erased
+        word                           = 0xffffffff;
+        memcpy(&word, &buf[i], (len-i<4) ? len-i : 4);
+        *(volatile uint32_t*)(uintptr_t)(addr+i) = word;
+        while (NRF_NVMC->READY==0);
+    }
+    NRF_NVMC->CONFIG                   = 0x00000000;       // 0==read only
+}
+
+void _store_touch(uint8_t slot) {
+    store_vars.lru[slot]               = ++store_vars.lru_clock;
+}
+
+void _store_done(void) {
+    store_vars.state                   = STORE_STATE_IDLE;
+    app_dbg.num_store_saves++;
+    events_post(EVT_STORE_DONE);
+}
@@ -0,0 +1,49 @@
+/**
+SCuM image library, in the nRF52840's internal flash.
+*/
+
+#ifndef __STORE_H
+#define __STORE_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+// flash layout, kept out of the FLASH region by ses_nrf52840_xxaa.icf
+#define STORE_PAGE_SIZE             4096
+#define STORE_DIR_ADDR              0x0007F000 // log of store_entry_t, the first one
+#define STORE_DIR_ALT_ADDR          0x0007E000 // the other one, compaction switches between them
+#define STORE_SLOTS_ADDR            0x00080000 // slots, up to the end of flash
+#define STORE_SLOT_SIZE             0x00010000 // SCUM_IMAGE_SIZE
+#define STORE_NUM_SLOTS             8
+
+#define STORE_MAGIC                 0x4d754353 // "SCuM"
+#define STORE_HEADER_MAGIC          0x44754353 // "SCuD", directory page header
+#define STORE_SLOT_NONE             0xff
+
+//=========================== typedef =========================================
+
+// directory entry, the last one written for a slot wins, len 0 frees it
+// a page written by compaction starts with a header, STORE_HEADER_MAGIC and
+// the page's generation in seq
+typedef struct {
+    uint32_t       slot;
+    uint32_t       len;
+    uint32_t       crc;             // CRC32 of the image, with len its identity
+    uint32_t       seq;             // bumped by each save
+    uint32_t       magic;           // written last, a torn entry doesn't count
+} store_entry_t;
+
+//=========================== prototypes ======================================
+
+void    store_init(void);
+uint8_t store_save(const uint8_t* buf, uint32_t len);
+uint8_t store_find(uint32_t len, uint32_t crc);
+uint8_t store_load(uint8_t slot, uint8_t* buf, uint32_t* len, uint32_t* crc);
+uint8_t store_last(void);
+uint8_t store_saved_slot(void);
+const store_entry_t* store_entry(uint8_t slot);
+uint8_t store_is_busy(void);
+void    store_step(void);
+
+#endif
@@ -0,0 +1,685 @@
+/**
+SCuM 3-wire bus (3WB) loader.
+
+EN frames the whole image, CLK and DATA are driven in one of two modes.
+
+THREEWB_MODE_PWM: CLK and DATA are channels 0 and 2 of PWM0, which plays a
+sequence from RAM through EasyDMA, one pair of 16-bit values per bit
+period (DECODER grouped): CLK low for the first half of the period, high
+for the second, SCuM samples DATA on that rising edge; DATA constant over
+the period. DATA changes with the falling edge of CLK, setup and hold are
+both half a bit period, whatever the interrupt latency. The two sequences
+are double buffers of THREEWB_PWM_BITS bits, played one after the other
+(LOOP, and LOOPSDONE restarts sequence 0):
+- SEQEND[n] (sequence n's last value loaded) refills sequence n while the
+  other one plays, THREEWB_PWM_BITS bits per interrupt
+- the refill holding the last bit sets the SEQEND[n]->STOP shortcut, the
+  next one if the last bit fills its sequence, so PWM0 stops with CLK
+  low; STOPPED ends the load
+Where the image isn't there yet, a refill puts CLK low periods instead,
+the bus pauses until threewb_feed() makes more available.
+
+THREEWB_MODE_SPIM: CLK and DATA are SPIM3's SCK and MOSI (mode 0, MSB first),
+the image is read straight from RAM by EasyDMA, THREEWB_SPIM_CHUNK bytes per
+transaction. TXD uses the EasyDMA ArrayList, so TXD.PTR advances by itself
+after each chunk, and the chunks are chained in hardware:
+- PPI_CH_3WB_SPIM_CHAIN:  SPIM3 END -> SPIM3 START, in PPI_CHG_3WB_SPIM
+- PPI_CH_3WB_SPIM_COUNT:  SPIM3 END -> TIMER3 COUNT
+- PPI_CH_3WB_SPIM_LAST:   TIMER3 COMPARE[0] (n-1 chunks) -> PPI_CHG_3WB_SPIM disable
+TIMER3 COMPARE[1] (n chunks) is the only interrupt, it sends the remainder
+of the image, if any, as one last transaction. The clock pauses between
+chunks, which a synchronous bus doesn't mind, EN stays asserted throughout.
+
+A load may start before the whole image is in: threewb_load_stream() takes
+how much of it is there, threewb_feed() says when more arrives. In SPIM
+mode, a streamed load is sent one transaction per END interrupt, each as
+long as the data allows, up to THREEWB_SPIM_CHUNK, and stops when it
+catches up with the data, until threewb_feed() restarts it.
+
+Every SPIM3 load sets the anomaly 198 workaround, which gives SPIM3
+priority on the RAM blocks it reads from: any CPU access to the same 8kB
+AHB block can corrupt what EasyDMA reads, to .bss or the stack next to
+.scum_image as much as to the image being written during a streamed load.
+
+A streamed load left stalled for THREEWB_STALL_TIMEOUT, or given up with
+threewb_abort(), drops EN and frees the bus, threewb_result() then says
+RC_INVALID.
+*/
+
+#include "scum-programmer.h"
+#include "threewb.h"
+#include "prof.h"
+#include "trace.h"
+
+//=========================== defines =========================================
+
+#define HRESET_PULSE_TICKS          (16*100)    // 100us
+#define THREEWB_SPIM_CHUNK          0x1000      // TXD.MAXCNT is 16-bit
+#define THREEWB_PWM_BITS            256         // per sequence, 1KiB each
+
+// PWM0 sequence values, bit 15 set: low until the compare value, then high
+#define THREEWB_PWM_RISING          0x8000
+#define THREEWB_PWM_NEVER           0x7fff      // compare value above COUNTERTOP
+#define THREEWB_PWM_LOW             (THREEWB_PWM_RISING | THREEWB_PWM_NEVER)
+#define THREEWB_PWM_HIGH            THREEWB_PWM_NEVER
+
+//=========================== variables =======================================
+
+typedef struct {
+    uint32_t ns;                    // shortest bit period of this setting
+    uint32_t frequency;             // SPIM FREQUENCY register value
+    uint32_t bps;
+} threewb_spim_freq_t;
+
+const threewb_spim_freq_t threewb_spim_freqs[] = {
+    {   31, 0x14000000, 32000000 },
+    {   62, 0x0A000000, 16000000 },
+    {  125, 0x80000000,  8000000 },
+    {  250, 0x40000000,  4000000 },
+    {  500, 0x20000000,  2000000 },
+    { 1000, 0x10000000,  1000000 },
+    { 2000, 0x08000000,   500000 },
+    { 4000, 0x04000000,   250000 },
+    { 8000, 0x02000000,   125000 },
+};
+
+typedef struct {
+    uint8_t        mode;            // THREEWB_MODE_*
+    uint32_t       bit_period;      // in ns
+    const uint8_t* buf;
+    uint32_t       len;
+    uint32_t       idx;             // PWM: byte being queued, SPIM: bytes handed to EasyDMA
+    uint8_t        mask;            // PWM: bit being queued, MSB first
+    uint8_t        busy;
+    uint8_t        result;          // of the last load, RC_INVALID if abandoned
+    volatile uint32_t avail;        // bytes of the image ready to be sent
+    uint8_t        stalled;         // waiting for threewb_feed()
+    uint32_t       ts_stall;
+    uint32_t       ts_start;
+    uint32_t       spim_bps;        // SPIM: bit rate of the current load
+    uint32_t       spim_num_chunks; // SPIM: transactions in the current load
+    uint16_t       pwm_clk;         // PWM: CLK value of a bit period, rising half-way
+    uint16_t       pwm_seq[2][2*THREEWB_PWM_BITS]; // PWM: [CLK][DATA] per bit period
+} threewb_vars_t;
+
+threewb_vars_t threewb_vars;
+
+//=========================== prototypes ======================================
+
+void _threewb_pwm_start(void);
+void _threewb_pwm_fill(uint8_t seq);
+void _threewb_spim_start(void);
+void _threewb_spim_remainder(void);
+void _threewb_spim_stream(void);
+void _threewb_spim_anomaly_198(const uint8_t* buf, uint32_t len);
+void _threewb_stall(void);
+void _threewb_spim_stats(uint32_t duration);
+void _threewb_release(void);
+void _threewb_done(void);
+
+//=========================== public ==========================================
+
+void threewb_init(void) {
+
+    threewb_vars.mode                  = THREEWB_MODE_PWM;
+    threewb_vars.bit_period            = THREEWB_BIT_PERIOD_DEFAULT;
+
+    // pins, all outputs, SCuM out of reset, 3WB idle
+    // CLK and DATA use high drive, SPIM3 runs them up to 32MHz
+    NRF_P0->OUTSET                     = (0x00000001 << PIN_SCUM_HRESET);
+    NRF_P0->OUTCLR                     = (0x00000001 << PIN_3WB_CLK) |
+                                         (0x00000001 << PIN_3WB_DATA) |
+                                         (0x00000001 << PIN_3WB_EN);
+    NRF_P0->PIN_CNF[PIN_SCUM_HRESET]   = 0x00000003;       // output, input buffer disconnected
+    NRF_P0->PIN_CNF[PIN_3WB_CLK]       = 0x00000303;       // output, input buffer disconnected, H0H1
+    NRF_P0->PIN_CNF[PIN_3WB_DATA]      = 0x00000303;
+    NRF_P0->PIN_CNF[PIN_3WB_EN]        = 0x00000003;
+
+    // PWM0, up counter, [CLK][DATA] value pairs, one per period
+    // it is only connected to CLK/DATA during a load, as SPIM3 below
+    NRF_PWM0->MODE                     = 0x00000000;       // 0==up
+    NRF_PWM0->DECODER                  = 0x00000001;       // grouped, refresh count
+    NRF_PWM0->SEQ[0].PTR               = (uint32_t)(uintptr_t)threewb_vars.pwm_seq[0];
+    NRF_PWM0->SEQ[0].CNT               = 2*THREEWB_PWM_BITS;
+    NRF_PWM0->SEQ[0].REFRESH           = 0;
+    NRF_PWM0->SEQ[0].ENDDELAY          = 0;
+    NRF_PWM0->SEQ[1].PTR               = (uint32_t)(uintptr_t)threewb_vars.pwm_seq[1];
+    NRF_PWM0->SEQ[1].CNT               = 2*THREEWB_PWM_BITS;
+    NRF_PWM0->SEQ[1].REFRESH           = 0;
+    NRF_PWM0->SEQ[1].ENDDELAY          = 0;
+    NRF_PWM0->LOOP                     = 0x0000ffff;
+    NRF_PWM0->PSEL.OUT[0]              = 0xffffffff;       // CLK, while loading
+    NRF_PWM0->PSEL.OUT[1]              = 0xffffffff;
+    NRF_PWM0->PSEL.OUT[2]              = 0xffffffff;       // DATA, while loading
+    NRF_PWM0->PSEL.OUT[3]              = 0xffffffff;
+    // 1098 7654 3210 9876 5432 1098 7654 3210
+    // xxxx xxxx xxxx xxxx xxxx xxxx xxBA xxSx (B=SEQEND1, A=SEQEND0, S=STOPPED)
+    // 0000 0000 0000 0000 0000 0000 0011 0010
+    //    0    0    0    0    0    0    3    2 0x00000032
+    NRF_PWM0->INTENSET                 = 0x00000032;
+
+    // SPIM3, mode 0, MSB first, transmit only
+    // it is only enabled during a load, so it doesn't hold on to CLK/DATA
+    NRF_SPIM3->PSEL.SCK                = PIN_3WB_CLK;
+    NRF_SPIM3->PSEL.MOSI               = PIN_3WB_DATA;
+    NRF_SPIM3->PSEL.MISO               = 0xffffffff;       // disconnected
+    NRF_SPIM3->PSEL.CSN                = 0xffffffff;       // disconnected, EN is driven by hand
+    NRF_SPIM3->CONFIG                  = 0x00000000;       // MSB first, CPHA leading, CPOL active high
+    NRF_SPIM3->ORC                     = 0x00;
+    NRF_SPIM3->RXD.MAXCNT              = 0;
+    NRF_SPIM3->TXD.LIST                = 0x00000001;       // 1==ArrayList
+
+    // TIMER3 counts the chunks sent
+    NRF_TIMER3->MODE                   = 0x00000002;       // 2==low power counter
+    NRF_TIMER3->BITMODE                = 0x00000000;       // 0==16-bit
+    NRF_TIMER3->INTENSET               = 0x00020000;       // COMPARE1
+
+    // PPI, chain the chunks, stop chaining before the last one
+    NRF_PPI->CH[PPI_CH_3WB_SPIM_CHAIN].EEP = (uint32_t)(uintptr_t)&NRF_SPIM3->EVENTS_END;
+    NRF_PPI->CH[PPI_CH_3WB_SPIM_CHAIN].TEP = (uint32_t)(uintptr_t)&NRF_SPIM3->TASKS_START;
+    NRF_PPI->CH[PPI_CH_3WB_SPIM_COUNT].EEP = (uint32_t)(uintptr_t)&NRF_SPIM3->EVENTS_END;
+    NRF_PPI->CH[PPI_CH_3WB_SPIM_COUNT].TEP = (uint32_t)(uintptr_t)&NRF_TIMER3->TASKS_COUNT;
+    NRF_PPI->CH[PPI_CH_3WB_SPIM_LAST].EEP  = (uint32_t)(uintptr_t)&NRF_TIMER3->EVENTS_COMPARE[0];
+    NRF_PPI->CH[PPI_CH_3WB_SPIM_LAST].TEP  = (uint32_t)(uintptr_t)&NRF_PPI->TASKS_CHG[PPI_CHG_3WB_SPIM].DIS;
+    NRF_PPI->CHG[PPI_CHG_3WB_SPIM]     = (0x00000001 << PPI_CH_3WB_SPIM_CHAIN);
+    NRF_PPI->CHENSET                   = (0x00000001 << PPI_CH_3WB_SPIM_COUNT) |
+                                         (0x00000001 << PPI_CH_3WB_SPIM_LAST);
+
+    // enable interrupts
+    NVIC_SetPriority(PWM0_IRQn, IRQ_PRIO_3WB);
+    NVIC_ClearPendingIRQ(PWM0_IRQn);
+    NVIC_EnableIRQ(PWM0_IRQn);
+    NVIC_SetPriority(SPIM3_IRQn, IRQ_PRIO_3WB);
+    NVIC_ClearPendingIRQ(SPIM3_IRQn);
+    NVIC_EnableIRQ(SPIM3_IRQn);
+    NVIC_SetPriority(TIMER3_IRQn, IRQ_PRIO_3WB);
+    NVIC_ClearPendingIRQ(TIMER3_IRQn);
+    NVIC_EnableIRQ(TIMER3_IRQn);
+}
+
+uint8_t threewb_set_mode(uint8_t mode) {
+
+    if (threewb_vars.busy) {
+        return RC_BUSY;
+    }
+    switch (mode) {
+        case THREEWB_MODE_PWM:
+            if (threewb_vars.bit_period<THREEWB_PWM_PERIOD_MIN) {
+                threewb_vars.bit_period = THREEWB_PWM_PERIOD_MIN;
+            }
+            break;
+        case THREEWB_MODE_SPIM:
+            if (threewb_vars.bit_period>THREEWB_SPIM_PERIOD_MAX) {
+                threewb_vars.bit_period = THREEWB_SPIM_PERIOD_MAX;
+            }
+            break;
+        default:
+            return RC_INVALID;
+    }
+    threewb_vars.mode                  = mode;
+    return RC_OK;
+}
+
+uint8_t threewb_set_bit_period(uint32_t ns) {
+
+    if (threewb_vars.busy) {
+        return RC_BUSY;
+    }
+    if (threewb_vars.mode==THREEWB_MODE_PWM) {
+        if (ns<THREEWB_PWM_PERIOD_MIN || ns>THREEWB_PWM_PERIOD_MAX) {
+            return RC_INVALID;
+        }
+    } else {
+        if (ns<THREEWB_SPIM_PERIOD_MIN || ns>THREEWB_SPIM_PERIOD_MAX) {
+            return RC_INVALID;
+        }
+    }
+    threewb_vars.bit_period            = ns;
+    return RC_OK;
+}
+
+uint8_t threewb_load(const uint8_t* buf, uint32_t len) {
+    return threewb_load_stream(buf, len, len);
+}
+
+uint8_t threewb_load_stream(const uint8_t* buf, uint32_t len, uint32_t avail) {
+    uint32_t ts;
+
+    if (threewb_vars.busy) {
+        return RC_BUSY;
+    }
+    if (len==0 || avail>len) {
+        return RC_INVALID;
+    }
+    threewb_vars.buf                   = buf;
+    threewb_vars.len                   = len;
+    threewb_vars.avail                 = avail;
+    threewb_vars.idx                   = 0;
+    threewb_vars.mask                  = 0x80;
+    threewb_vars.stalled               = 0;
+    threewb_vars.busy                  = 1;
+    threewb_vars.result                = RC_OK;
+    trace(TRACE_EVT_3WB_START, threewb_vars.mode, len/256);
+
+    // hard reset SCuM, it comes back up in its bootloader
+    NRF_P0->OUTCLR                     = (0x00000001 << PIN_SCUM_HRESET);
+    ts = timestamp_get();
+    while (timestamp_get()-ts < HRESET_PULSE_TICKS);
+    NRF_P0->OUTSET                     = (0x00000001 << PIN_SCUM_HRESET);
+    app_bench.reset_ticks              = timestamp_get()-ts;
+
+    // frame the image with EN
+    NRF_P0->OUTSET                     = (0x00000001 << PIN_3WB_EN);
+    threewb_vars.ts_start              = timestamp_get();
+
+    // debug
+    app_dbg.num_3wb_loads++;
+    app_dbg.threewb_stall_ticks        = 0;
+
+    if (threewb_vars.mode==THREEWB_MODE_PWM) {
+        // pauses by itself while there is nothing to send
+        _threewb_pwm_start();
+        return RC_OK;
+    }
+    if (avail==0) {
+        // nothing to send yet, threewb_feed() starts the clock
+        threewb_vars.stalled           = 1;
+        threewb_vars.ts_stall          = threewb_vars.ts_start;
+    }
+    _threewb_spim_start();
+
+    return RC_OK;
+}
+
+void threewb_feed(uint32_t avail) {
+    uint32_t primask;
+
+    if (threewb_vars.busy==0 || avail<=threewb_vars.avail) {
+        return;
+    }
+
+    // the 3WB interrupt may be stalling right now, let it finish
+    // in PWM mode, the next refill picks the new data up
+    primask = __get_PRIMASK();
+    __disable_irq();
+    threewb_vars.avail                 = avail;
+    if (threewb_vars.stalled) {
+        threewb_vars.stalled           = 0;
+        app_dbg.threewb_stall_ticks   += timestamp_get()-threewb_vars.ts_stall;
+        trace(TRACE_EVT_3WB_RESUME, 0, avail/256);
+        if (threewb_vars.mode==THREEWB_MODE_SPIM) {
+            _threewb_spim_stream();
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+uint8_t threewb_abort(void) {
+    uint32_t primask;
+    uint8_t  rc;
+
+    // only a stalled load; in PWM mode, up to two sequences of bits may
+    // still be playing before the idle periods, PWM0 is stopped at the end
+    // of the current period before EN drops, so SCuM never sees a cut CLK
+    // pulse; its interrupt is off meanwhile, that STOPPED is not the end
+    // of the load
+    primask = __get_PRIMASK();
+    __disable_irq();
+    rc = RC_INVALID;
+    if (threewb_vars.busy && threewb_vars.stalled) {
+        threewb_vars.result            = RC_INVALID;
+        app_dbg.num_3wb_aborts++;
+        rc = RC_OK;
+        if (threewb_vars.mode==THREEWB_MODE_PWM) {
+            NRF_PWM0->INTENCLR         = 0x00000032;       // SEQEND1, SEQEND0, STOPPED
+            NVIC_ClearPendingIRQ(PWM0_IRQn);
+            NRF_PWM0->TASKS_STOP       = 0x00000001;
+        }
+    }
+    __set_PRIMASK(primask);
+    if (rc!=RC_OK) {
+        return rc;
+    }
+
+    // at most THREEWB_PWM_PERIOD_MAX, interrupts enabled meanwhile
+    if (threewb_vars.mode==THREEWB_MODE_PWM) {
+        while (NRF_PWM0->EVENTS_STOPPED==0);
+    }
+    _threewb_release();
+    if (threewb_vars.mode==THREEWB_MODE_PWM) {
+        NRF_PWM0->INTENSET             = 0x00000032;       // SEQEND1, SEQEND0, STOPPED
+    }
+
+    return rc;
+}
+
+void threewb_tick(void) {
+
+    // the image stopped coming, give EN and the bus back
+    if (threewb_vars.busy && threewb_vars.stalled &&
+        timestamp_get()-threewb_vars.ts_stall>=THREEWB_STALL_TIMEOUT &&
+        threewb_abort()==RC_OK) {
+        events_post(EVT_3WB_DONE);
+    }
+}
+
+uint8_t threewb_is_busy(void) {
+    return threewb_vars.busy;
+}
+
+uint8_t threewb_result(void) {
+    return threewb_vars.result;
+}
+
+//=========================== private =========================================
+
+//=== pwm
+
+void _threewb_pwm_start(void) {
+    uint32_t ticks;
+    uint8_t  prescaler;
+
+    // COUNTERTOP is 15-bit, and must stay below THREEWB_PWM_NEVER
+    ticks                              = (threewb_vars.bit_period*16)/1000;
+    prescaler                          = 0;
+    while ((ticks>>prescaler)>=THREEWB_PWM_NEVER) {
+        prescaler++;
+    }
+    NRF_PWM0->PRESCALER                = prescaler;        // 16MHz/2^prescaler
+    NRF_PWM0->COUNTERTOP               = ticks>>prescaler;
+    threewb_vars.pwm_clk               = THREEWB_PWM_RISING | ((ticks>>prescaler)/2);
+
+    // both sequences ready before the first one starts
+    NRF_PWM0->SHORTS                   = 0x00000004;       // LOOPSDONE_SEQSTART0
+    _threewb_pwm_fill(0);
+    _threewb_pwm_fill(1);
+
+    // PWM0 takes over CLK and DATA
+    NRF_PWM0->EVENTS_SEQEND[0]         = 0x00000000;
+    NRF_PWM0->EVENTS_SEQEND[1]         = 0x00000000;
+    NRF_PWM0->EVENTS_STOPPED           = 0x00000000;
+    NRF_PWM0->PSEL.OUT[0]              = PIN_3WB_CLK;
+    NRF_PWM0->PSEL.OUT[2]              = PIN_3WB_DATA;
+    NRF_PWM0->ENABLE                   = 0x00000001;
+    NRF_PWM0->TASKS_SEQSTART[0]        = 0x00000001;
+}
+
+void _threewb_pwm_fill(uint8_t seq) {
+    uint16_t* out;
+    uint32_t  avail;
+    uint16_t  i;
+
+    // as many bits as are available, MSB first
+    out   = threewb_vars.pwm_seq[seq];
+    avail = threewb_vars.avail;
+    for (i=0;i<THREEWB_PWM_BITS && threewb_vars.idx<avail;i++) {
+        out[2*i]                       = threewb_vars.pwm_clk;
+        out[2*i+1]                     = (threewb_vars.buf[threewb_vars.idx] & threewb_vars.mask) ?
+                                         THREEWB_PWM_HIGH : THREEWB_PWM_LOW;
+        threewb_vars.mask            >>= 1;
+        if (threewb_vars.mask==0) {
+            threewb_vars.mask          = 0x80;
+            threewb_vars.idx++;
+        }
+    }
+    if (i<THREEWB_PWM_BITS && threewb_vars.idx==threewb_vars.len) {
+        // the last bit is in, and CLK is low at the end of this sequence,
+        // stop once it has played; PWM0 stops with the level of its last
+        // period, which picks up again at the next load's ENABLE
+        NRF_PWM0->SHORTS              |= (0x00000001 << seq); // SEQENDn_STOP
+    } else if (threewb_vars.idx<threewb_vars.len && threewb_vars.idx==avail && threewb_vars.stalled==0) {
+        // caught up with the data
+        _threewb_stall();
+    }
+
+    // CLK stays low for the rest, the bus pauses
+    for (;i<THREEWB_PWM_BITS;i++) {
+        out[2*i]                       = THREEWB_PWM_LOW;
+        out[2*i+1]                     = THREEWB_PWM_LOW;
+    }
+}
+
+//=== spim
+
+void _threewb_spim_start(void) {
+    uint32_t num_chunks;
+    uint8_t  i;
+
+    // fastest setting not exceeding the requested bit rate
+    i = 0;
+    while (i<sizeof(threewb_spim_freqs)/sizeof(threewb_spim_freqs[0])-1 &&
+           threewb_spim_freqs[i].ns<threewb_vars.bit_period) {
+        i++;
+    }
+    NRF_SPIM3->FREQUENCY               = threewb_spim_freqs[i].frequency;
+    threewb_vars.spim_bps              = threewb_spim_freqs[i].bps;
+
+    // SPIM3 takes over CLK and DATA
+    // anomaly 198: EasyDMA reads of SPIM3 are corrupted by CPU accesses to
+    // the same RAM AHB block, whatever the CPU touches there, the chained
+    // transactions as much as the streamed ones
+    _threewb_spim_anomaly_198(threewb_vars.buf, threewb_vars.len);
+    NRF_SPIM3->ENABLE                  = 0x00000007;       // 7==SPIM
+    NRF_SPIM3->TXD.PTR                 = (uint32_t)(uintptr_t)threewb_vars.buf;
+
+    if (threewb_vars.avail<threewb_vars.len) {
+        // streamed, one transaction per END interrupt
+        threewb_vars.spim_num_chunks   = 0;
+        NRF_SPIM3->EVENTS_END          = 0x00000000;
+        NRF_SPIM3->INTENSET            = 0x00000040;       // END
+        if (threewb_vars.stalled==0) {
+            _threewb_spim_stream();
+        }
+        return;
+    }
+
+    num_chunks                         = threewb_vars.len/THREEWB_SPIM_CHUNK;
+    threewb_vars.spim_num_chunks       = num_chunks;
+    if (threewb_vars.len%THREEWB_SPIM_CHUNK) {
+        threewb_vars.spim_num_chunks++;
+    }
+    if (num_chunks==0) {
+        // shorter than a chunk, only the remainder is sent
+        _threewb_spim_remainder();
+    } else {
+        // full chunks, chained in hardware
+        threewb_vars.idx               = num_chunks*THREEWB_SPIM_CHUNK;
+        NRF_SPIM3->TXD.MAXCNT          = THREEWB_SPIM_CHUNK;
+        NRF_TIMER3->CC[0]              = num_chunks-1;
+        NRF_TIMER3->CC[1]              = num_chunks;
+        NRF_TIMER3->TASKS_CLEAR        = 0x00000001;
+        NRF_TIMER3->TASKS_START        = 0x00000001;
+        if (num_chunks>1) {
+            NRF_PPI->TASKS_CHG[PPI_CHG_3WB_SPIM].EN = 0x00000001;
+        }
+        NRF_SPIM3->TASKS_START         = 0x00000001;
+    }
+}
+
+void _threewb_spim_remainder(void) {
+
+    // TXD.PTR has already moved past the full chunks
+    NRF_SPIM3->TXD.MAXCNT              = threewb_vars.len-threewb_vars.idx;
+    threewb_vars.idx                   = threewb_vars.len;
+    NRF_SPIM3->EVENTS_END              = 0x00000000;
+    NRF_SPIM3->INTENSET                = 0x00000040;       // END
+    NRF_SPIM3->TASKS_START             = 0x00000001;
+}
+
+void _threewb_spim_stream(void) {
+    uint32_t len;
+
+    // as much as is there, the SPIM3 END interrupt comes back for more
+    len = threewb_vars.avail-threewb_vars.idx;
+    if (len>THREEWB_SPIM_CHUNK) {
+        len = THREEWB_SPIM_CHUNK;
+    }
+    NRF_SPIM3->TXD.PTR                 = (uint32_t)(uintptr_t)&threewb_vars.buf[threewb_vars.idx];
+    NRF_SPIM3->TXD.MAXCNT              = len;
+    threewb_vars.idx                  += len;
+    threewb_vars.spim_num_chunks++;
+    NRF_SPIM3->TASKS_START             = 0x00000001;
+}
+
+void _threewb_spim_anomaly_198(const uint8_t* buf, uint32_t len) {
+    uint32_t block;
+    uint32_t blocks;
+
+    // give SPIM3 priority on the 8kB RAM blocks holding buf, the blocks
+    // above 0x20010000 are one
+    blocks = 0;
+    for (block=(uint32_t)(uintptr_t)buf & ~0x1fff;block<(uint32_t)(uintptr_t)buf+len;block+=0x2000) {
+        if (block>=0x20010000) {
+            blocks |= (0x00000001 << 8);
+            break;
+        }
+        blocks |= (0x00000001 << ((block>>13) & 0x7));
+    }
+    *(volatile uint32_t *)(uintptr_t)0x40000E00 = blocks;
+}
+
+void _threewb_stall(void) {
+    threewb_vars.stalled               = 1;
+    threewb_vars.ts_stall              = timestamp_get();
+    app_dbg.num_3wb_stalls++;
+    trace(TRACE_EVT_3WB_STALL, 0, threewb_vars.idx/256);
+}
+
+void _threewb_spim_stats(uint32_t duration) {
+    uint32_t transfer;
+    uint32_t gaps;
+
+    // time the bits take on the wire, the rest is spent starting transactions
+    transfer = (uint32_t)(((uint64_t)threewb_vars.len*8*16000000)/threewb_vars.spim_bps);
+    gaps     = (duration>transfer) ? duration-transfer : 0;
+    app_dbg.threewb_spim_chunks        = threewb_vars.spim_num_chunks;
+    app_dbg.threewb_spim_gap_ns        = (uint32_t)(((uint64_t)gaps*1000/16)/threewb_vars.spim_num_chunks);
+}
+
+//=== common
+
+void _threewb_release(void) {
+    uint32_t duration;
+
+    // hand CLK and DATA back to GPIO, both low
+    if (threewb_vars.mode==THREEWB_MODE_PWM) {
+        NRF_PWM0->ENABLE               = 0x00000000;
+        NRF_PWM0->EVENTS_SEQEND[0]     = 0x00000000;
+        NRF_PWM0->EVENTS_SEQEND[1]     = 0x00000000;
+        NRF_PWM0->EVENTS_STOPPED       = 0x00000000;
+        NRF_PWM0->PSEL.OUT[0]          = 0xffffffff;
+        NRF_PWM0->PSEL.OUT[2]          = 0xffffffff;
+    } else {
+        NRF_TIMER3->TASKS_STOP         = 0x00000001;
+        NRF_SPIM3->INTENCLR            = 0x00000040;       // END
+        NRF_SPIM3->ENABLE              = 0x00000000;
+        *(volatile uint32_t *)(uintptr_t)0x4002F004 = 1; // anomaly 195, SPIM3 current after disable
+        *(volatile uint32_t *)(uintptr_t)0x40000E00 = 0; // anomaly 198, workaround off
+    }
+
+    // release the bus, SCuM boots the loaded image
+    NRF_P0->OUTCLR                     = (0x00000001 << PIN_3WB_CLK) |
+                                         (0x00000001 << PIN_3WB_DATA) |
+                                         (0x00000001 << PIN_3WB_EN);
+    threewb_vars.busy                  = 0;
+    trace(TRACE_EVT_3WB_DONE, 0, threewb_vars.len/256);
+
+    // debug
+    duration                           = timestamp_get()-threewb_vars.ts_start;
+    app_bench.threewb_ticks            = duration;
+    app_bench.threewb_stall_ticks      = app_dbg.threewb_stall_ticks;
+    if (duration) {
+        app_dbg.threewb_bps            = (uint32_t)(((uint64_t)threewb_vars.len*8*16000000)/duration);
+    }
+    if (threewb_vars.mode==THREEWB_MODE_SPIM && threewb_vars.spim_num_chunks) {
+        _threewb_spim_stats(duration);
+    }
+}
+
+void _threewb_done(void) {
+    _threewb_release();
+    events_post(EVT_3WB_DONE);
+}
+
+//=========================== interrupt handlers ==============================
+
+void PWM0_IRQHandler(void) {
+    uint32_t prof;
+    uint8_t  seq;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_PWM0_IRQHandler++;
+
+    // sequence seq is done with its RAM, the other one plays meanwhile
+    for (seq=0;seq<2;seq++) {
+        if (NRF_PWM0->EVENTS_SEQEND[seq] == 0x00000001) {
+            NRF_PWM0->EVENTS_SEQEND[seq] = 0x00000000;
+            _threewb_pwm_fill(seq);
+            // the other one ended before the refill did, the refill was
+            // late and PWM0 may have played part of the old sequence
+            if (NRF_PWM0->EVENTS_SEQEND[seq^1] == 0x00000001 && (NRF_PWM0->SHORTS & (0x00000001 << (seq^1)))==0) {
+                app_dbg.num_3wb_late_refills++;
+            }
+        }
+    }
+
+    // the last bit has played
+    if (NRF_PWM0->EVENTS_STOPPED == 0x00000001) {
+        NRF_PWM0->EVENTS_STOPPED       = 0x00000000;
+        _threewb_done();
+    }
+
+    prof_stop(PROF_ISR_PWM0, prof);
+}
+
+void SPIM3_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_SPIM3_IRQHandler++;
+
+    if (NRF_SPIM3->EVENTS_END == 0x00000001) {
+
+        // clear flag
+        NRF_SPIM3->EVENTS_END          = 0x00000000;
+
+        // only enabled for the last transaction, or for all of a streamed load
+        if (threewb_vars.idx==threewb_vars.len) {
+            _threewb_done();
+        } else if (threewb_vars.idx<threewb_vars.avail) {
+            _threewb_spim_stream();
+        } else {
+            _threewb_stall();
+        }
+    }
+
+    prof_stop(PROF_ISR_SPIM3, prof);
+}
+
+void TIMER3_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_TIMER3_IRQHandler++;
+
+    if (NRF_TIMER3->EVENTS_COMPARE[1] == 0x00000001) {
+
+        // clear flag
+        NRF_TIMER3->EVENTS_COMPARE[1]  = 0x00000000;
+
+        // all full chunks sent
+        if (threewb_vars.idx==threewb_vars.len) {
+            _threewb_done();
+        } else {
+            _threewb_spim_remainder();
+        }
+    }
+
+    prof_stop(PROF_ISR_TIMER3, prof);
+}
@@ -0,0 +1,39 @@
+/**
+SCuM 3-wire bus (3WB) loader.
+*/
+
+#ifndef __THREEWB_H
+#define __THREEWB_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+// how the 3WB is clocked
+#define THREEWB_MODE_PWM            0 // PWM0, CLK and DATA played from RAM by EasyDMA
+#define THREEWB_MODE_SPIM           1 // SPIM3, streamed from RAM by EasyDMA
+
+// bit period, in ns
+#define THREEWB_BIT_PERIOD_DEFAULT  4000 // 250kbit/s
+#define THREEWB_PWM_PERIOD_MIN      500  // 2Mbit/s
+#define THREEWB_PWM_PERIOD_MAX      4095000
+#define THREEWB_SPIM_PERIOD_MIN     31   // 32Mbit/s
+#define THREEWB_SPIM_PERIOD_MAX     8000 // 125kbit/s
+
+// a streamed load waiting this long for the image is abandoned, 16MHz ticks
+#define THREEWB_STALL_TIMEOUT       (2*16000000)
+
+//=========================== prototypes ======================================
+
+void    threewb_init(void);
+uint8_t threewb_set_mode(uint8_t mode);
+uint8_t threewb_set_bit_period(uint32_t ns);
+uint8_t threewb_load(const uint8_t* buf, uint32_t len);
+uint8_t threewb_load_stream(const uint8_t* buf, uint32_t len, uint32_t avail);
+void    threewb_feed(uint32_t avail);
+uint8_t threewb_abort(void);
+void    threewb_tick(void);
+uint8_t threewb_is_busy(void);
+uint8_t threewb_result(void);
+
+#endif
@@ -0,0 +1,107 @@
+/**
+Binary event trace, over SEGGER RTT.
+
+Each event is 8 bytes, little endian:
+    [cycles u32][id u8][arg8 u8][arg16 u16]
+cycles is the DWT cycle counter, 64MHz, enabled by prof_init(). Events go
+to RTT up-buffer TRACE_RTT_CHANNEL, "Trace", which J-Link reads in the
+background while the CPU runs, e.g. with
+    JLinkRTTLogger -Device NRF52840_XXAA -If SWD -Speed 4000 -RTTChannel 1 trace.bin
+and tools/scum_programmer.py trace turns the dump into a timeline.
+
+The RTT control block, _SEGGER_RTT, is the one of the runtime library
+(LIBRARY_IO_TYPE RTT), which keeps up-buffer 0 as its terminal; the trace
+configures its own buffer there with SEGGER_RTT_ConfigUpBuffer(), then
+writes to it directly, the library's write functions are too slow for an
+ISR. When J-Link doesn't keep up, or isn't attached, events that don't fit
+are dropped and counted in app_dbg.num_trace_drops; a trace never waits.
+*/
+
+#include <string.h>
+#include "scum-programmer.h"
+#include "trace.h"
+
+//=========================== defines =========================================
+
+#define TRACE_RTT_CHANNEL           1  // up-buffer 0 is the library's terminal
+#define TRACE_RTT_MODE_NO_BLOCK_SKIP 0  // drop what doesn't fit
+
+//=========================== typedef =========================================
+
+// layout expected by J-Link, SEGGER_RTT_BUFFER_UP
+typedef struct {
+    const char*       name;
+    uint8_t*          buf;
+    uint32_t          size;
+    volatile uint32_t wr;           // written by the target
+    volatile uint32_t rd;           // advanced by J-Link
+    uint32_t          flags;
+} trace_rtt_buf_t;
+
+// layout expected by J-Link, SEGGER_RTT_CB, up to the trace's buffer
+typedef struct {
+    char              id[16];       // "SEGGER RTT"
+    int32_t           num_up;
+    int32_t           num_down;
+    trace_rtt_buf_t   up[TRACE_RTT_CHANNEL+1];
+} trace_rtt_cb_t;
+
+//=========================== variables =======================================
+
+// in the runtime library
+extern trace_rtt_cb_t _SEGGER_RTT;
+int SEGGER_RTT_ConfigUpBuffer(unsigned index, const char* name, void* buf, unsigned size, unsigned flags);
+
+typedef struct {
+    trace_rtt_buf_t*  up;           // NULL if the library has no room for it
+} trace_vars_t;
+
+trace_vars_t trace_vars;
+
+uint8_t trace_buf[TRACE_BUF_SIZE] __attribute__((aligned(4)));
+
+//=========================== public ==========================================
+
+void trace_init(void) {
+
+    // the library sets its control block up on first use
+    trace_vars.up                      = NULL;
+    if (SEGGER_RTT_ConfigUpBuffer(TRACE_RTT_CHANNEL, "Trace", trace_buf, TRACE_BUF_SIZE,
+                                  TRACE_RTT_MODE_NO_BLOCK_SKIP)<0 ||
+        _SEGGER_RTT.num_up<=TRACE_RTT_CHANNEL) {
+        return;
+    }
+    trace_vars.up                      = &_SEGGER_RTT.up[TRACE_RTT_CHANNEL];
+}
+
+void trace(uint8_t id, uint8_t arg8, uint16_t arg16) {
+    trace_rtt_buf_t* up;
+    uint32_t         primask;
+    uint32_t         wr;
+    uint32_t*        event;
+
+    up = trace_vars.up;
+    if (up==NULL) {
+        return;
+    }
+
+    // locked writer, see trace.h
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    // one byte always stays free, wr==rd means empty
+    // events are 8 bytes and the size a multiple of 8, one never wraps
+    wr = up->wr;
+    if (((up->rd-wr-1) & (TRACE_BUF_SIZE-1)) < 8) {
+        app_dbg.num_trace_drops++;
+        __set_PRIMASK(primask);
+        return;
+    }
+    event                              = (uint32_t*)&trace_buf[wr];
+    event[0]                           = DWT->CYCCNT;
+    event[1]                           = id | (arg8<<8) | ((uint32_t)arg16<<16);
+    __DMB();
+    up->wr                             = (wr+8) & (TRACE_BUF_SIZE-1);
+
+    __set_PRIMASK(primask);
+}
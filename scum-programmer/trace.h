@@ -0,0 +1,36 @@
+/**
+Binary event trace, over SEGGER RTT.
+*/
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+// event ids, [arg8][arg16] in brackets
+#define TRACE_EVT_TASK_START        0x01 // [EVT_*][-]
+#define TRACE_EVT_TASK_END          0x02 // [EVT_*][-]
+#define TRACE_EVT_PROTO_FRAME       0x10 // [cmd][seq]
+#define TRACE_EVT_PROTO_CHUNKS      0x11 // [seq][next offset/256], chunks committed to the window
+#define TRACE_EVT_PROTO_ACK         0x12 // [status][next offset/256]
+#define TRACE_EVT_3WB_START         0x20 // [mode][len/256]
+#define TRACE_EVT_3WB_STALL         0x21 // [-][bytes sent/256]
+#define TRACE_EVT_3WB_RESUME        0x22 // [-][bytes available/256]
+#define TRACE_EVT_3WB_DONE          0x23 // [-][len/256]
+#define TRACE_EVT_STORE_STEP        0x30 // [state][-]
+#define TRACE_EVT_SCUM_UART_REQ     0x40 // [op][address/64]
+
+#define TRACE_BUF_SIZE              4096 // 512 events
+
+//=========================== prototypes ======================================
+
+void trace_init(void);
+// a locked writer: masks all interrupts (PRIMASK) for the few cycles it
+// takes to copy an event and publish it, since ISRs of any priority trace
+// into the same buffer; not lock-free, don't call it where even that
+// jitter matters
+void trace(uint8_t id, uint8_t arg8, uint16_t arg16);
+
+#endif
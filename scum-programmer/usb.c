@@ -0,0 +1,770 @@
+/**
+USB full-speed CDC-ACM device on USBD.
+
+Allocation-free, everything runs from the USBD and POWER interrupts:
+- POWER brings USBD up when VBUS appears, and connects the pull-up once
+  the USB regulator is ready
+- EP0 answers the standard and CDC-ACM control requests
+- EP1 OUT/IN carry the CDC data, EP2 IN is the (silent) notification
+  endpoint CDC-ACM requires
+- EP3 OUT/IN form a vendor-specific interface for image upload: OUT packets
+  are moved by EasyDMA straight into scum_image, a short packet (or ZLP)
+  ends the upload, the main loop then answers with a status on EP3 IN; an
+  upload starting while scum_image_in_use() is drained and answered RC_BUSY
+
+USBD has a single EasyDMA channel shared by all endpoints, so transfers are
+queued in usb_vars.dma_pending and started one at a time.
+
+The bulk OUT endpoint is double-buffered in RAM: while the main loop consumes
+one packet, the next one is moved into the other buffer. The endpoint keeps
+NAKing the host as long as both buffers are full. Bulk IN packets are cut
+from a TX ring filled by the main loop.
+*/
+
+#include <string.h>
+#include "scum-programmer.h"
+#include "usb.h"
+#include "ringbuf.h"
+#include "prof.h"
+
+//=========================== defines =========================================
+
+#define USB_VID                     0x1915 // Nordic Semiconductor
+#define USB_PID                     0x5343 // "SC"
+
+// endpoint bits, same layout as EPDATASTATUS
+#define EP_IN(n)                    (0x00000001<<(n))
+#define EP_OUT(n)                   (0x00000001<<(16+(n)))
+
+#define EP_CDC_NOTIF                2
+#define EP_CDC_DATA                 1
+#define EP_VENDOR                   3
+
+#define USB_CDC_TX_BUF_SIZE         1024 // power of two
+
+// standard requests
+#define REQ_GET_STATUS              0x00
+#define REQ_CLEAR_FEATURE           0x01
+#define REQ_SET_FEATURE             0x03
+#define REQ_SET_ADDRESS             0x05
+#define REQ_GET_DESCRIPTOR          0x06
+#define REQ_GET_CONFIGURATION       0x08
+#define REQ_SET_CONFIGURATION       0x09
+#define REQ_GET_INTERFACE           0x0a
+#define REQ_SET_INTERFACE           0x0b
+
+// CDC-ACM requests
+#define REQ_CDC_SET_LINE_CODING     0x20
+#define REQ_CDC_GET_LINE_CODING     0x21
+#define REQ_CDC_SET_CTRL_LINE_STATE 0x22
+
+// descriptor types
+#define DESC_DEVICE                 0x01
+#define DESC_CONFIGURATION          0x02
+#define DESC_STRING                 0x03
+
+//=========================== variables =======================================
+
+const uint8_t usb_desc_device[] = {
+    0x12,                           // bLength
+    DESC_DEVICE,                    // bDescriptorType
+    0x00, 0x02,                     // bcdUSB 2.00
+    0xef, 0x02, 0x01,               // class/subclass/protocol: interface association
+    64,                             // bMaxPacketSize0
+    (USB_VID & 0xff), (USB_VID >> 8),
+    (USB_PID & 0xff), (USB_PID >> 8),
+    0x01, 0x00,                     // bcdDevice
+    1, 2, 3,                        // iManufacturer, iProduct, iSerialNumber
+    1,                              // bNumConfigurations
+};
+
+const uint8_t usb_desc_config[] = {
+    // configuration
+    0x09, DESC_CONFIGURATION,
+    98, 0,                          // wTotalLength
+    3,                              // bNumInterfaces
+    1,                              // bConfigurationValue
+    0,                              // iConfiguration
+    0x80,                           // bmAttributes: bus powered
+    50,                             // bMaxPower: 100mA
+    // interface association, CDC-ACM
+    0x08, 0x0b, 0, 2, 0x02, 0x02, 0x01, 0,
+    // interface 0, CDC communication
+    0x09, 0x04, 0, 0, 1, 0x02, 0x02, 0x01, 0,
+    0x05, 0x24, 0x00, 0x10, 0x01,   // header, CDC 1.10
+    0x05, 0x24, 0x01, 0x00, 0x01,   // call management
+    0x04, 0x24, 0x02, 0x02,         // ACM: line coding and control line state
+    0x05, 0x24, 0x06, 0, 1,         // union: interface 0 controls interface 1
+    0x07, 0x05, 0x80|EP_CDC_NOTIF, 0x03, 8, 0, 16,
+    // interface 1, CDC data
+    0x09, 0x04, 1, 0, 2, 0x0a, 0x00, 0x00, 0,
+    0x07, 0x05, EP_CDC_DATA, 0x02, USB_EP_SIZE, 0, 0,
+    0x07, 0x05, 0x80|EP_CDC_DATA, 0x02, USB_EP_SIZE, 0, 0,
+    // interface 2, vendor-specific image upload
+    0x09, 0x04, 2, 0, 2, 0xff, 0x00, 0x00, 0,
+    0x07, 0x05, EP_VENDOR, 0x02, USB_EP_SIZE, 0, 0,
+    0x07, 0x05, 0x80|EP_VENDOR, 0x02, USB_EP_SIZE, 0, 0,
+};
+
+const char* const usb_strings[] = {
+    "OpenWSN",                      // 1 manufacturer
+    "SCuM programmer",              // 2 product
+    // 3 serial number, from FICR
+};
+
+typedef struct {
+    uint8_t        buf[2][USB_EP_SIZE] __attribute__((aligned(4)));
+    uint8_t        len[2];
+    uint8_t        full;            // bitmap of buffers holding data
+    uint8_t        dma;             // OUT: buffer the next DMA lands in
+    uint8_t        rd;              // OUT: buffer the main loop reads next
+    uint8_t        pending;         // OUT: host data waiting on the endpoint
+    uint8_t        busy;            // IN: a packet is on the endpoint
+    uint8_t        zlp;             // IN: last packet was full-sized
+} usb_ep_t;
+
+typedef struct {
+    // EasyDMA
+    uint32_t       dma_busy;
+    uint32_t       dma_pending;     // EP_IN()/EP_OUT() bitmap
+    uint8_t*       dma_ptr[32];
+    uint32_t       dma_len[32];
+    // EP0
+    uint8_t        ep0_buf[USB_EP_SIZE] __attribute__((aligned(4)));
+    const uint8_t* ep0_data;        // rest of the IN data stage
+    uint32_t       ep0_len;
+    uint8_t        ep0_zlp;         // data stage ends with a zero-length packet
+    uint8_t        ep0_str[2+2*32] __attribute__((aligned(4)));
+    uint8_t        configuration;
+    // CDC-ACM
+    uint8_t        line_coding[8] __attribute__((aligned(4)));
+    usb_ep_t       cdc_out;
+    usb_ep_t       cdc_in;
+    uint8_t        cdc_tx_buf[USB_CDC_TX_BUF_SIZE];
+    ringbuf_t      cdc_tx;          // filled by the main loop, drained by the ISR
+    uint8_t        cdc_tx_waiting;  // post cdc_tx_evt on the next IN completion
+    uint8_t        cdc_tx_evt;
+    // vendor
+    uint32_t       vendor_len;      // bytes of the upload received so far
+    uint8_t        vendor_started;  // first packet taken, scum_image is the upload's
+    uint8_t        vendor_busy;     // upload complete, waiting for the main loop
+    uint8_t        vendor_pending;  // OUT: host data waiting on the endpoint
+    uint8_t        vendor_rc;       // RC_INVALID larger than scum_image, RC_BUSY refused
+    uint8_t        vendor_status[12] __attribute__((aligned(4)));
+    uint8_t        vendor_scratch[USB_EP_SIZE] __attribute__((aligned(4)));
+} usb_vars_t;
+
+usb_vars_t usb_vars;
+
+//=========================== prototypes ======================================
+
+void _usb_enable(void);
+void _usb_disable(void);
+void _usb_reset(void);
+void _usb_dma_request(uint32_t ep, uint8_t* ptr, uint32_t len);
+void _usb_dma_kick(void);
+void _usb_dma_done(uint32_t ep);
+void _usb_ep0_setup(void);
+void _usb_ep0_in_start(const uint8_t* data, uint32_t len, uint32_t wlength);
+void _usb_ep0_in_next(void);
+void _usb_ep0_stall(void);
+void _usb_string(uint8_t idx);
+void _usb_out_data(uint8_t n, usb_ep_t* ep);
+void _usb_in_kick(uint8_t n, usb_ep_t* ep);
+void _usb_vendor_out_data(void);
+
+//=========================== public ==========================================
+
+void usb_init(void) {
+
+    // default line coding, 115200 8N1, the value is meaningless on USB
+    usb_vars.line_coding[0]            = 0x00;
+    usb_vars.line_coding[1]            = 0xc2;
+    usb_vars.line_coding[2]            = 0x01;
+    usb_vars.line_coding[6]            = 8;
+
+    ringbuf_init(&usb_vars.cdc_tx, usb_vars.cdc_tx_buf, USB_CDC_TX_BUF_SIZE);
+
+    // USBD is brought up by POWER when VBUS is detected
+    NRF_POWER->EVENTS_USBDETECTED      = 0x00000000;
+    NRF_POWER->EVENTS_USBREMOVED       = 0x00000000;
+    NRF_POWER->EVENTS_USBPWRRDY        = 0x00000000;
+    NRF_POWER->INTENSET                = 0x00000380;       // USBDETECTED, USBREMOVED, USBPWRRDY
+
+    // USBD interrupts
+    // 1098 7654 3210 9876 5432 1098 7654 3210
+    // xxxx xxxS UFSI OOOO OOOO DIII IIII IIxR (S=EPDATA, U=EP0SETUP, F=USBEVENT, O=ENDEPOUT, D=EP0DATADONE, I=ENDEPIN, R=USBRESET)
+    // 0000 0001 1100 1111 1111 0111 1111 1101
+    //    0    1    c    f    f    7    f    d 0x01cff7fd
+    NRF_USBD->INTENSET                 = 0x01cff7fd;
+
+    // enable interrupts
+    NVIC_SetPriority(POWER_CLOCK_IRQn, IRQ_PRIO_USB);
+    NVIC_ClearPendingIRQ(POWER_CLOCK_IRQn);
+    NVIC_EnableIRQ(POWER_CLOCK_IRQn);
+    NVIC_SetPriority(USBD_IRQn, IRQ_PRIO_USB);
+    NVIC_ClearPendingIRQ(USBD_IRQn);
+    NVIC_EnableIRQ(USBD_IRQn);
+
+    // already plugged in
+    if (NRF_POWER->USBREGSTATUS & 0x00000001) {            // VBUSDETECT
+        _usb_enable();
+        if (NRF_POWER->USBREGSTATUS & 0x00000002) {        // OUTPUTRDY
+            NRF_USBD->USBPULLUP        = 0x00000001;
+        }
+    }
+}
+
+uint8_t* usb_cdc_rx_peek(uint32_t* len) {
+    usb_ep_t* ep;
+
+    ep = &usb_vars.cdc_out;
+    if ((ep->full & (0x01<<ep->rd))==0) {
+        return NULL;
+    }
+    *len = ep->len[ep->rd];
+    return ep->buf[ep->rd];
+}
+
+void usb_cdc_rx_release(void) {
+    usb_ep_t* ep;
+
+    ep = &usb_vars.cdc_out;
+    NVIC_DisableIRQ(USBD_IRQn);
+    ep->full                          &= ~(0x01<<ep->rd);
+    ep->rd                            ^= 1;
+    // a packet was left on the endpoint for lack of a free buffer
+    if (ep->pending) {
+        ep->pending                    = 0;
+        _usb_out_data(EP_CDC_DATA, ep);
+    }
+    NVIC_EnableIRQ(USBD_IRQn);
+}
+
+uint8_t usb_vendor_is_busy(void) {
+    return usb_vars.vendor_started;
+}
+
+uint32_t usb_cdc_tx(const uint8_t* buf, uint32_t len) {
+    uint32_t num;
+
+    num = ringbuf_write(&usb_vars.cdc_tx, buf, len);
+    NVIC_DisableIRQ(USBD_IRQn);
+    _usb_in_kick(EP_CDC_DATA, &usb_vars.cdc_in);
+    NVIC_EnableIRQ(USBD_IRQn);
+    return num;
+}
+
+uint32_t usb_cdc_tx_free(void) {
+    return ringbuf_free(&usb_vars.cdc_tx);
+}
+
+void usb_cdc_tx_wait(uint8_t evt) {
+
+    // posted once the IN endpoint has freed some of the TX ring
+    NVIC_DisableIRQ(USBD_IRQn);
+    if (usb_vars.configuration && usb_vars.cdc_in.busy==0) {
+        // nothing in flight, the space won't come from a completion
+        events_post(evt);
+    } else {
+        usb_vars.cdc_tx_waiting        = 1;
+        usb_vars.cdc_tx_evt            = evt;
+    }
+    NVIC_EnableIRQ(USBD_IRQn);
+}
+
+uint32_t usb_vendor_rx_len(uint8_t* rc) {
+    *rc = usb_vars.vendor_rc;
+    return usb_vars.vendor_len;
+}
+
+void usb_vendor_status(uint8_t status, uint32_t len, uint32_t crc) {
+
+    // status, 3 padding bytes, length and CRC32, little endian
+    usb_vars.vendor_status[0]          = status;
+    usb_vars.vendor_status[4]          = (len >>  0) & 0xff;
+    usb_vars.vendor_status[5]          = (len >>  8) & 0xff;
+    usb_vars.vendor_status[6]          = (len >> 16) & 0xff;
+    usb_vars.vendor_status[7]          = (len >> 24) & 0xff;
+    usb_vars.vendor_status[8]          = (crc >>  0) & 0xff;
+    usb_vars.vendor_status[9]          = (crc >>  8) & 0xff;
+    usb_vars.vendor_status[10]         = (crc >> 16) & 0xff;
+    usb_vars.vendor_status[11]         = (crc >> 24) & 0xff;
+
+    NVIC_DisableIRQ(USBD_IRQn);
+    _usb_dma_request(EP_IN(EP_VENDOR), usb_vars.vendor_status, sizeof(usb_vars.vendor_status));
+
+    // ready for the next upload
+    usb_vars.vendor_len                = 0;
+    usb_vars.vendor_rc                 = RC_OK;
+    usb_vars.vendor_started            = 0;
+    usb_vars.vendor_busy               = 0;
+    if (usb_vars.vendor_pending) {
+        usb_vars.vendor_pending        = 0;
+        _usb_vendor_out_data();
+    }
+    NVIC_EnableIRQ(USBD_IRQn);
+}
+
+//=========================== private =========================================
+
+//=== power
+
+void _usb_enable(void) {
+
+    // errata 187 and 171, USBD might not reach its active state
+    if (*(volatile uint32_t *)0x4006EC00 == 0x00000000) {
+        *(volatile uint32_t *)0x4006EC00 = 0x00009375;
+    }
+    *(volatile uint32_t *)0x4006ED14   = 0x00000003;
+    *(volatile uint32_t *)0x4006EC14   = 0x000000c0;
+    *(volatile uint32_t *)0x4006EC00   = 0x00009375;
+
+    NRF_USBD->ENABLE                   = 0x00000001;
+    while ((NRF_USBD->EVENTCAUSE & 0x00000800)==0);        // READY
+    NRF_USBD->EVENTCAUSE               = 0x00000800;
+
+    if (*(volatile uint32_t *)0x4006EC00 == 0x00000000) {
+        *(volatile uint32_t *)0x4006EC00 = 0x00009375;
+    }
+    *(volatile uint32_t *)0x4006ED14   = 0x00000000;
+    *(volatile uint32_t *)0x4006EC14   = 0x00000000;
+    *(volatile uint32_t *)0x4006EC00   = 0x00009375;
+
+    _usb_reset();
+}
+
+void _usb_disable(void) {
+    NRF_USBD->USBPULLUP                = 0x00000000;
+    NRF_USBD->ENABLE                   = 0x00000000;
+    _usb_reset();
+}
+
+void _usb_reset(void) {
+
+    // back to the default state, only EP0 enabled
+    NRF_USBD->EPINEN                   = 0x00000001;
+    NRF_USBD->EPOUTEN                  = 0x00000001;
+    *(volatile uint32_t *)0x40027C1C   = 0x00000000;       // errata 199
+    usb_vars.dma_busy                  = 0;
+    usb_vars.dma_pending               = 0;
+    usb_vars.configuration             = 0;
+    memset(&usb_vars.cdc_out, 0, sizeof(usb_ep_t));
+    memset(&usb_vars.cdc_in,  0, sizeof(usb_ep_t));
+    usb_vars.vendor_len                = 0;
+    usb_vars.vendor_started            = 0;
+    usb_vars.vendor_busy               = 0;
+    usb_vars.vendor_pending            = 0;
+    usb_vars.vendor_rc                 = RC_OK;
+}
+
+//=== EasyDMA
+
+void _usb_dma_request(uint32_t ep, uint8_t* ptr, uint32_t len) {
+    uint8_t i;
+
+    i = __CLZ(__RBIT(ep));
+    usb_vars.dma_ptr[i]                = ptr;
+    usb_vars.dma_len[i]                = len;
+    usb_vars.dma_pending              |= ep;
+    _usb_dma_kick();
+}
+
+void _usb_dma_kick(void) {
+    uint8_t i;
+
+    if (usb_vars.dma_busy || usb_vars.dma_pending==0) {
+        return;
+    }
+    i = __CLZ(__RBIT(usb_vars.dma_pending));
+    usb_vars.dma_pending              &= ~(0x00000001<<i);
+    usb_vars.dma_busy                  = 1;
+
+    // errata 199, USBD cannot receive tasks during DMA
+    *(volatile uint32_t *)0x40027C1C   = 0x00000082;
+    if (i<16) {
+        NRF_USBD->EPIN[i].PTR          = (uint32_t)usb_vars.dma_ptr[i];
+        NRF_USBD->EPIN[i].MAXCNT       = usb_vars.dma_len[i];
+        NRF_USBD->TASKS_STARTEPIN[i]   = 0x00000001;
+    } else {
+        NRF_USBD->EPOUT[i-16].PTR      = (uint32_t)usb_vars.dma_ptr[i];
+        NRF_USBD->EPOUT[i-16].MAXCNT   = usb_vars.dma_len[i];
+        NRF_USBD->TASKS_STARTEPOUT[i-16] = 0x00000001;
+    }
+}
+
+void _usb_dma_done(uint32_t ep) {
+    usb_ep_t* e;
+
+    *(volatile uint32_t *)0x40027C1C   = 0x00000000;       // errata 199
+    usb_vars.dma_busy                  = 0;
+
+    if (ep==EP_OUT(0)) {
+        // SET_LINE_CODING data stage received
+        NRF_USBD->TASKS_EP0STATUS      = 0x00000001;
+    } else if (ep==EP_OUT(EP_CDC_DATA)) {
+        e = &usb_vars.cdc_out;
+        e->len[e->dma]                 = NRF_USBD->EPOUT[EP_CDC_DATA].AMOUNT;
+        e->full                       |= (0x01<<e->dma);
+        e->dma                        ^= 1;
+        app_dbg.num_usb_bytes_out     += NRF_USBD->EPOUT[EP_CDC_DATA].AMOUNT;
+        events_post(EVT_USB_CDC_RX);
+    } else if (ep==EP_OUT(EP_VENDOR)) {
+        if (usb_vars.vendor_rc==RC_OK) {
+            usb_vars.vendor_len       += NRF_USBD->EPOUT[EP_VENDOR].AMOUNT;
+        }
+        app_dbg.num_usb_bytes_out     += NRF_USBD->EPOUT[EP_VENDOR].AMOUNT;
+        if (NRF_USBD->EPOUT[EP_VENDOR].AMOUNT<USB_EP_SIZE) {
+            // short packet, end of the upload
+            usb_vars.vendor_busy       = 1;
+            events_post(EVT_USB_VENDOR_RX);
+        }
+    }
+    // EP0 IN: wait for EP0DATADONE, CDC IN: wait for EPDATA
+
+    _usb_dma_kick();
+}
+
+//=== EP0
+
+void _usb_ep0_setup(void) {
+    uint8_t  bmrequesttype;
+    uint8_t  brequest;
+    uint16_t wvalue;
+    uint16_t wlength;
+
+    bmrequesttype                      = NRF_USBD->BMREQUESTTYPE;
+    brequest                           = NRF_USBD->BREQUEST;
+    wvalue                             = NRF_USBD->WVALUEL | (NRF_USBD->WVALUEH<<8);
+    wlength                            = NRF_USBD->WLENGTHL | (NRF_USBD->WLENGTHH<<8);
+
+    switch (bmrequesttype & 0x60) {
+        case 0x00: // standard
+            switch (brequest) {
+                case REQ_GET_DESCRIPTOR:
+                    switch (wvalue>>8) {
+                        case DESC_DEVICE:
+                            _usb_ep0_in_start(usb_desc_device, sizeof(usb_desc_device), wlength);
+                            return;
+                        case DESC_CONFIGURATION:
+                            _usb_ep0_in_start(usb_desc_config, sizeof(usb_desc_config), wlength);
+                            return;
+                        case DESC_STRING:
+                            if ((wvalue & 0xff)<=3) {
+                                _usb_string(wvalue & 0xff);
+                                _usb_ep0_in_start(usb_vars.ep0_str, usb_vars.ep0_str[0], wlength);
+                                return;
+                            }
+                            break;
+                    }
+                    break;
+                case REQ_SET_ADDRESS:
+                    // handled by the hardware, including the status stage
+                    return;
+                case REQ_SET_CONFIGURATION:
+                    if ((wvalue & 0xff)>1) {
+                        break;
+                    }
+                    _usb_reset();
+                    usb_vars.configuration = wvalue & 0xff;
+                    if (usb_vars.configuration) {
+                        NRF_USBD->EPINEN   = 0x00000001 | EP_IN(EP_CDC_DATA) | EP_IN(EP_CDC_NOTIF) | EP_IN(EP_VENDOR);
+                        NRF_USBD->EPOUTEN  = 0x00000001 | (EP_OUT(EP_CDC_DATA)>>16) | (EP_OUT(EP_VENDOR)>>16);
+                        NRF_USBD->DTOGGLE  = 0x00000180 | EP_CDC_DATA;  // IN, Data0
+                        NRF_USBD->DTOGGLE  = 0x00000180 | EP_CDC_NOTIF;
+                        NRF_USBD->DTOGGLE  = 0x00000180 | EP_VENDOR;
+                        NRF_USBD->DTOGGLE  = 0x00000100 | EP_CDC_DATA;  // OUT, Data0
+                        NRF_USBD->DTOGGLE  = 0x00000100 | EP_VENDOR;
+                        NRF_USBD->SIZE.EPOUT[EP_CDC_DATA] = 0;          // accept the first packet
+                        NRF_USBD->SIZE.EPOUT[EP_VENDOR]   = 0;
+                    }
+                    NRF_USBD->TASKS_EP0STATUS = 0x00000001;
+                    return;
+                case REQ_GET_CONFIGURATION:
+                    _usb_ep0_in_start(&usb_vars.configuration, 1, wlength);
+                    return;
+                case REQ_GET_STATUS:
+                    usb_vars.ep0_str[0]    = 0;
+                    usb_vars.ep0_str[1]    = 0;
+                    _usb_ep0_in_start(usb_vars.ep0_str, 2, wlength);
+                    return;
+                case REQ_CLEAR_FEATURE:
+                    if ((bmrequesttype & 0x1f)==0x02 && wvalue==0) {
+                        // ENDPOINT_HALT, unstall and reset the data toggle
+                        NRF_USBD->EPSTALL  = NRF_USBD->WINDEXL & 0x87;
+                        NRF_USBD->DTOGGLE  = (NRF_USBD->WINDEXL & 0x87) | 0x00000100; // Data0
+                        NRF_USBD->TASKS_EP0STATUS = 0x00000001;
+                        return;
+                    }
+                    break;
+                case REQ_SET_INTERFACE:
+                    NRF_USBD->TASKS_EP0STATUS = 0x00000001;
+                    return;
+                case REQ_GET_INTERFACE:
+                    usb_vars.ep0_str[0]    = 0;
+                    _usb_ep0_in_start(usb_vars.ep0_str, 1, wlength);
+                    return;
+            }
+            break;
+        case 0x20: // class
+            switch (brequest) {
+                case REQ_CDC_SET_LINE_CODING:
+                    // data stage lands in line_coding, then status
+                    NRF_USBD->TASKS_EP0RCVOUT = 0x00000001;
+                    return;
+                case REQ_CDC_GET_LINE_CODING:
+                    _usb_ep0_in_start(usb_vars.line_coding, 7, wlength);
+                    return;
+                case REQ_CDC_SET_CTRL_LINE_STATE:
+                    NRF_USBD->TASKS_EP0STATUS = 0x00000001;
+                    return;
+            }
+            break;
+    }
+
+    // not supported
+    _usb_ep0_stall();
+}
+
+void _usb_ep0_in_start(const uint8_t* data, uint32_t len, uint32_t wlength) {
+    if (len>wlength) {
+        len = wlength;
+    }
+    usb_vars.ep0_data                  = data;
+    usb_vars.ep0_len                   = len;
+    // a transfer shorter than requested ending on a full packet needs a ZLP
+    usb_vars.ep0_zlp                   = (len<wlength && (len%USB_EP_SIZE)==0);
+    _usb_ep0_in_next();
+}
+
+void _usb_ep0_in_next(void) {
+    uint32_t len;
+
+    len = usb_vars.ep0_len;
+    if (len>USB_EP_SIZE) {
+        len = USB_EP_SIZE;
+    }
+    // descriptors live in flash, EasyDMA only reaches RAM
+    memcpy(usb_vars.ep0_buf, usb_vars.ep0_data, len);
+    usb_vars.ep0_data                 += len;
+    usb_vars.ep0_len                  -= len;
+    _usb_dma_request(EP_IN(0), usb_vars.ep0_buf, len);
+}
+
+void _usb_ep0_stall(void) {
+    NRF_USBD->TASKS_EP0STALL           = 0x00000001;
+
+    // debug
+    app_dbg.num_usb_stalls++;
+}
+
+void _usb_string(uint8_t idx) {
+    const char* str;
+    char        serial[17];
+    uint32_t    id;
+    uint8_t     i;
+
+    if (idx==0) {
+        // supported languages, en-US
+        usb_vars.ep0_str[0]            = 4;
+        usb_vars.ep0_str[1]            = DESC_STRING;
+        usb_vars.ep0_str[2]            = 0x09;
+        usb_vars.ep0_str[3]            = 0x04;
+        return;
+    }
+    if (idx==3) {
+        // serial number, FICR DEVICEID in hex
+        for (i=0;i<16;i++) {
+            id                         = NRF_FICR->DEVICEID[1-i/8];
+            serial[i]                  = "0123456789ABCDEF"[(id>>(28-4*(i%8))) & 0x0f];
+        }
+        serial[16]                     = 0;
+        str                            = serial;
+    } else {
+        str                            = usb_strings[idx-1];
+    }
+
+    // ASCII to UTF-16LE
+    i = 0;
+    while (str[i]) {
+        usb_vars.ep0_str[2+2*i]        = str[i];
+        usb_vars.ep0_str[2+2*i+1]      = 0;
+        i++;
+    }
+    usb_vars.ep0_str[0]                = 2+2*i;
+    usb_vars.ep0_str[1]                = DESC_STRING;
+}
+
+//=== bulk
+
+void _usb_out_data(uint8_t n, usb_ep_t* ep) {
+
+    // data is waiting on OUT endpoint n, move it to a free buffer
+    if (ep->full & (0x01<<ep->dma)) {
+        // both buffers in use, the endpoint NAKs the host until one frees up
+        ep->pending                    = 1;
+        app_dbg.num_usb_naks++;
+        return;
+    }
+    _usb_dma_request(EP_OUT(n), ep->buf[ep->dma], NRF_USBD->SIZE.EPOUT[n]);
+}
+
+void _usb_in_kick(uint8_t n, usb_ep_t* ep) {
+    uint32_t len;
+
+    if (usb_vars.configuration==0 || ep->busy) {
+        return;
+    }
+    if (ringbuf_used(&usb_vars.cdc_tx)==0 && ep->zlp==0) {
+        return;
+    }
+    len = ringbuf_read(&usb_vars.cdc_tx, ep->buf[0], USB_EP_SIZE);
+    // end the transfer with a ZLP if the last packet was full-sized
+    ep->zlp                            = (len==USB_EP_SIZE);
+    ep->busy                           = 1;
+    app_dbg.num_usb_bytes_in          += len;
+    _usb_dma_request(EP_IN(n), ep->buf[0], len);
+}
+
+//=== vendor
+
+void _usb_vendor_out_data(void) {
+    uint32_t size;
+
+    // data is waiting on the vendor OUT endpoint
+    if (usb_vars.vendor_busy) {
+        // previous upload not answered yet, NAK the host meanwhile
+        usb_vars.vendor_pending        = 1;
+        app_dbg.num_usb_naks++;
+        return;
+    }
+    if (usb_vars.vendor_started==0) {
+        // first packet, the upload only gets scum_image if nothing else uses it
+        usb_vars.vendor_started        = 1;
+        if (scum_image_in_use()) {
+            usb_vars.vendor_rc         = RC_BUSY;
+            app_dbg.num_usb_vendor_refused++;
+        }
+    }
+    size = NRF_USBD->SIZE.EPOUT[EP_VENDOR];
+    if (size==0) {
+        // ZLP, end of an upload that filled its last packet
+        NRF_USBD->SIZE.EPOUT[EP_VENDOR] = 0;
+        usb_vars.vendor_busy           = 1;
+        events_post(EVT_USB_VENDOR_RX);
+        return;
+    }
+    if (usb_vars.vendor_rc==RC_OK && usb_vars.vendor_len+size>SCUM_IMAGE_SIZE) {
+        // too large, drain the rest of the upload, report it at the end
+        usb_vars.vendor_rc             = RC_INVALID;
+    }
+    if (usb_vars.vendor_rc!=RC_OK) {
+        _usb_dma_request(EP_OUT(EP_VENDOR), usb_vars.vendor_scratch, size);
+    } else {
+        // zero-copy, straight to its place in the image
+        _usb_dma_request(EP_OUT(EP_VENDOR), &scum_image[usb_vars.vendor_len], size);
+    }
+}
+
+//=========================== interrupt handlers ==============================
+
+void POWER_CLOCK_IRQHandler(void) {
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_POWER_CLOCK_IRQHandler++;
+
+    if (NRF_POWER->EVENTS_USBDETECTED == 0x00000001) {
+        NRF_POWER->EVENTS_USBDETECTED  = 0x00000000;
+        _usb_enable();
+    }
+    if (NRF_POWER->EVENTS_USBPWRRDY == 0x00000001) {
+        NRF_POWER->EVENTS_USBPWRRDY    = 0x00000000;
+        NRF_USBD->USBPULLUP            = 0x00000001;
+    }
+    if (NRF_POWER->EVENTS_USBREMOVED == 0x00000001) {
+        NRF_POWER->EVENTS_USBREMOVED   = 0x00000000;
+        _usb_disable();
+    }
+
+    prof_stop(PROF_ISR_POWER_CLOCK, prof);
+}
+
+void USBD_IRQHandler(void) {
+    uint32_t epdatastatus;
+    uint8_t  i;
+    uint32_t prof;
+
+    prof = prof_start();
+
+    // debug
+    app_dbg.num_ISR_USBD_IRQHandler++;
+
+    if (NRF_USBD->EVENTS_USBRESET == 0x00000001) {
+        NRF_USBD->EVENTS_USBRESET      = 0x00000000;
+        _usb_reset();
+    }
+
+    if (NRF_USBD->EVENTS_USBEVENT == 0x00000001) {
+        NRF_USBD->EVENTS_USBEVENT      = 0x00000000;
+        // suspend/resume are not acted upon, the DK is powered anyway
+        NRF_USBD->EVENTCAUSE           = NRF_USBD->EVENTCAUSE;
+    }
+
+    // EasyDMA transfers done
+    for (i=0;i<8;i++) {
+        if (NRF_USBD->EVENTS_ENDEPIN[i] == 0x00000001) {
+            NRF_USBD->EVENTS_ENDEPIN[i] = 0x00000000;
+            _usb_dma_done(EP_IN(i));
+        }
+        if (NRF_USBD->EVENTS_ENDEPOUT[i] == 0x00000001) {
+            NRF_USBD->EVENTS_ENDEPOUT[i] = 0x00000000;
+            _usb_dma_done(EP_OUT(i));
+        }
+    }
+
+    if (NRF_USBD->EVENTS_EP0SETUP == 0x00000001) {
+        NRF_USBD->EVENTS_EP0SETUP      = 0x00000000;
+        _usb_ep0_setup();
+    }
+
+    if (NRF_USBD->EVENTS_EP0DATADONE == 0x00000001) {
+        NRF_USBD->EVENTS_EP0DATADONE   = 0x00000000;
+        if ((NRF_USBD->BMREQUESTTYPE & 0x80)==0) {
+            // OUT data stage
+            _usb_dma_request(EP_OUT(0), usb_vars.line_coding, 7);
+        } else if (usb_vars.ep0_len || usb_vars.ep0_zlp) {
+            if (usb_vars.ep0_len==0) {
+                usb_vars.ep0_zlp       = 0;
+            }
+            _usb_ep0_in_next();
+        } else {
+            NRF_USBD->TASKS_EP0STATUS  = 0x00000001;
+        }
+    }
+
+    // packets acknowledged by the host (IN) or received from it (OUT)
+    if (NRF_USBD->EVENTS_EPDATA == 0x00000001) {
+        NRF_USBD->EVENTS_EPDATA        = 0x00000000;
+        epdatastatus                   = NRF_USBD->EPDATASTATUS;
+        NRF_USBD->EPDATASTATUS         = epdatastatus;
+        if (epdatastatus & EP_IN(EP_CDC_DATA)) {
+            usb_vars.cdc_in.busy       = 0;
+            _usb_in_kick(EP_CDC_DATA, &usb_vars.cdc_in);
+            if (usb_vars.cdc_tx_waiting) {
+                usb_vars.cdc_tx_waiting = 0;
+                events_post(usb_vars.cdc_tx_evt);
+            }
+        }
+        if (epdatastatus & EP_OUT(EP_CDC_DATA)) {
+            _usb_out_data(EP_CDC_DATA, &usb_vars.cdc_out);
+        }
+        if (epdatastatus & EP_OUT(EP_VENDOR)) {
+            _usb_vendor_out_data();
+        }
+    }
+
+    prof_stop(PROF_ISR_USBD, prof);
+}
@@ -0,0 +1,28 @@
+/**
+USB full-speed CDC-ACM device on USBD.
+*/
+
+#ifndef __USB_H
+#define __USB_H
+
+#include <stdint.h>
+
+//=========================== defines =========================================
+
+#define USB_EP_SIZE                 64 // full-speed bulk max packet size
+
+//=========================== prototypes ======================================
+
+void     usb_init(void);
+// CDC-ACM data, main loop only
+uint8_t* usb_cdc_rx_peek(uint32_t* len);
+void     usb_cdc_rx_release(void);
+uint32_t usb_cdc_tx(const uint8_t* buf, uint32_t len);
+uint32_t usb_cdc_tx_free(void);
+void     usb_cdc_tx_wait(uint8_t evt);
+// vendor image upload, main loop only
+uint32_t usb_vendor_rx_len(uint8_t* rc);
+void     usb_vendor_status(uint8_t status, uint32_t len, uint32_t crc);
+uint8_t  usb_vendor_is_busy(void);
+
+#endif
@@ -0,0 +1,631 @@
+#!/usr/bin/env python3
+"""
+Host side of the SCuM programmer.
+
+usb-upload   stream an image into the programmer over its vendor USB
+             interface (needs pyusb)
+
+The other commands talk the framed protocol (see proto.h) over a serial
+port, the CDC-ACM one or the J-Link VCOM (needs pyserial).
+"""
+
+import argparse
+import queue
+import random
+import struct
+import sys
+import threading
+import time
+import zlib
+
+#============================ defines =========================================
+
+USB_VID                 = 0x1915
+USB_PID                 = 0x5343
+USB_VENDOR_INTERFACE    = 2
+USB_VENDOR_EP_OUT       = 0x03
+USB_VENDOR_EP_IN        = 0x83
+
+SCUM_IMAGE_SIZE         = 64*1024
+
+RC_NAMES                = {0: 'OK', 1: 'BUSY', 2: 'INVALID', 3: 'UNKNOWN'}
+
+HDLC_FLAG               = 0x7e
+HDLC_ESCAPE             = 0x7d
+HDLC_XOR                = 0x20
+
+CMD_GET_VERSION         = 0x01
+CMD_LOAD_START          = 0x02
+CMD_LOAD_CHUNK          = 0x03
+CMD_VERIFY              = 0x04
+CMD_BOOT                = 0x05
+CMD_CALIBRATE           = 0x06
+CMD_BRIDGE_START        = 0x07
+CMD_SET_3WB             = 0x08
+CMD_GET_DBG             = 0x09
+CMD_STORE_SAVE          = 0x0a
+CMD_STORE_BOOT          = 0x0b
+CMD_STORE_FIND          = 0x0c
+CMD_STORE_LIST          = 0x0d
+CMD_STORE_STAGE         = 0x0e
+CMD_BLOCK_CRCS          = 0x0f
+CMD_LOAD_CHUNK_LZ4      = 0x10
+CMD_SCUM_VERIFY         = 0x11
+CMD_GET_BENCH           = 0x12
+CMD_GET_PROF            = 0x13
+CMD_RESET_PROF          = 0x14
+CMD_BRIDGE_STOP         = 0x15
+CMD_BRIDGE_TX           = 0x16
+CMD_BRIDGE_RX           = 0x17
+
+# main loop tasks, one per EVT_*
+TASK_NAMES = (
+    'app_tick', 'usb_cdc_rx', 'usb_vendor_rx', 'host_uart_rx', '3wb_done', 'store_step', 'store_done', 'button',
+    'scum_uart', 'scum_verify_done', 'scum_uart_rx',
+)
+
+# trace events, as in trace.h, with how to print [arg8][arg16]
+TRACE_EVENTS = {
+    0x01: ('task start',   lambda a8, a16: TASK_NAMES[a8] if a8 < len(TASK_NAMES) else a8),
+    0x02: ('task end',     lambda a8, a16: TASK_NAMES[a8] if a8 < len(TASK_NAMES) else a8),
+    0x10: ('frame',        lambda a8, a16: 'cmd 0x{0:02x} seq {1}'.format(a8, a16)),
+    0x11: ('chunks',       lambda a8, a16: 'seq {0}, staged up to {1}'.format(a8, a16 * 256)),
+    0x12: ('ack',          lambda a8, a16: 'status {0}, next {1}'.format(a8, a16 * 256)),
+    0x20: ('3wb start',    lambda a8, a16: '{0} mode, {1} bytes'.format(('pwm', 'spim')[a8 & 1], a16 * 256)),
+    0x21: ('3wb stall',    lambda a8, a16: 'at {0}'.format(a16 * 256)),
+    0x22: ('3wb resume',   lambda a8, a16: 'up to {0}'.format(a16 * 256)),
+    0x23: ('3wb done',     lambda a8, a16: ''),
+    0x30: ('store step',   lambda a8, a16: 'state {0}'.format(a8)),
+    0x40: ('scum uart',    lambda a8, a16: '{0} at 0x{1:05x}'.format(chr(a8), a16 * 64)),
+}
+
+# profiled ISRs, then the main loop tasks, as in prof.h
+PROF_NAMES = (
+    'RTC0', 'GPIOTE', 'PWM0', 'SPIM3', 'TIMER3', 'POWER_CLOCK', 'USBD', 'UARTE0', 'TIMER0', 'RTC2', 'UARTE1', 'RTC1',
+) + TASK_NAMES
+
+RESPONSE                = 0x80
+
+LOAD_KEEP               = 0x01
+LOAD_BOOT               = 0x02
+
+#============================ helpers =========================================
+
+def read_image(path):
+    with open(path, 'rb') as f:
+        image = f.read()
+    if len(image) > SCUM_IMAGE_SIZE:
+        sys.exit('{0}: {1} bytes, larger than SCuM\'s {2}'.format(path, len(image), SCUM_IMAGE_SIZE))
+    return image
+
+def crc16(data):
+    # CRC-16/X.25, as in crc.c
+    crc = 0xffff
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc ^ 0xffff
+
+def lz4_compress(data):
+    # LZ4 block, greedy; the last 5 bytes are literals, and no match starts
+    # in the last 12, as the format requires
+    out    = bytearray()
+    table  = {}
+    anchor = 0
+    i      = 0
+
+    def length(n):
+        ext = bytearray()
+        n  -= 15
+        while n >= 255:
+            ext.append(255)
+            n -= 255
+        ext.append(n)
+        return bytes(ext)
+
+    def sequence(literals, offset=None, match=0):
+        token = min(len(literals), 15) << 4
+        if offset is not None:
+            token |= min(match - 4, 15)
+        out.append(token)
+        if len(literals) >= 15:
+            out.extend(length(len(literals)))
+        out.extend(literals)
+        if offset is not None:
+            out.extend(struct.pack('<H', offset))
+            if match - 4 >= 15:
+                out.extend(length(match - 4))
+
+    while i < len(data) - 12:
+        key        = data[i:i+4]
+        candidate  = table.get(key)
+        table[key] = i
+        if candidate is None or i - candidate > 0xffff:
+            i += 1
+            continue
+        match = 4
+        while match < len(data) - 5 - i and data[candidate+match] == data[i+match]:
+            match += 1
+        sequence(data[anchor:i], i - candidate, match)
+        i     += match
+        anchor = i
+    sequence(data[anchor:])
+    return bytes(out)
+
+def hdlc_encode(content, fcs=None):
+    if fcs is None:
+        fcs = crc16(content)
+    out = bytearray([HDLC_FLAG])
+    for b in content + struct.pack('<H', fcs):
+        if b in (HDLC_FLAG, HDLC_ESCAPE):
+            out += bytes([HDLC_ESCAPE, b ^ HDLC_XOR])
+        else:
+            out.append(b)
+    out.append(HDLC_FLAG)
+    return bytes(out)
+
+class Link(object):
+    '''
+    Framed protocol over a serial port.
+    '''
+
+    def __init__(self, port, baudrate):
+        import serial
+        self.serial  = serial.Serial(port, baudrate, rtscts=True, timeout=0.1)
+        self.seq     = 0
+        self.frame   = bytearray()
+        self.escape  = False
+        self.pending = bytearray()     # read from the port, not parsed yet
+        self.on_bridge_rx = None       # called with the data of each BRIDGE_RX
+
+    def send(self, cmd, payload=b''):
+        self.seq = (self.seq + 1) & 0xff
+        self.serial.write(hdlc_encode(bytes([cmd, self.seq]) + payload))
+        return self.seq
+
+    def receive(self, timeout):
+        # returns (cmd, seq, status, payload) or None
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if not self.pending:
+                self.pending = bytearray(self.serial.read(self.serial.in_waiting or 1))
+            while self.pending:
+                b = self.pending.pop(0)
+                if b == HDLC_FLAG:
+                    frame       = bytes(self.frame)
+                    self.frame  = bytearray()
+                    self.escape = False
+                    if len(frame) >= 5 and crc16(frame[:-2]) == struct.unpack('<H', frame[-2:])[0]:
+                        if frame[0] & ~RESPONSE == CMD_BRIDGE_RX and self.on_bridge_rx:
+                            self.on_bridge_rx(frame[3:-2])
+                            continue
+                        return (frame[0] & ~RESPONSE, frame[1], frame[2], frame[3:-2])
+                elif b == HDLC_ESCAPE:
+                    self.escape = True
+                else:
+                    self.frame.append(b ^ HDLC_XOR if self.escape else b)
+                    self.escape = False
+        return None
+
+    def request(self, cmd, payload=b'', timeout=1.0, retries=3, may_fail=False):
+        for _ in range(retries):
+            seq = self.send(cmd, payload)
+            while True:
+                resp = self.receive(timeout)
+                if resp is None:
+                    break
+                if resp[0] == cmd and resp[1] == seq:
+                    if resp[2] != 0 and may_fail:
+                        return None
+                    if resp[2] != 0:
+                        sys.exit('command 0x{0:02x}: {1}'.format(cmd, RC_NAMES.get(resp[2], resp[2])))
+                    return resp[3]
+        sys.exit('command 0x{0:02x}: no response'.format(cmd))
+
+    def staged_blocks(self, chunk_max=256):
+        # CRC32 of each block of what the programmer has staged
+        (length, _) = struct.unpack('<II', self.request(CMD_VERIFY))
+        crcs = []
+        while len(crcs) * chunk_max < length:
+            resp  = self.request(CMD_BLOCK_CRCS, struct.pack('<HH', len(crcs), 0xffff))
+            crcs += struct.unpack('<{0}I'.format(len(resp) // 4), resp)
+        return (length, crcs)
+
+    def load(self, image, error_rate=0.0, keep=frozenset(), lz4=False, boot=False):
+        # chunks in keep are already staged, they go out empty
+        flags = LOAD_KEEP if keep else 0
+        if boot:
+            # SCuM is loaded as the image arrives, the BOOT response comes with the seq of LOAD_START
+            flags |= LOAD_BOOT
+        (window, chunk_max) = struct.unpack('<HH', self.request(CMD_LOAD_START, struct.pack('<IB', len(image), flags)))
+        self.boot_seq  = self.seq if boot else None
+        self.boot_resp = None
+        num_chunks = (len(image) + chunk_max - 1) // chunk_max
+
+        # frames to send, (first chunk, number of chunks, content)
+        frames = []
+        i      = 0
+        while i < num_chunks:
+            frame = None
+            if lz4 and i not in keep:
+                # as many chunks as compress into one frame
+                for n in (16, 8, 4, 2, 1):
+                    if i + n > num_chunks or keep.intersection(range(i, i + n)):
+                        continue
+                    data  = image[i*chunk_max:(i+n)*chunk_max]
+                    block = lz4_compress(data)
+                    if len(block) <= chunk_max and (n > 1 or len(block) < len(data)):
+                        frame = (i, n, bytes([CMD_LOAD_CHUNK_LZ4, i & 0xff]) + struct.pack('<IH', i * chunk_max, len(data)) + block)
+                        break
+            if frame is None:
+                data  = b'' if i in keep else image[i*chunk_max:(i+1)*chunk_max]
+                frame = (i, 1, bytes([CMD_LOAD_CHUNK, i & 0xff]) + struct.pack('<I', i * chunk_max) + data)
+            frames.append(frame)
+            i += frame[1]
+
+        received    = [False] * num_chunks
+        sent        = [False] * len(frames)
+        base        = 0     # first chunk not acknowledged
+        retransmits = 0
+
+        def send_frame(f):
+            content = frames[f][2]
+            if error_rate and random.random() < error_rate:
+                # flip a bit after computing the FCS, the programmer drops the frame
+                corrupted      = bytearray(content)
+                corrupted[-1] ^= 1 << random.randrange(8)
+                self.serial.write(hdlc_encode(bytes(corrupted), crc16(content)))
+            else:
+                self.serial.write(hdlc_encode(content))
+            sent[f] = True
+
+        def resend(below):
+            # frames with a chunk missing before chunk 'below'
+            count = 0
+            for (f, (first, n, _)) in enumerate(frames):
+                if first < below and sent[f] and not all(received[first:first+n]):
+                    sent[f] = False
+                    count  += 1
+            return count
+
+        # selective repeat: keep the window full, resend only what the programmer reports missing
+        while base < num_chunks:
+            for (f, (first, n, _)) in enumerate(frames):
+                if first + n > base + window:
+                    break
+                if not sent[f] and not all(received[first:first+n]):
+                    send_frame(f)
+            resp = self.receive(1.0)
+            if resp is None:
+                # nothing heard, resend everything not acknowledged in the window
+                retransmits += resend(base + window)
+                continue
+            if resp[0] == CMD_BOOT and resp[1] == self.boot_seq:
+                self.boot_resp = resp
+                continue
+            if resp[0] != CMD_LOAD_CHUNK:
+                continue
+            (offset, bitmap) = struct.unpack('<II', resp[3])
+            base = (offset + chunk_max - 1) // chunk_max
+            for i in range(base):
+                received[i] = True
+            for n in range(window):
+                if bitmap & (1 << n) and base + n < num_chunks:
+                    received[base + n] = True
+            if resp[2] != 0:
+                # NACK, holes below the last chunk received
+                retransmits += resend(base + bitmap.bit_length() - 1)
+        return (retransmits, len(frames))
+
+    def wait_boot(self, timeout=10.0):
+        # end of a load started with boot=True
+        deadline = time.time() + timeout
+        while self.boot_resp is None and time.time() < deadline:
+            resp = self.receive(deadline - time.time())
+            if resp is not None and resp[0] == CMD_BOOT and resp[1] == self.boot_seq:
+                self.boot_resp = resp
+        if self.boot_resp is None:
+            sys.exit('boot: no response')
+        if self.boot_resp[2] != 0:
+            sys.exit('boot: {0}'.format(RC_NAMES.get(self.boot_resp[2], self.boot_resp[2])))
+
+#============================ commands ========================================
+
+def cmd_usb_upload(args):
+    import usb.core
+    import usb.util
+
+    image = read_image(args.image)
+
+    dev = usb.core.find(idVendor=USB_VID, idProduct=USB_PID)
+    if dev is None:
+        sys.exit('SCuM programmer not found on USB')
+    usb.util.claim_interface(dev, USB_VENDOR_INTERFACE)
+
+    # one write, the short packet (or ZLP) at the end closes the upload
+    dev.write(USB_VENDOR_EP_OUT, image, timeout=5000)
+    if len(image) % 64 == 0:
+        dev.write(USB_VENDOR_EP_OUT, b'', timeout=1000)
+
+    (status, length, crc) = struct.unpack('<B3xII', bytes(dev.read(USB_VENDOR_EP_IN, 12, timeout=5000)))
+    print('status {0}, {1} bytes, CRC32 0x{2:08x}'.format(RC_NAMES.get(status, status), length, crc))
+    if status != 0 or length != len(image) or crc != zlib.crc32(image):
+        sys.exit('upload failed')
+
+def cmd_version(args):
+    link = Link(args.port, args.baudrate)
+    (major, minor) = struct.unpack('<BB', link.request(CMD_GET_VERSION))
+    print('firmware {0}.{1}'.format(major, minor))
+
+def cmd_load(args):
+    image = read_image(args.image)
+    if args.stream:
+        args.boot = True
+    link  = Link(args.port, args.baudrate)
+    start = time.time()
+
+    # the programmer may have it in its library already
+    found = None
+    if not args.upload:
+        found = link.request(CMD_STORE_FIND, struct.pack('<II', len(image), zlib.crc32(image)), may_fail=True)
+    if found is not None:
+        print('found in slot {0}, not uploaded'.format(found[0]))
+    else:
+        # only send the blocks that differ from what is staged
+        keep = set()
+        if not args.upload:
+            if args.base_slot is not None:
+                link.request(CMD_STORE_STAGE, bytes([args.base_slot]))
+            (length, crcs) = link.staged_blocks()
+            for (i, crc) in enumerate(crcs):
+                block = image[i*256:(i+1)*256]
+                if len(block) == min(256, length - i*256) and zlib.crc32(block) == crc:
+                    keep.add(i)
+        (retransmits, num_frames) = link.load(image, args.error_rate, keep, args.lz4, args.stream)
+        if args.stream:
+            link.wait_boot()
+            print('booted while uploading')
+        print('uploaded in {0:.2f}s, {1} frames, {2} of {3} blocks unchanged, {4} frames resent'.format(
+            time.time() - start, num_frames, len(keep), (len(image) + 255) // 256, retransmits))
+    (length, crc) = struct.unpack('<II', link.request(CMD_VERIFY))
+    print('{0} bytes, CRC32 0x{1:08x}'.format(length, crc))
+    if length != len(image) or crc != zlib.crc32(image):
+        sys.exit('verify failed')
+    if args.save and found is None:
+        (slot, seq) = struct.unpack('<BI', link.request(CMD_STORE_SAVE, timeout=10.0, retries=1))
+        print('saved to slot {0}, seq {1}'.format(slot, seq))
+    if args.boot and not (args.stream and found is None):
+        link.request(CMD_BOOT, timeout=10.0, retries=1)
+        print('booted')
+    if args.scum_verify:
+        scum_verify(link)
+
+def scum_verify(link):
+    # read back SCuM's SRAM through the verify stub running on it
+    start = time.time()
+    (result, address) = struct.unpack('<BI', link.request(CMD_SCUM_VERIFY, timeout=5.0, retries=1))
+    if result == 1:
+        sys.exit('SCuM differs from the staged image at 0x{0:05x}'.format(address))
+    if result == 2:
+        sys.exit('no answer from SCuM, is the verify stub running?')
+    print('SCuM matches the staged image, read back in {0:.0f}ms'.format((time.time() - start) * 1000))
+
+def cmd_verify(args):
+    link = Link(args.port, args.baudrate)
+    (length, crc) = struct.unpack('<II', link.request(CMD_VERIFY))
+    print('{0} bytes, CRC32 0x{1:08x}'.format(length, crc))
+    if args.scum:
+        scum_verify(link)
+
+def cmd_boot(args):
+    link = Link(args.port, args.baudrate)
+    link.request(CMD_BOOT, timeout=10.0, retries=1)
+
+def cmd_save(args):
+    link = Link(args.port, args.baudrate)
+    (slot, seq) = struct.unpack('<BI', link.request(CMD_STORE_SAVE, timeout=10.0, retries=1))
+    print('saved to slot {0}, seq {1}'.format(slot, seq))
+
+def cmd_store_boot(args):
+    link    = Link(args.port, args.baudrate)
+    payload = b'' if args.slot is None else bytes([args.slot])
+    (slot, length, crc) = struct.unpack('<BII', link.request(CMD_STORE_BOOT, payload, timeout=10.0, retries=1))
+    print('booted slot {0}, {1} bytes, CRC32 0x{2:08x}'.format(slot, length, crc))
+
+def cmd_list(args):
+    link = Link(args.port, args.baudrate)
+    resp = link.request(CMD_STORE_LIST)
+    for i in range(0, len(resp), 13):
+        (slot, length, crc, seq) = struct.unpack('<BIII', resp[i:i+13])
+        print('slot {0}: {1:6d} bytes, CRC32 0x{2:08x}, seq {3}'.format(slot, length, crc, seq))
+
+def cmd_calibrate(args):
+    link = Link(args.port, args.baudrate)
+    link.request(CMD_CALIBRATE, struct.pack('<HH', args.periods, args.ticks))
+
+def cmd_set_3wb(args):
+    link = Link(args.port, args.baudrate)
+    link.request(CMD_SET_3WB, struct.pack('<BI', {'pwm': 0, 'spim': 1}[args.mode], args.period))
+
+def cmd_bench(args):
+    image  = read_image(args.image)
+    link   = Link(args.port, args.baudrate)
+    stages = ('host upload', 'upload', 'lz4', 'staging', 'reset', '3wb', '3wb stalled', 'verify', 'host total')
+    runs   = []
+    for _ in range(args.runs):
+        start = time.time()
+        link.load(image, lz4=args.lz4, boot=args.stream)
+        upload = time.time() - start
+        if args.stream:
+            link.wait_boot()
+        else:
+            link.request(CMD_BOOT, timeout=10.0, retries=1)
+        if args.scum_verify:
+            scum_verify(link)
+        total = time.time() - start
+        # firmware stages, 16MHz ticks
+        bench = struct.unpack('<8I', link.request(CMD_GET_BENCH))
+        if bench[0] != len(image):
+            sys.exit('benchmark report is for another load')
+        runs.append([upload * 1000] + [ticks / 16000.0 for ticks in bench[1:]] + [total * 1000])
+
+    # percentiles across runs, in ms
+    def percentile(values, p):
+        values = sorted(values)
+        return values[min(len(values) - 1, int(p * len(values)))]
+    print('{0:12s} {1:>9s} {2:>9s} {3:>9s}'.format('ms', 'p50', 'p90', 'max'))
+    for (i, stage) in enumerate(stages):
+        values = [run[i] for run in runs]
+        print('{0:12s} {1:9.2f} {2:9.2f} {3:9.2f}'.format(stage, percentile(values, 0.5), percentile(values, 0.9), max(values)))
+
+def cmd_prof(args):
+    link = Link(args.port, args.baudrate)
+    print('{0:17s} {1:>8s} {2:>8s} {3:>8s} {4:>8s}  cycles <64, <128, ..., >=4096'.format('cycles @64MHz', 'count', 'min', 'avg', 'max'))
+    for (i, name) in enumerate(PROF_NAMES):
+        stats = link.request(CMD_GET_PROF, bytes([i]))
+        (count, cmin, cmax, total) = struct.unpack('<4I', stats[:16])
+        hist  = struct.unpack('<8I', stats[16:48])
+        if count == 0:
+            continue
+        print('{0:17s} {1:8d} {2:8d} {3:8d} {4:8d}  {5}'.format(name, count, cmin, total // count, cmax, ' '.join(str(h) for h in hist)))
+    if args.reset:
+        link.request(CMD_RESET_PROF)
+
+def cmd_trace(args):
+    # RTT dump of 8-byte events, [cycles u32][id u8][arg8 u8][arg16 u16], 64MHz cycles
+    with open(args.dump, 'rb') as f:
+        data = f.read()
+    now  = 0
+    last = None
+    for i in range(0, len(data) - 7, 8):
+        (cycles, event, arg8, arg16) = struct.unpack('<IBBH', data[i:i+8])
+        if last is not None:
+            now += (cycles - last) & 0xffffffff
+        last = cycles
+        (name, describe) = TRACE_EVENTS.get(event, ('0x{0:02x}'.format(event), lambda a8, a16: '{0} {1}'.format(a8, a16)))
+        print('{0:12.3f}us  {1:12s} {2}'.format(now / 64.0, name, describe(arg8, arg16)))
+
+def cmd_bridge(args):
+    link  = Link(args.port, args.baudrate)
+    typed = queue.Queue()
+
+    def output(data):
+        sys.stdout.buffer.write(data)
+        sys.stdout.buffer.flush()
+
+    def read_stdin():
+        while True:
+            data = sys.stdin.buffer.read1(256)
+            if not data:
+                break
+            typed.put(data)
+
+    link.on_bridge_rx = output
+    link.request(CMD_BRIDGE_START, struct.pack('<I', args.scum_baudrate))
+    threading.Thread(target=read_stdin, daemon=True).start()
+    try:
+        while True:
+            link.receive(0.05)
+            while not typed.empty():
+                data = typed.get()
+                while data:
+                    (accepted,) = struct.unpack('<H', link.request(CMD_BRIDGE_TX, data[:256]))
+                    data = data[accepted:]
+                    if not accepted:
+                        time.sleep(0.01)       # SCuM's side of the bridge is full
+    except KeyboardInterrupt:
+        pass
+    link.on_bridge_rx = None
+    link.request(CMD_BRIDGE_STOP)
+
+def cmd_dbg(args):
+    link = Link(args.port, args.baudrate)
+    dbg  = link.request(CMD_GET_DBG)
+    for (i, val) in enumerate(struct.unpack('<{0}I'.format(len(dbg)//4), dbg)):
+        print('{0:3d} {1}'.format(i, val))
+
+#============================ main ============================================
+
+def main():
+    parser = argparse.ArgumentParser(description='SCuM programmer host tool')
+    sub    = parser.add_subparsers(dest='cmd', required=True)
+
+    p = sub.add_parser('usb-upload', help='upload an image over the vendor USB interface')
+    p.add_argument('image', help='raw binary SCuM image')
+    p.set_defaults(func=cmd_usb_upload)
+
+    serial = argparse.ArgumentParser(add_help=False)
+    serial.add_argument('-p', '--port', required=True, help='serial port, CDC-ACM or J-Link VCOM')
+    serial.add_argument('-b', '--baudrate', type=int, default=1000000)
+
+    p = sub.add_parser('version', parents=[serial], help='read the firmware version')
+    p.set_defaults(func=cmd_version)
+
+    p = sub.add_parser('load', parents=[serial], help='stream an image into the programmer, and verify it')
+    p.add_argument('image', help='raw binary SCuM image')
+    p.add_argument('--save', action='store_true', help='keep it in the programmer\'s flash afterwards')
+    p.add_argument('--upload', action='store_true', help='upload all of it, even if the programmer has it or part of it')
+    p.add_argument('--lz4', action='store_true', help='compress what is sent')
+    p.add_argument('--base-slot', type=int, help='send only what differs from this flash slot, default: from what is staged')
+    p.add_argument('--boot', action='store_true', help='load it into SCuM afterwards')
+    p.add_argument('--stream', action='store_true', help='load it into SCuM while uploading, implies --boot')
+    p.add_argument('--scum-verify', action='store_true', help='read SCuM\'s SRAM back afterwards, needs a verify stub on SCuM')
+    p.add_argument('--error-rate', type=float, default=0.0, help='corrupt this fraction of the chunks sent, to exercise retransmission')
+    p.set_defaults(func=cmd_load)
+
+    p = sub.add_parser('bench', parents=[serial], help='time each stage of uploading and loading an image, over several runs')
+    p.add_argument('image', help='raw binary SCuM image')
+    p.add_argument('-n', '--runs', type=int, default=10)
+    p.add_argument('--lz4', action='store_true', help='compress what is sent')
+    p.add_argument('--stream', action='store_true', help='load SCuM while uploading')
+    p.add_argument('--scum-verify', action='store_true', help='read SCuM\'s SRAM back too, needs a verify stub on SCuM')
+    p.set_defaults(func=cmd_bench)
+
+    p = sub.add_parser('verify', parents=[serial], help='length and CRC32 of the staged image')
+    p.add_argument('--scum', action='store_true', help='also compare it with SCuM\'s SRAM, needs a verify stub on SCuM')
+    p.set_defaults(func=cmd_verify)
+
+    p = sub.add_parser('boot', parents=[serial], help='load the staged image into SCuM over the 3WB')
+    p.set_defaults(func=cmd_boot)
+
+    p = sub.add_parser('save', parents=[serial], help='keep the staged image in the programmer\'s flash')
+    p.set_defaults(func=cmd_save)
+
+    p = sub.add_parser('store-boot', parents=[serial], help='load an image kept in flash into SCuM')
+    p.add_argument('--slot', type=int, help='default: the most recently used one')
+    p.set_defaults(func=cmd_store_boot)
+
+    p = sub.add_parser('list', parents=[serial], help='images kept in flash')
+    p.set_defaults(func=cmd_list)
+
+    p = sub.add_parser('calibrate', parents=[serial], help='toggle the calibration pin off the 32kHz crystal')
+    p.add_argument('--periods', type=int, default=100)
+    p.add_argument('--ticks', type=int, default=3277, help='half period, in 32768Hz ticks')
+    p.set_defaults(func=cmd_calibrate)
+
+    p = sub.add_parser('set-3wb', parents=[serial], help='3WB clocking')
+    p.add_argument('mode', choices=['pwm', 'spim'])
+    p.add_argument('period', type=int, help='bit period, in ns')
+    p.set_defaults(func=cmd_set_3wb)
+
+    p = sub.add_parser('prof', parents=[serial], help='cycles spent in each ISR and main loop task')
+    p.add_argument('--reset', action='store_true', help='clear the statistics after dumping them')
+    p.set_defaults(func=cmd_prof)
+
+    p = sub.add_parser('trace', help='decode an RTT trace dump into a timeline')
+    p.add_argument('dump', help='RTT channel 1, as saved by JLinkRTTLogger')
+    p.set_defaults(func=cmd_trace)
+
+    p = sub.add_parser('bridge', parents=[serial], help='pass SCuM\'s serial port through to the terminal, until Ctrl-C')
+    p.add_argument('--scum-baudrate', type=int, default=19200)
+    p.set_defaults(func=cmd_bridge)
+
+    p = sub.add_parser('dbg', parents=[serial], help='dump the debug counters')
+    p.set_defaults(func=cmd_dbg)
+
+    args = parser.parse_args()
+    args.func(args)
+
+if __name__ == '__main__':
+    main()